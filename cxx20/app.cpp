@@ -1,19 +1,57 @@
 #include "app.hpp"
+#include <chrono>
 #include <iostream>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 namespace project {
-    app::app(net::any_io_executor exec) : exec_(exec), signals_(exec, SIGINT, SIGHUP),
-                                   server_(exec) {}
+    namespace {
+        // Keep a shard on one core, so that its connections stay in that
+        // core's cache
+        void pin_to_core(std::size_t n) {
+#ifdef __linux__
+            auto cores = std::thread::hardware_concurrency();
+            if (cores == 0)
+                return;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(n % cores, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+        }
+    }
+
+    app::app(net::any_io_executor exec, std::size_t shards) : exec_(exec), signals_(exec, SIGINT, SIGHUP) {
+        for (std::size_t n = 0; n < shards; ++n)
+            shards_.push_back(std::make_unique< shard >(shards > 1));
+    }
 
     void app::handle_run() {
         signals_.async_wait([this](error_code ec, int sig) {
             if (!ec) {
                 std::cout << "signal: " << sig << std::endl;
-                server_.stop();
+                stop();
             }
         });
 
-        server_.run();
+        for (std::size_t n = 0; n < shards_.size(); ++n) {
+            auto &s = *shards_[n];
+            s.srv.run();
+            s.thread = std::jthread([&s, n] {
+                pin_to_core(n);
+                try
+                {
+                    s.ioc.run();
+                }
+                catch(std::exception& e)
+                {
+                    std::cout << "shard " << n << " bombed: " << e.what() << std::endl;
+                }
+            });
+        }
     }
 
     void app::run() {
@@ -22,5 +60,12 @@ namespace project {
             handle_run();
         }));
     }
-}
 
+    void app::stop() {
+        // DRAIN_BATCH_SIZE and DRAIN_TIMEOUT_MS tune the drain
+        auto settings = beast_fun_times::util::drain_settings::from_env();
+        auto deadline = std::chrono::steady_clock::now() + settings.timeout;
+        for (auto &s : shards_)
+            s->srv.stop(settings, deadline);
+    }
+}
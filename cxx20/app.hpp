@@ -3,23 +3,47 @@
 #include "config.hpp"
 #include "server.hpp"
 
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
 namespace project {
     /// The application object.
     /// There shall be one.
     /// So no need to be owned by a shared ptr
+    ///
+    /// Connections are served by shards. Each shard has its own io_context,
+    /// thread, acceptor and connection registry, and the kernel balances new
+    /// connections across the shards' acceptors (SO_REUSEPORT). A connection
+    /// never leaves its shard, so connections need neither strands nor locks.
     struct app {
-        app(net::any_io_executor exec);
+        app(net::any_io_executor exec, std::size_t shards = 1);
 
         void run();
 
+        /// Gracefully stop every shard.
+        /// The shards drain their connections in parallel, against one
+        /// deadline. The shards' threads are joined when the app is
+        /// destroyed.
+        void stop();
+
     private:
 
+        struct shard {
+            shard(bool shared) : ioc(1), srv(ioc.get_executor(), shared) {}
+
+            net::io_context ioc;
+            server srv;
+            std::jthread thread;
+        };
+
         void handle_run();
 
-        // The application's executor.
+        // The application's executor, which handles signals.
         // In a multi-threaded application this would be a strand.
         net::any_io_executor exec_;
         net::signal_set signals_;
-        server server_;
+        std::vector< std::unique_ptr< shard > > shards_;
     };
 }
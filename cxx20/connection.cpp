@@ -1,8 +1,7 @@
 #include "connection.hpp"
 
 #include "states.hpp"
-
-#include <iostream>
+#include "util/log.hpp"
 
 namespace project
 {
@@ -11,41 +10,77 @@ namespace project
     {
     }
 
+    connection_impl::~connection_impl()
+    {
+        beast_fun_times::util::server_metrics::local().closed.add();
+        if (on_close_)
+            on_close_();
+    }
+
+    void connection_impl::on_close(beast_fun_times::util::poly_handler< void() > f)
+    {
+        on_close_ = std::move(f);
+    }
+
     void connection_impl::run()
     {
         // callback which will happen zero or one times after websocket handshake
         // The rx state will not make progress until this function returns, so it should not block
         auto on_connect = [this]() {
-            net::co_spawn(
-                get_executor(),
-                [this]() -> net::awaitable< void > { co_await dequeue_send(txqueue, stream); },
-                spawn_handler("tx_state"));
+            net::co_spawn(get_executor(), dequeue_send(txqueue, stream), spawn_handler("tx_state"));
         };
 
         // callback which will happen zero or more times, as each message is received.
-        // The rx state will not make progress until this function returns, so it should not block
-        auto on_message = [this](std::string message) { this->send(std::move(message)); };
+        // The rx state will not make progress until the returned awaitable completes, so a peer which does not
+        // read its echoes will not be read from either. It returns the push operation itself rather than being a
+        // coroutine, so a message costs no extra coroutine frame. The echo is the received buffer itself, so it is
+        // not copied.
+        auto on_message = [this](beast_fun_times::util::shared_message message) {
+            quiet = false;
+            return txqueue.async_push(std::move(message));
+        };
 
-        net::co_spawn(
-            this->get_executor(),
-            [this, on_connect, on_message]() -> net::awaitable< void > {
-                co_await run_state(*this, on_connect, on_message);
-            },
-            spawn_handler("run"));
+        net::co_spawn(this->get_executor(), run_state(*this, on_connect, on_message), spawn_handler("run"));
     }
 
     void connection_impl::stop()
     {
-        net::co_spawn(
-            get_executor(),
-            [this]() -> net::awaitable< void > { co_await notify_error(net::error::operation_aborted); },
-            spawn_handler("stop"));
+        net::dispatch(get_executor(), [self = shared_from_this()] {
+            self->notify_error(net::error::operation_aborted, self->close_handler("stop"));
+        });
     }
 
-    void connection_impl::send(std::string msg)
+    void connection_impl::abort()
+    {
+        net::dispatch(get_executor(), [self = shared_from_this()] {
+            if (!self->ec)
+                self->ec = net::error::operation_aborted;
+            self->txqueue.stop();
+            auto ec = error_code();
+            beast::get_lowest_layer(self->stream).close(ec);
+        });
+    }
+
+    void connection_impl::send(beast_fun_times::util::shared_message msg, beast_fun_times::util::async_queue_lane lane)
     {
         // this will "happen" on the correct executor
-        txqueue.push(std::move(msg));
+        // If the peer is not keeping up, it's not going to catch up on a full queue, so drop it.
+        // A stopping connection's queue refuses everything, which is no cause for alarm.
+        if (!txqueue.try_push(std::move(msg), lane) && !ec)
+        {
+            UTIL_LOG_WARN("tx queue full: stopping connection");
+            stop();
+        }
+    }
+
+    void connection_impl::send(std::string msg, beast_fun_times::util::async_queue_lane lane)
+    {
+        send(beast_fun_times::util::shared_message(std::move(msg)), lane);
+    }
+
+    beast_fun_times::util::async_queue_snapshot connection_impl::tx_stats() const
+    {
+        return txqueue.snapshot();
     }
 
 }   // namespace project
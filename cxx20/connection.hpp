@@ -2,6 +2,8 @@
 
 #include "config.hpp"
 #include "states.hpp"
+#include "util/log.hpp"
+#include "util/poly_handler.hpp"
 
 #include <deque>
 #include <iostream>
@@ -24,6 +26,8 @@ namespace project
     {
         connection_impl(net::ip::tcp::socket sock);
 
+        ~connection_impl();
+
         //
         // external events
         //
@@ -36,11 +40,37 @@ namespace project
         void
         stop();
 
-        /// Queue a message to be sent at the earliest opportunity
+        /// Close the socket at once, without a websocket close handshake.
+        /// For connections which have not closed by a server's drain deadline.
+        void
+        abort();
+
+        /// Queue a message to be sent at the earliest opportunity.
+        /// Messages in the urgent lane overtake queued bulk messages.
+        /// If the tx queue is full, the connection is stopped.
+        void
+        send(beast_fun_times::util::shared_message   msg,
+             beast_fun_times::util::async_queue_lane lane =
+                 txqueue_t::bulk_lane);
+
+        void
+        send(std::string                             msg,
+             beast_fun_times::util::async_queue_lane lane =
+                 txqueue_t::bulk_lane);
+
+        /// Set a function to be called once, when the connection has closed
+        /// and is destroyed
         void
-        send(std::string msg);
+        on_close(beast_fun_times::util::poly_handler< void() > f);
+
+        /// The transmit queue's instrumentation. All zeroes unless built
+        /// with ENABLE_QUEUE_STATS.
+        beast_fun_times::util::async_queue_snapshot
+        tx_stats() const;
 
       private:
+        beast_fun_times::util::poly_handler< void() > on_close_;
+
         /// Construct a completion handler for any coroutine running in this
         /// implementation
         ///
@@ -60,7 +90,7 @@ namespace project
                 {
                     if (ep)
                         std::rethrow_exception(ep);
-                    std::cout << context << ": done\n";
+                    UTIL_LOG_DEBUG(context, ": done");
                 }
                 catch (system_error &se)
                 {
@@ -72,7 +102,7 @@ namespace project
                     }
                     else
                     {
-                        std::cout << context << ": graceful shutdown\n";
+                        UTIL_LOG_DEBUG(context, ": graceful shutdown");
                     }
                 }
                 catch (std::exception &e)
@@ -82,5 +112,21 @@ namespace project
                 }
             };
         }
+
+        /// Construct a completion handler for a plain asynchronous operation
+        /// in this implementation, which keeps it alive and logs the result
+        /// in the same way as spawn_handler
+        auto
+        close_handler(std::string_view context)
+        {
+            return [self = shared_from_this(), context](error_code ec) {
+                if (ec && ec != net::error::operation_aborted &&
+                    ec != websocket::error::closed)
+                    std::cout << context << ": error in " << context << " : "
+                              << ec.message() << std::endl;
+                else
+                    UTIL_LOG_DEBUG(context, ": done");
+            };
+        }
     };
 }   // namespace project
\ No newline at end of file
@@ -1,16 +1,42 @@
 #include "config.hpp"
 #include "app.hpp"
+#include "util/log.hpp"
 
+#include <algorithm>
+#include <charconv>
 #include <iostream>
+#include <string_view>
+#include <thread>
 
-int main()
+int main(int argc, char **argv)
 {
     using namespace project;
 
+    // per-message logging is at trace level: LOG_LEVEL=trace to see it
+    beast_fun_times::util::log_sink::instance().set_level_from_env();
+
+    // one shard per core, unless told otherwise
+    std::size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+    std::size_t shards = cores;
+    if (argc > 1)
+    {
+        auto arg = std::string_view(argv[1]);
+        auto r = std::from_chars(arg.data(), arg.data() + arg.size(), shards);
+        if (r.ec != std::errc() or r.ptr != arg.data() + arg.size() or shards == 0)
+        {
+            std::cerr << "usage: " << argv[0] << " [shards]\n"
+                      << "  shards: how many shards to serve on, at least 1. One per core by default.\n";
+            return 2;
+        }
+    }
+    // shards beyond a few per core only add contention
+    shards = std::min(shards, 4 * cores);
+
     net::io_context ioc;
 
-    auto the_app = app(ioc.get_executor());
+    auto the_app = app(ioc.get_executor(), shards);
     the_app.run();   // initiate async ops
+    std::cout << "serving on " << shards << " shard(s)" << std::endl;
 
     try
     {
@@ -19,5 +45,6 @@ int main()
     catch(std::exception& e)
     {
         std::cout << "program bombed: " << e.what();
+        the_app.stop();
     }
-}
\ No newline at end of file
+}
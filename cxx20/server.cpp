@@ -1,15 +1,34 @@
 #include "server.hpp"
 
+#include "util/buffer_pool.hpp"
+#include "util/log.hpp"
+#include "util/message_builder.hpp"
+#include "util/server_metrics.hpp"
+
+#include <chrono>
 #include <iostream>
+#include <utility>
+#include <vector>
 
 namespace project
 {
-    server::server(net::any_io_executor exec)
+    server::server(net::io_context::executor_type exec, bool shared)
     : acceptor_(exec)
+    , connection_exec_(net::require(exec, net::execution::allocator(beast_fun_times::util::recycling_allocator< void >())))
+    , connections_(std::make_shared< connection_registry >())
+    , hibernate_timer_(exec)
     {
         auto ep = net::ip::tcp::endpoint(net::ip::address_v4::any(), 4321);
         acceptor_.open(ep.protocol());
         acceptor_.set_option(net::ip::tcp::acceptor::reuse_address(true));
+        if (shared)
+        {
+#ifdef SO_REUSEPORT
+            acceptor_.set_option(reuse_port(true));
+#else
+            throw system_error(net::error::operation_not_supported, "SO_REUSEPORT");
+#endif
+        }
         acceptor_.bind(ep);
         acceptor_.listen();
     }
@@ -20,11 +39,15 @@ namespace project
             acceptor_.get_executor(),
             [this]() -> net::awaitable< void > { co_await this->handle_run(); },
             net::detached);
+
+        if (auto settings = beast_fun_times::util::hibernation_settings::from_env(); settings.enabled())
+            net::co_spawn(acceptor_.get_executor(), handle_hibernate(settings), net::detached);
     }
 
-    void server::stop()
+    void server::stop(beast_fun_times::util::drain_settings const &settings, std::chrono::steady_clock::time_point deadline)
     {
-        net::dispatch(net::bind_executor(acceptor_.get_executor(), [this] { this->handle_stop(); }));
+        net::dispatch(net::bind_executor(acceptor_.get_executor(),
+                                         [this, settings, deadline] { this->handle_stop(settings, deadline); }));
     }
 
     net::awaitable< void > server::handle_run()
@@ -32,34 +55,109 @@ namespace project
         while (!ec_)
             try
             {
-                auto sock = co_await acceptor_.async_accept(net::use_awaitable);
+                auto sock = co_await acceptor_.async_accept(connection_exec_, net::use_awaitable);
+                beast_fun_times::util::server_metrics::local().accepted.add();
                 auto ep   = sock.remote_endpoint();
-                auto conn = std::make_shared< connection_impl >(std::move(sock));
-                // cache the connection
-                connections_[ep] = conn;
+                auto conn = std::allocate_shared< connection_impl >(
+                    beast_fun_times::util::recycling_allocator< connection_impl >(), std::move(sock));
+                // cache the connection until it closes
+                auto handle = connections_->insert({ ep, conn });
+                conn->on_close([registry = std::weak_ptr(connections_), handle] {
+                    if (auto r = registry.lock())
+                        r->erase(handle);
+                });
                 conn->run();
-                conn->send("Welcome to my websocket server!\n");
-                conn->send("You are visitor number " + std::to_string(connections_.size()) + "\n");
-                conn->send("You connected from " + ep.address().to_string() + ":" + std::to_string(ep.port()) + "\n");
-                conn->send("Be good!\n");
+
+                // greetings which are the same for everyone are built once and shared. The rest are built into
+                // recycled buffers.
+                using beast_fun_times::util::make_message;
+                using beast_fun_times::util::shared_message;
+                static auto const welcome = shared_message("Welcome to my websocket server!\n");
+                static auto const be_good = shared_message("Be good!\n");
+                conn->send(welcome);
+                conn->send(make_message("You are visitor number ", ++visitors_, " (", connections_->size(), " connected)\n"));
+                conn->send(make_message("You connected from ", ep.address(), ':', ep.port(), '\n'));
+                conn->send(be_good);
             }
             catch (system_error &se)
             {
-                if (se.code() != net::error::connection_aborted)
+                // a stopped server's accept completes with operation_aborted
+                if (se.code() != net::error::connection_aborted && !ec_)
                     throw;
             }
     }
 
-    void server::handle_stop()
+    net::awaitable< void > server::handle_hibernate(beast_fun_times::util::hibernation_settings settings)
+    {
+        // A connection is quiet if it has received nothing in one whole period, so it hibernates between one and two
+        // periods after its last message
+        while (!ec_)
+        {
+            hibernate_timer_.expires_after(settings.quiet_period);
+            auto ec = error_code();
+            co_await hibernate_timer_.async_wait(net::redirect_error(net::use_awaitable, ec));
+            if (ec)
+                break;
+            for (auto &c : *connections_)
+                if (auto conn = c.conn.lock())
+                    conn->hibernate_if_quiet();
+        }
+    }
+
+    beast_fun_times::util::async_queue_snapshot server::tx_stats() const
     {
+        auto total = beast_fun_times::util::async_queue_snapshot();
+        for (auto &c : *connections_)
+            if (auto conn = c.conn.lock())
+                total += conn->tx_stats();
+        return total;
+    }
+
+    void server::handle_stop(beast_fun_times::util::drain_settings const &settings,
+                             std::chrono::steady_clock::time_point       deadline)
+    {
+#ifdef ENABLE_QUEUE_STATS
+        auto s = tx_stats();
+        std::cout << "tx queues: depth " << s.depth << ", high water " << s.high_water << ", enqueued " << s.enqueued
+                  << ", dequeued " << s.dequeued << ", p50 wait < " << s.latency_percentile(0.5).count()
+                  << "us, p99 wait < " << s.latency_percentile(0.99).count() << "us" << std::endl;
+#endif
+        using beast_fun_times::util::buffer_pool;
+        auto r = beast_fun_times::util::recycling_allocator_stats();
+        UTIL_LOG_DEBUG("recycled allocations: ", r.recycled, " of ", r.allocations, ", ", r.oversize,
+                       " too big to recycle");
+        auto b = buffer_pool::thread_stats();
+        UTIL_LOG_DEBUG("pooled buffers: ", b.recycled, " of ", b.allocations, " recycled, ", b.oversize,
+                       " too big to pool, ", buffer_pool::mapped_bytes() / 1024, "KiB mapped",
+                       buffer_pool::huge_pages() ? " in huge pages" : "");
+        // stop accepting first, so that the drain is not chasing new arrivals
         ec_ = net::error::operation_aborted;
-        acceptor_.cancel();
-        for (auto &[ep, weak_conn] : connections_)
-            if (auto conn = weak_conn.lock())
-            {
-                std::cout << "stopping connection on " << ep << std::endl;
-                conn->stop();
-            }
-        connections_.clear();
+        auto ec = error_code();
+        acceptor_.close(ec);
+        hibernate_timer_.cancel();
+
+        // Connections erase themselves from the registry as they close, so
+        // the drain works from a snapshot of it
+        auto live = std::vector< std::weak_ptr< connection_impl > >();
+        live.reserve(connections_->size());
+        for (auto &c : *connections_)
+            live.push_back(c.conn);
+        std::cout << "draining " << live.size() << " connections" << std::endl;
+
+        using beast_fun_times::util::drain_progress;
+        auto ms = [](auto d) { return std::chrono::duration_cast< std::chrono::milliseconds >(d).count(); };
+        beast_fun_times::util::async_drain(
+            acceptor_.get_executor(),
+            std::move(live),
+            settings,
+            deadline,
+            [ms](drain_progress const &p) {
+                std::cout << "draining: " << p.closed << " of " << p.total << " closed, " << p.stopping
+                          << " asked to close, " << ms(p.elapsed) << "ms" << std::endl;
+            },
+            [ms](drain_progress p) {
+                std::cout << "drained " << p.total << " connections in " << ms(p.elapsed) << "ms, " << p.aborted
+                          << " closed hard at the deadline" << std::endl;
+            });
     }
 }   // namespace project
\ No newline at end of file
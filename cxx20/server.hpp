@@ -3,52 +3,77 @@
 #include "config.hpp"
 #include "connection.hpp"
 
-#include <boost/functional/hash.hpp>
-#include <unordered_map>
+#include "util/drain.hpp"
+#include "util/hibernating_buffer.hpp"
+#include "util/recycling_allocator.hpp"
+#include "util/slab_registry.hpp"
+#include "util/wheel_timer.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
 
 namespace project
 {
-    struct endpoint_hasher
-    {
-        void combine(std::size_t &seed, net::ip::address const &v) const
-        {
-            if (v.is_v4())
-                boost::hash_combine(seed, v.to_v4().to_bytes());
-            else if (v.is_v6())
-                boost::hash_combine(seed, v.to_v6().to_bytes());
-            else if (v.is_unspecified())
-                boost::hash_combine(seed, 0x4751301174351161ul);
-            else
-                boost::hash_combine(seed, v.to_string());
-        }
-
-        std::size_t operator()(net::ip::tcp::endpoint const &ep) const
-        {
-            std::size_t seed = 0;
-            boost::hash_combine(seed, ep.port());
-            combine(seed, ep.address());
-            return seed;
-        }
-    };
+#ifdef SO_REUSEPORT
+    /// Allows several acceptors to bind the same port. The kernel spreads new
+    /// connections across them.
+    using reuse_port = net::detail::socket_option::boolean< SOL_SOCKET, SO_REUSEPORT >;
+#endif
 
+    /// Accepts connections on port 4321 and keeps a registry of them.
+    /// Everything, including the connections, runs on the server's executor.
+    ///
+    /// The connections, and the operations their executor runs, are allocated
+    /// from the thread's recycling cache, so that connection churn does not
+    /// go to the global heap.
+    ///
+    /// Connections which stay quiet for HIBERNATE_AFTER_MS (10s by default, 0
+    /// for never) give back their receive and staging buffers until their
+    /// next message.
     struct server
     {
-        server(net::any_io_executor exec);
+        /// \param shared if true, the port is bound with SO_REUSEPORT so that
+        /// other servers, each on its own thread, may accept on it too
+        server(net::io_context::executor_type exec, bool shared = false);
 
         void run();
 
-        void stop();
+        /// Stop accepting, then drain the connections: close them gracefully a
+        /// batch at a time, and hard any left at the deadline. Progress is
+        /// reported as counters rather than a line per connection.
+        void stop(beast_fun_times::util::drain_settings const &settings, std::chrono::steady_clock::time_point deadline);
+
+        /// The instrumentation of every live connection's transmit queue,
+        /// added together. Must be called on the server's executor.
+        beast_fun_times::util::async_queue_snapshot tx_stats() const;
 
       private:
         net::awaitable< void > handle_run();
 
-        void handle_stop();
+        net::awaitable< void > handle_hibernate(beast_fun_times::util::hibernation_settings settings);
+
+        void handle_stop(beast_fun_times::util::drain_settings const &settings,
+                         std::chrono::steady_clock::time_point       deadline);
 
       private:
+        struct registered_connection
+        {
+            net::ip::tcp::endpoint            ep;
+            std::weak_ptr< connection_impl > conn;
+        };
+
+        // Connections erase themselves when they close. The registry is
+        // shared with them so that one which outlives the server does not
+        // touch it.
+        using connection_registry = beast_fun_times::util::slab_registry< registered_connection >;
+
       private:
-        net::ip::tcp::acceptor acceptor_;
-        std::unordered_map< net::ip::tcp::endpoint, std::weak_ptr< connection_impl >, endpoint_hasher, std::equal_to<> >
-                   connections_;
-        error_code ec_;
+        net::ip::tcp::acceptor                 acceptor_;
+        net::any_io_executor                   connection_exec_;
+        std::shared_ptr< connection_registry > connections_;
+        beast_fun_times::util::wheel_timer     hibernate_timer_;
+        std::uint64_t                          visitors_ = 0;
+        error_code                             ec_;
     };
 }   // namespace project
\ No newline at end of file
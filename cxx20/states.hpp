@@ -1,11 +1,18 @@
 #pragma once
 #include "config.hpp"
 #include "util/async_queue.hpp"
+#include "util/coalescing_stream.hpp"
+#include "util/hibernating_buffer.hpp"
+#include "util/log.hpp"
+#include "util/metrics_response.hpp"
+#include "util/server_metrics.hpp"
+#include "util/shared_message.hpp"
 
 #include <deque>
-#include <iostream>
 #include <queue>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 
 namespace project
 {
@@ -13,44 +20,105 @@ namespace project
     ///
     /// Responsibilites:
     /// - Read messages and call on_msg (a function call) when a message has
-    /// been received
+    /// been received. If on_msg returns an awaitable, it is awaited before
+    /// the next read, which allows on_msg to apply backpressure.
+    /// - If on_msg accepts a shared_message, the message is handed over in
+    /// the buffer it was read into, without a copy. Otherwise on_msg is given
+    /// a std::string.
+    /// - Messages are read into rxbuffer, which holds no storage while
+    /// waiting for a message to start, so that the owner may hibernate it
+    /// between messages.
     /// @exception will throw a system_error if the websocket closes or there is
     /// a transport error
     template < class NextLayer, class OnMessage >
     net::awaitable< void >
-    websocket_rx_state(websocket::stream< NextLayer > &s, OnMessage &&on_msg)
+    websocket_rx_state(websocket::stream< NextLayer > &          s,
+                       beast_fun_times::util::hibernating_buffer &rxbuffer,
+                       OnMessage &&                              on_msg)
     try
     {
-        beast::flat_buffer rxbuffer;
+        using beast_fun_times::util::shared_message;
+        constexpr bool forwards = std::is_invocable_v< OnMessage &, shared_message >;
+        using message_type      = std::conditional_t< forwards, shared_message, std::string >;
+
         for (;;)
         {
-            auto bytes   = co_await s.async_read(rxbuffer);
-            auto message = beast::buffers_to_string(rxbuffer.data());
-            std::cout << " received: " << message << "\n";
-            rxbuffer.consume(message.size());
-            on_msg(std::move(message));
+            auto size = co_await beast_fun_times::util::async_read_message(s, rxbuffer, net::use_awaitable);
+            auto &metrics = beast_fun_times::util::server_metrics::local();
+            metrics.messages_in.add();
+            metrics.bytes_in.add(size);
+            auto message = [&] {
+                if constexpr (forwards)
+                    return shared_message::take(rxbuffer);
+                else
+                {
+                    auto message = beast::buffers_to_string(rxbuffer.data());
+                    rxbuffer.consume(message.size());
+                    rxbuffer.hibernate();
+                    return message;
+                }
+            }();
+            UTIL_LOG_TRACE("received: ", std::string_view(message.data(), message.size()));
+            if constexpr (std::is_same_v<
+                              std::invoke_result_t< OnMessage &, message_type >,
+                              net::awaitable< void > >)
+                co_await on_msg(std::move(message));
+            else
+                on_msg(std::move(message));
         }
     }
     catch (system_error &)
     {
         if (auto r = s.reason(); r)
-            std::cout << "connection closed with : " << r.reason << " : "
-                      << r.code << std::endl;
+            UTIL_LOG_DEBUG("connection closed with : ",
+                           std::string_view(r.reason.data(), r.reason.size()),
+                           " : ",
+                           unsigned(r.code));
     }
 
     /// Run the transmit state until the tx queue is stopped
     ///
-    template < class QueueExecutor, class Transport >
+    /// Every message that is ready is taken from the queue in one resumption,
+    /// rather than paying a post-and-resume cycle per message. Urgent
+    /// messages come first in each batch. Messages are written straight from
+    /// their shared payload.
+    ///
+    /// When a batch holds more than one message, the transport is corked so
+    /// that the batch's frames leave in one write to the socket rather than
+    /// one each.
+    template < class QueueExecutor, class QueueTraits, class Transport >
     net::awaitable< void >
     dequeue_send(
-        beast_fun_times::util::basic_async_queue< std::string, QueueExecutor >
-            &                           txqueue,
-        websocket::stream< Transport > &stream)
+        beast_fun_times::util::basic_async_queue<
+            beast_fun_times::util::shared_message,
+            QueueExecutor,
+            QueueTraits > &txqueue,
+        websocket::stream<
+            beast_fun_times::util::coalescing_stream< Transport > > &stream)
     {
         for (;;)
         {
-            co_await stream.async_write(
-                net::buffer(co_await txqueue.async_pop()));
+            auto batch = co_await txqueue.async_pop_all();
+            if (batch.size() > 1)
+                stream.next_layer().cork();
+
+            // always uncork, even on error: a close frame may be waiting in
+            // the staging buffer behind the batch
+            auto ec = error_code();
+            for (auto &message : batch)
+            {
+                co_await stream.async_write(
+                    message, net::redirect_error(net::use_awaitable, ec));
+                if (ec)
+                    break;
+                auto &metrics = beast_fun_times::util::server_metrics::local();
+                metrics.messages_out.add();
+                metrics.bytes_out.add(message.size());
+            }
+            if (stream.next_layer().corked())
+                co_await stream.next_layer().async_uncork();
+            if (ec)
+                throw system_error(ec);
         }
     }
 
@@ -76,11 +144,12 @@ namespace project
         using transport_template  = Transport;
         using awaitable_transport = typename net::use_awaitable_t<
             executor_type >::template as_default_on_t< transport_template >;
-        using stream_type = websocket::stream< awaitable_transport >;
+        using stream_type = websocket::stream<
+            beast_fun_times::util::coalescing_stream< awaitable_transport > >;
 
         chat_state(Transport t)
         : stream(std::move(t))
-        , txqueue(get_executor())
+        , txqueue(get_executor(), tx_limits)
         {
         }
 
@@ -90,11 +159,17 @@ namespace project
             return stream.get_executor();
         }
 
-        /// Coroutine to notify this state and any substates of a server-side
-        /// error. net::error::operation_aborted is the correct code to use for
-        /// a SIGNINT response
-        net::awaitable< void >
-        notify_error(error_code nec)
+        /// Notify this state and any substates of a server-side error.
+        /// net::error::operation_aborted is the correct code to use for a
+        /// SIGNINT response
+        ///
+        /// This is a plain function rather than a coroutine, so stopping a
+        /// connection costs no coroutine frame.
+        /// \param on_closed completion handler, void(error_code), for the
+        /// websocket close if one is started. It must keep this state alive.
+        template < class CloseHandler >
+        void
+        notify_error(error_code nec, CloseHandler &&on_closed)
         {
             assert(nec);
             if (!ec)
@@ -105,14 +180,14 @@ namespace project
                 case chat_state_base::initial_state:
                     break;
                 case chat_state_base::handshaking:
-                    stream.next_layer().cancel();
+                    beast::get_lowest_layer(stream).cancel();
                     txqueue.stop();
                     break;
                 case chat_state_base::chatting:
                     txqueue.stop();
-                    co_await stream.async_close(
+                    stream.async_close(
                         websocket::close_reason("shutting down"),
-                        net::use_awaitable);
+                        std::forward< CloseHandler >(on_closed));
                     break;
                 case chat_state_base::exit_state:
                     break;
@@ -120,19 +195,84 @@ namespace project
             }
         }
 
+        /// Give back the buffers of a connection which has received no
+        /// message since the last call, and is neither part way through
+        /// receiving one nor sending. Called periodically, on the
+        /// connection's executor. Returns true if anything was given back.
+        bool
+        hibernate_if_quiet()
+        {
+            if (!std::exchange(quiet, true))
+                return false;
+            auto rx = rxbuffer.hibernate();
+            auto tx = stream.next_layer().shrink_to_fit();
+            if (!rx && !tx)
+                return false;
+            beast_fun_times::util::server_metrics::local().hibernations.add();
+            return true;
+        }
+
         stream_type stream;
 
+        /// Messages are received into this. It holds no storage between
+        /// messages once the connection has hibernated.
+        beast_fun_times::util::hibernating_buffer rxbuffer;
+
+        /// Nothing has been received since the last hibernate_if_quiet
+        bool quiet = false;
+
         // substates
 
+        /// A peer which does not read what we send may not make us buffer
+        /// without limit
+        static constexpr auto tx_limits =
+            beast_fun_times::util::async_queue_limits { 1024, 1024 * 1024 };
+
+        /// Messages which must not wait behind a backlog of chat, such as
+        /// control messages, go in the urgent lane. A message sent to many
+        /// connections is queued to each without copying its payload.
+        struct tx_traits
+        : beast_fun_times::util::async_queue_traits<
+              beast_fun_times::util::shared_message >
+        {
+            static constexpr std::size_t lanes = 2;
+            // the queue's depth is kept in the server metrics
+#ifdef ENABLE_QUEUE_STATS
+            using stats_type = beast_fun_times::util::metered_queue_stats<
+                beast_fun_times::util::async_queue_stats >;
+#else
+            using stats_type = beast_fun_times::util::metered_queue_stats<>;
+#endif
+        };
+
         using queue_template =
-            beast_fun_times::util::basic_async_queue< std::string,
-                                                      executor_type >;
+            beast_fun_times::util::basic_async_queue<
+                beast_fun_times::util::shared_message,
+                executor_type,
+                tx_traits >;
         using txqueue_t = typename net::use_awaitable_t<
             executor_type >::template as_default_on_t< queue_template >;
         txqueue_t txqueue;
     };
 
+    /// Answer a plain HTTP request, such as a scrape of GET /metrics, and
+    /// close the connection
+    template < class Transport, class Request >
+    net::awaitable< void >
+    serve_http(chat_state< Transport > &state, Request const &request)
+    {
+        auto response = beast_fun_times::util::metrics_response(
+            request, beast_fun_times::util::server_metrics::instance().snapshot());
+        co_await http::async_write(state.stream.next_layer(), response, net::use_awaitable);
+        auto ec = error_code();
+        beast::get_lowest_layer(state.stream).shutdown(net::socket_base::shutdown_send, ec);
+    }
+
     /// Coroutine which runs the chat state
+    ///
+    /// The callbacks are moved into the coroutine frame, so the coroutine can
+    /// be handed straight to co_spawn without a wrapper coroutine to keep
+    /// them alive.
     /// \tparam Transport
     /// \tparam OnConnected
     /// \tparam OnMessage
@@ -143,27 +283,54 @@ namespace project
     template < class Transport, class OnConnected, class OnMessage >
     net::awaitable< void >
     run_state(chat_state< Transport > &state,
-              OnConnected &&           on_connected,
-              OnMessage &&             on_message)
+              OnConnected              on_connected,
+              OnMessage                on_message)
     try
     {
         assert(state.state == chat_state_base::initial_state);
         state.state = chat_state_base::handshaking;
-        co_await state.stream.async_accept();
+
+        // Read the request ourselves, so that a plain HTTP request can be
+        // answered on the same port. A websocket client sends nothing more
+        // until it has the handshake response, so the buffer holds nothing
+        // the websocket needs. A small body is allowed for, so that a request
+        // such as POST /metrics is refused rather than failing to parse.
+        auto parser = http::request_parser< http::string_body >();
+        parser.body_limit(beast_fun_times::util::max_http_request_body);
+        {
+            auto buffer = beast::flat_buffer();
+            co_await http::async_read(state.stream.next_layer(), buffer, parser, net::use_awaitable);
+        }
+        auto request = parser.release();
+        if (!websocket::is_upgrade(request))
+        {
+            co_await serve_http(state, request);
+            state.state = chat_state_base::exit_state;
+            state.txqueue.stop();
+            co_return;
+        }
+
+        co_await state.stream.async_accept(request, net::use_awaitable);
         if (state.ec)
             throw system_error(state.ec);
 
         state.state = chat_state_base::chatting;
         on_connected();
-        co_await websocket_rx_state(state.stream,
-                                    std::forward< OnMessage >(on_message));
+        co_await websocket_rx_state(state.stream, state.rxbuffer, on_message);
 
         state.state = chat_state_base::exit_state;
+        // nothing more can be sent, so let the tx state finish and release
+        // the connection
+        state.txqueue.stop();
         co_return;
     }
     catch (...)
     {
+        // a handshake which fails without our stopping it is the peer's
+        if (state.state == chat_state_base::handshaking && !state.ec)
+            beast_fun_times::util::server_metrics::local().handshake_failures.add();
         state.state = chat_state_base::exit_state;
+        state.txqueue.stop();
         throw;
     }
 }   // namespace project
\ No newline at end of file
@@ -0,0 +1,339 @@
+#include "util/async_queue.hpp"
+#include "util/testing/benchmark.hpp"
+
+#include <boost/version.hpp>
+#include <deque>
+#include <string>
+#include <thread>
+
+#if BOOST_VERSION >= 107800
+#include <boost/asio/experimental/channel.hpp>
+#include <boost/asio/experimental/concurrent_channel.hpp>
+#endif
+
+using namespace beast_fun_times::util;
+
+namespace
+{
+    /// Pushes the next value each time it is handed one, so that each
+    /// iteration is one push and one pop
+    struct echo_consumer
+    {
+        void
+        operator()(error_code ec, std::string s)
+        {
+            if (ec or --*remaining == 0)
+                return;
+            q->push(std::move(s));
+            q->async_pop(*this);
+        }
+
+        async_queue< std::string > *q;
+        std::size_t *               remaining;
+    };
+
+    /// Takes everything ready in each resumption. If refill is non-zero,
+    /// pushes that many more values each time.
+    struct batch_consumer
+    {
+        void
+        operator()(error_code ec, std::vector< std::string > batch)
+        {
+            if (ec)
+                return;
+            *remaining -= batch.size();
+            if (*remaining == 0)
+                return;
+            for (std::size_t i = 0; i < std::min(refill, *remaining); ++i)
+                q->push("x");
+            q->async_pop_all(*this);
+        }
+
+        async_queue< std::string > *q;
+        std::size_t *               remaining;
+        std::size_t                 refill;
+    };
+
+    /// One end of a round trip between two queues
+    struct volley
+    {
+        void
+        operator()(error_code ec, std::string s)
+        {
+            if (ec)
+                return;
+            if (remaining and --*remaining == 0)
+            {
+                out->stop();
+                return;
+            }
+            out->push(std::move(s));
+            in->async_pop(*this);
+        }
+
+        async_queue< std::string > *in;
+        async_queue< std::string > *out;
+        std::size_t *               remaining;   // null for the server end
+    };
+}   // namespace
+
+UTIL_BENCHMARK("async_queue", "push+pop, same executor")
+{
+    auto ioc       = net::io_context(1);
+    auto q         = async_queue< std::string >(ioc.get_executor());
+    auto remaining = iterations;
+    q.push("x");
+    q.async_pop(echo_consumer { &q, &remaining });
+    ioc.run();
+}
+
+UTIL_BENCHMARK("async_queue", "push+pop_all per item, batches of 64")
+{
+    auto ioc       = net::io_context(1);
+    auto q         = async_queue< std::string >(ioc.get_executor());
+    auto remaining = iterations;
+    for (std::size_t i = 0; i < std::min< std::size_t >(64, iterations); ++i)
+        q.push("x");
+    q.async_pop_all(batch_consumer { &q, &remaining, 64 });
+    ioc.run();
+}
+
+UTIL_BENCHMARK("async_queue", "push+pop_all per item, producer thread")
+{
+    auto ioc       = net::io_context(1);
+    auto q         = async_queue< std::string >(ioc.get_executor());
+    auto remaining = iterations;
+    q.async_pop_all(batch_consumer { &q, &remaining, 0 });
+    auto producer = std::thread([&q, iterations] {
+        for (std::size_t i = 0; i < iterations; ++i)
+            q.push("x");
+    });
+    ioc.run();
+    producer.join();
+}
+
+UTIL_BENCHMARK("async_queue", "round trip, two io_contexts")
+{
+    auto ioc1      = net::io_context(1);
+    auto ioc2      = net::io_context(1);
+    auto to1       = async_queue< std::string >(ioc1.get_executor());
+    auto to2       = async_queue< std::string >(ioc2.get_executor());
+    auto remaining = iterations;
+
+    to2.async_pop(volley { &to2, &to1, nullptr });
+    to1.async_pop(volley { &to1, &to2, &remaining });
+    auto server = std::thread([&ioc2] { ioc2.run(); });
+    to2.push("x");
+    ioc1.run();
+    server.join();
+}
+
+namespace
+{
+    /// The channel people built before asio had one: a deque of values, and
+    /// a timer which never expires, cancelled to wake the receiver. It is not
+    /// thread-safe, so a sender on another thread posts to its executor.
+    class timer_channel
+    {
+      public:
+        explicit timer_channel(net::any_io_executor exec)
+        : timer_(exec, net::steady_timer::time_point::max())
+        {
+        }
+
+        net::any_io_executor
+        get_executor()
+        {
+            return timer_.get_executor();
+        }
+
+        void
+        send(std::string s)
+        {
+            values_.push_back(std::move(s));
+            timer_.cancel_one();
+        }
+
+        void
+        close()
+        {
+            closed_ = true;
+            timer_.cancel();
+        }
+
+        template < class Handler >
+        void
+        async_receive(Handler h)
+        {
+            if (closed_ or not values_.empty())
+                net::post(get_executor(), [this, h = std::move(h)]() mutable {
+                    complete(h);
+                });
+            else
+                timer_.async_wait([this, h = std::move(h)](error_code) mutable {
+                    if (closed_ or not values_.empty())
+                        complete(h);
+                    else
+                        async_receive(std::move(h));
+                });
+        }
+
+      private:
+        template < class Handler >
+        void
+        complete(Handler &h)
+        {
+            if (closed_)
+                return h(net::error::operation_aborted, std::string());
+            auto s = std::move(values_.front());
+            values_.pop_front();
+            h(error_code(), std::move(s));
+        }
+
+        net::steady_timer         timer_;
+        std::deque< std::string > values_;
+        bool                      closed_ = false;
+    };
+
+    struct timer_channel_echo
+    {
+        void
+        operator()(error_code ec, std::string s)
+        {
+            if (ec or --*remaining == 0)
+                return;
+            ch->send(std::move(s));
+            ch->async_receive(*this);
+        }
+
+        timer_channel *ch;
+        std::size_t *  remaining;
+    };
+
+    struct timer_channel_volley
+    {
+        void
+        operator()(error_code ec, std::string s)
+        {
+            if (ec)
+                return;
+            auto last = remaining and --*remaining == 0;
+            net::post(out->get_executor(),
+                      [out = out, s = std::move(s), last]() mutable {
+                          if (last)
+                              out->close();
+                          else
+                              out->send(std::move(s));
+                      });
+            if (not last)
+                in->async_receive(*this);
+        }
+
+        timer_channel *in;
+        timer_channel *out;
+        std::size_t *  remaining;   // null for the server end
+    };
+}   // namespace
+
+UTIL_BENCHMARK("timer+deque", "send+receive, same executor")
+{
+    auto ioc       = net::io_context(1);
+    auto ch        = timer_channel(ioc.get_executor());
+    auto remaining = iterations;
+    ch.send("x");
+    ch.async_receive(timer_channel_echo { &ch, &remaining });
+    ioc.run();
+}
+
+UTIL_BENCHMARK("timer+deque", "round trip, two io_contexts")
+{
+    auto ioc1      = net::io_context(1);
+    auto ioc2      = net::io_context(1);
+    auto to1       = timer_channel(ioc1.get_executor());
+    auto to2       = timer_channel(ioc2.get_executor());
+    auto remaining = iterations;
+
+    to2.async_receive(timer_channel_volley { &to2, &to1, nullptr });
+    to1.async_receive(timer_channel_volley { &to1, &to2, &remaining });
+    auto server = std::thread([&ioc2] { ioc2.run(); });
+    net::post(ioc2, [&to2] { to2.send("x"); });
+    ioc1.run();
+    server.join();
+}
+
+// asio's own channels arrived in boost 1.78, after the version this project
+// pins, so they are measured only when built against a newer boost
+#if BOOST_VERSION >= 107800
+
+namespace
+{
+    using channel =
+        net::experimental::channel< void(error_code, std::string) >;
+    using concurrent_channel =
+        net::experimental::concurrent_channel< void(error_code, std::string) >;
+
+    template < class Channel >
+    struct channel_echo
+    {
+        void
+        operator()(error_code ec, std::string s)
+        {
+            if (ec or --*remaining == 0)
+                return;
+            ch->try_send(error_code(), std::move(s));
+            ch->async_receive(*this);
+        }
+
+        Channel *    ch;
+        std::size_t *remaining;
+    };
+
+    struct channel_volley
+    {
+        void
+        operator()(error_code ec, std::string s)
+        {
+            if (ec)
+                return;
+            if (remaining and --*remaining == 0)
+            {
+                out->close();
+                return;
+            }
+            out->async_send(error_code(), std::move(s), [](error_code) {});
+            in->async_receive(*this);
+        }
+
+        concurrent_channel *in;
+        concurrent_channel *out;
+        std::size_t *       remaining;
+    };
+}   // namespace
+
+UTIL_BENCHMARK("channel", "send+receive, same executor")
+{
+    auto ioc       = net::io_context(1);
+    auto ch        = channel(ioc.get_executor(), 1);
+    auto remaining = iterations;
+    ch.try_send(error_code(), "x");
+    ch.async_receive(channel_echo< channel > { &ch, &remaining });
+    ioc.run();
+}
+
+UTIL_BENCHMARK("channel", "round trip, two io_contexts (concurrent)")
+{
+    auto ioc1      = net::io_context(1);
+    auto ioc2      = net::io_context(1);
+    auto to1       = concurrent_channel(ioc1.get_executor(), 1);
+    auto to2       = concurrent_channel(ioc2.get_executor(), 1);
+    auto remaining = iterations;
+
+    to2.async_receive(channel_volley { &to2, &to1, nullptr });
+    to1.async_receive(channel_volley { &to1, &to2, &remaining });
+    auto server = std::thread([&ioc2] { ioc2.run(); });
+    to2.async_send(error_code(), "x", [](error_code) {});
+    ioc1.run();
+    server.join();
+}
+
+#endif
@@ -1,23 +1,64 @@
 #pragma once
+#include "async_queue_traits.hpp"
 #include "detail/async_queue_impl.hpp"
 #include "net.hpp"
 
+#include <limits>
+#include <vector>
+
 namespace beast_fun_times::util
 {
-    template < class T, class Executor >
+    /// An asynchronous queue of T.
+    ///
+    /// Any number of producers, on any thread, may push. Any number of
+    /// consumers, on any executors, may wait for elements. Each element is
+    /// delivered to exactly one waiting consumer, and consumers are served in
+    /// the order in which they began to wait, so one queue can feed a pool of
+    /// workers.
+    ///
+    /// If Traits has more than one lane, each push names the lane it pushes
+    /// onto. Urgent elements are delivered ahead of bulk ones, but never
+    /// split one: consumers receive whole elements.
+    ///
+    /// Waits on an element which is already in the queue may complete
+    /// immediately: see async_pop.
+    ///
+    /// If Traits selects async_queue_stats, the queue measures its depth and
+    /// how long elements wait in it: see snapshot.
+    ///
+    /// A queue constructed with limits is bounded. Producers which must not
+    /// outrun the consumer use async_push, which suspends them while the
+    /// queue is full, or try_push, which fails instead. push always succeeds,
+    /// but the elements it adds count towards the limits.
+    ///
+    /// @tparam Traits see async_queue_traits
+    template < class T,
+               class Executor,
+               class Traits = async_queue_traits< T > >
     struct basic_async_queue
     {
         using executor_type = Executor;
+        using traits_type   = Traits;
 
         template < class OtherExec >
         struct rebind_executor
         {
-            using other = basic_async_queue< T, OtherExec >;
+            using other = basic_async_queue< T, OtherExec, Traits >;
         };
 
         using value_type = T;
 
-        basic_async_queue(executor_type exec);
+        /// The type delivered by async_pop_some and async_pop_all
+        using batch_type = std::vector< T >;
+
+        /// The most urgent lane
+        static constexpr async_queue_lane urgent_lane = async_queue_lane::urgent;
+
+        /// The least urgent lane, used by pushes which do not name a lane
+        static constexpr async_queue_lane bulk_lane =
+            async_queue_lane(Traits::lanes - 1);
+
+        basic_async_queue(executor_type exec, async_queue_limits limits = {});
         basic_async_queue(basic_async_queue &&other);
         basic_async_queue &
         operator=(basic_async_queue &&other);
@@ -26,8 +67,20 @@ namespace beast_fun_times::util
         /// Initiate an asynchronous wait on the queue.
         ///
         /// The function will return immediately. The WaitHandler will be
-        /// invoked, as if by post on its associated executor when an in the
-        /// queue is ready for delivery
+        /// invoked, as if by post on its associated executor, when an item in
+        /// the queue is ready for delivery to it. This function is
+        /// thread-safe.
+        ///
+        /// There is one exception. If this function is called from a
+        /// function running on the queue's executor, the handler's
+        /// associated executor is the queue's executor, no other consumer is
+        /// waiting and an item is ready, the handler is invoked before this
+        /// function returns. The queue must be able to tell where it is
+        /// running, which it can for io_context executors and strands.
+        /// A coroutine draining a busy queue therefore does not yield to
+        /// the event loop for every element. Such immediate completions
+        /// nest a bounded number of times on each thread, after which one
+        /// is posted.
         ///
         /// @tparam WaitHandler A completion token
         /// or handler whose signature matches void(error_code, T)
@@ -42,20 +95,117 @@ namespace beast_fun_times::util
         async_pop(WaitHandler &&handler
                       BOOST_ASIO_DEFAULT_COMPLETION_TOKEN(executor_type));
 
+        /// Initiate an asynchronous wait for a batch of items.
+        ///
+        /// The function will return immediately. When at least one item is
+        /// ready, the WaitHandler will be invoked, as if by post on its
+        /// associated executor, with every ready item up to max_items.
+        /// A consumer woken with many queued items therefore handles them all
+        /// in one resumption rather than one resumption per item. It may
+        /// complete immediately, under the same conditions as async_pop.
+        ///
+        /// @param max_items The maximum number of items to deliver. Must be
+        /// greater than zero.
+        /// @param handler A completion token or handler whose signature
+        /// matches void(error_code, batch_type)
+        /// @return DEDUCED
+        template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, batch_type))
+                       WaitHandler BOOST_ASIO_DEFAULT_COMPLETION_TOKEN_TYPE(
+                           executor_type) >
+        BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler,
+                                           void(error_code, batch_type))
+        async_pop_some(std::size_t max_items,
+                       WaitHandler &&handler
+                           BOOST_ASIO_DEFAULT_COMPLETION_TOKEN(executor_type));
+
+        /// Initiate an asynchronous wait for every ready item.
+        ///
+        /// Equivalent to async_pop_some with no limit.
+        template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, batch_type))
+                       WaitHandler BOOST_ASIO_DEFAULT_COMPLETION_TOKEN_TYPE(
+                           executor_type) >
+        BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler,
+                                           void(error_code, batch_type))
+        async_pop_all(WaitHandler &&handler
+                          BOOST_ASIO_DEFAULT_COMPLETION_TOKEN(executor_type));
+
         /// Push an item onto the queue.
         /// This function will return quickly, and delivery of the payload is
-        /// not guaranteed to have heppened before the function returns. \param
-        /// arg the value to push onto the queue.
+        /// not guaranteed to have heppened before the function returns.
+        ///
+        /// This function is thread-safe. Producers on any thread append to a
+        /// lock-free list. The consumer is woken at most once per batch of
+        /// pushes, not once per item. The item is discarded if the queue has
+        /// been stopped.
+        /// \param arg the value to push onto the queue.
+        /// \param lane the lane to push onto
+        void
+        push(T arg, async_queue_lane lane = bulk_lane);
+
+        /// Push an item onto the queue if there is room for it.
+        ///
+        /// This function is thread-safe and never blocks.
+        /// @return true if the item was pushed. If false, because the queue is
+        /// full or has been stopped, the item has not been moved from.
+        bool
+        try_push(T &&arg, async_queue_lane lane = bulk_lane);
+
+        /// Initiate an asynchronous push onto the queue.
+        ///
+        /// If there is room in the queue, the item is pushed immediately.
+        /// Otherwise the operation is suspended until the consumer has made
+        /// room for it. Suspended producers are admitted in the order in which
+        /// they arrived, ahead of any subsequent try_push. The PushHandler
+        /// will be invoked, as if by post, when the item has been pushed or
+        /// the queue has been stopped. If the queue is stopped while the item
+        /// is being pushed, the handler gets operation_aborted, as the item
+        /// may have been discarded.
+        ///
+        /// @param arg the value to push onto the queue
+        /// @param handler A completion token or handler whose signature
+        /// matches void(error_code)
+        /// @return DEDUCED
+        template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code))
+                       PushHandler BOOST_ASIO_DEFAULT_COMPLETION_TOKEN_TYPE(
+                           executor_type) >
+        BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(PushHandler, void(error_code))
+        async_push(T arg,
+                   PushHandler &&handler
+                       BOOST_ASIO_DEFAULT_COMPLETION_TOKEN(executor_type));
+
+        /// Initiate an asynchronous push onto the given lane of the queue.
+        template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code))
+                       PushHandler BOOST_ASIO_DEFAULT_COMPLETION_TOKEN_TYPE(
+                           executor_type) >
+        BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(PushHandler, void(error_code))
+        async_push(T                arg,
+                   async_queue_lane lane,
+                   PushHandler &&handler
+                       BOOST_ASIO_DEFAULT_COMPLETION_TOKEN(executor_type));
+
+        /// Push a range of items onto the queue.
+        /// The items are copied (use std::make_move_iterator to move them) and
+        /// published to the consumer together, in order, with a single atomic
+        /// operation. Nothing is pushed if the queue has been stopped. This
+        /// function is thread-safe.
+        template < class InputIterator >
         void
-        push(T arg);
+        push_range(InputIterator    first,
+                   InputIterator    last,
+                   async_queue_lane lane = bulk_lane);
 
         /// Put the queue into an error state, clear data from the queue and
-        /// cause all subsequent async_wait operations to fail
+        /// cause all current and subsequent waits and pushes to fail
         void
         stop();
 
+        /// A copy of the queue's instrumentation. All zeroes unless Traits
+        /// selects async_queue_stats. This function is thread-safe.
+        async_queue_snapshot
+        snapshot() const noexcept;
+
       private:
-        using impl_class          = detail::async_queue_impl< T, Executor >;
+        using impl_class = detail::async_queue_impl< T, Executor, Traits >;
         using implementation_type = typename impl_class::ptr;
 
       private:
@@ -69,22 +219,24 @@ namespace beast_fun_times::util
 
 namespace beast_fun_times::util
 {
-    template < class T, class Executor >
-    basic_async_queue< T, Executor >::basic_async_queue(Executor exec)
-    : impl_(impl_class::construct(exec))
+    template < class T, class Executor, class Traits >
+    basic_async_queue< T, Executor, Traits >::basic_async_queue(
+        Executor exec, async_queue_limits limits)
+    : impl_(impl_class::construct(exec, limits))
     {
     }
 
-    template < class T, class Executor >
-    basic_async_queue< T, Executor >::basic_async_queue(
+    template < class T, class Executor, class Traits >
+    basic_async_queue< T, Executor, Traits >::basic_async_queue(
         basic_async_queue &&other)
     : impl_(std::exchange(other.impl_, nullptr))
     {
     }
 
-    template < class T, class Executor >
+    template < class T, class Executor, class Traits >
     auto
-    basic_async_queue< T, Executor >::operator=(basic_async_queue &&other)
+    basic_async_queue< T, Executor, Traits >::operator=(
+        basic_async_queue &&other)
         -> basic_async_queue &
     {
         auto tmp = std::move(other);
@@ -92,35 +244,107 @@ namespace beast_fun_times::util
         return *this;
     }
 
-    template < class T, class Executor >
-    basic_async_queue< T, Executor >::~basic_async_queue()
+    template < class T, class Executor, class Traits >
+    basic_async_queue< T, Executor, Traits >::~basic_async_queue()
     {
         if (impl_)
             impl_->stop();
     }
 
-    template < class T, class Executor >
+    template < class T, class Executor, class Traits >
     template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, value_type))
                    WaitHandler >
     BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler,
                                        void(error_code, value_type))
-    basic_async_queue< T, Executor >::async_pop(WaitHandler &&handler)
+    basic_async_queue< T, Executor, Traits >::async_pop(WaitHandler &&handler)
     {
         return impl_->async_pop(std::forward< WaitHandler >(handler));
     }
 
-    template < class T, class Executor >
+    template < class T, class Executor, class Traits >
+    template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, batch_type))
+                   WaitHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler,
+                                       void(error_code, batch_type))
+    basic_async_queue< T, Executor, Traits >::async_pop_some(
+        std::size_t max_items, WaitHandler &&handler)
+    {
+        return impl_->async_pop_some(max_items,
+                                     std::forward< WaitHandler >(handler));
+    }
+
+    template < class T, class Executor, class Traits >
+    template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, batch_type))
+                   WaitHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler,
+                                       void(error_code, batch_type))
+    basic_async_queue< T, Executor, Traits >::async_pop_all(
+        WaitHandler &&handler)
+    {
+        return impl_->async_pop_some(std::numeric_limits< std::size_t >::max(),
+                                     std::forward< WaitHandler >(handler));
+    }
+
+    template < class T, class Executor, class Traits >
+    void
+    basic_async_queue< T, Executor, Traits >::push(value_type       v,
+                                                   async_queue_lane lane)
+    {
+        return impl_->push(std::move(v), std::size_t(lane));
+    }
+
+    template < class T, class Executor, class Traits >
+    bool
+    basic_async_queue< T, Executor, Traits >::try_push(value_type &&    v,
+                                                       async_queue_lane lane)
+    {
+        return impl_->try_push(std::move(v), std::size_t(lane));
+    }
+
+    template < class T, class Executor, class Traits >
+    template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code)) PushHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(PushHandler, void(error_code))
+    basic_async_queue< T, Executor, Traits >::async_push(value_type     v,
+                                                         PushHandler &&handler)
+    {
+        return impl_->async_push(std::move(v),
+                                 std::size_t(bulk_lane),
+                                 std::forward< PushHandler >(handler));
+    }
+
+    template < class T, class Executor, class Traits >
+    template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code)) PushHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(PushHandler, void(error_code))
+    basic_async_queue< T, Executor, Traits >::async_push(value_type       v,
+                                                         async_queue_lane lane,
+                                                         PushHandler &&handler)
+    {
+        return impl_->async_push(std::move(v),
+                                 std::size_t(lane),
+                                 std::forward< PushHandler >(handler));
+    }
+
+    template < class T, class Executor, class Traits >
+    template < class InputIterator >
     void
-    basic_async_queue< T, Executor >::push(value_type v)
+    basic_async_queue< T, Executor, Traits >::push_range(
+        InputIterator first, InputIterator last, async_queue_lane lane)
     {
-        return impl_->push(std::move(v));
+        return impl_->push_range(first, last, std::size_t(lane));
     }
 
-    template < class T, class Executor >
+    template < class T, class Executor, class Traits >
     void
-    basic_async_queue< T, Executor >::stop()
+    basic_async_queue< T, Executor, Traits >::stop()
     {
         return impl_->stop();
     }
 
+    template < class T, class Executor, class Traits >
+    async_queue_snapshot
+    basic_async_queue< T, Executor, Traits >::snapshot() const noexcept
+    {
+        return impl_->stats().snapshot();
+    }
+
 }   // namespace beast_fun_times::util
\ No newline at end of file
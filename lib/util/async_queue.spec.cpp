@@ -1,9 +1,35 @@
 #include <catch2/catch.hpp>
 
 #include "async_queue.hpp"
+#include "recycling_allocator.hpp"
+#include "testing/allocation_counter.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <thread>
+#include <vector>
 
 using namespace beast_fun_times::util;
 
+namespace
+{
+    struct two_lanes : async_queue_traits<std::string>
+    {
+        static constexpr std::size_t lanes = 2;
+    };
+
+    struct instrumented : async_queue_traits<std::string>
+    {
+        using stats_type = async_queue_stats;
+    };
+
+    // uninstrumented queues pay nothing per element
+    static_assert(sizeof(detail::async_queue_node<std::string, null_async_queue_stats::stamp>) ==
+                  sizeof(void *) + sizeof(std::string));
+}
+
 TEST_CASE("async_queue")
 {
     auto ioc = net::io_context(1);
@@ -38,6 +64,16 @@ TEST_CASE("async_queue")
         });
     };
 
+    std::vector<std::string> batch;
+
+    auto make_batch_handler = [&]()
+    {
+        return net::bind_executor(e2, [&](error_code ec, std::vector<std::string> b) {
+            error = ec;
+            batch = std::move(b);
+        });
+    };
+
     SECTION("stop")
     {
         q.async_pop(make_handler());
@@ -55,7 +91,8 @@ TEST_CASE("async_queue")
         q.push("a");
         q.push("b");
         q.push("c");
-        CHECK(poll(ioc) == 3);
+        // nobody is waiting, so nobody is woken
+        CHECK(poll(ioc) == 0);
 
         q.async_pop(make_handler());
         CHECK(poll(ioc) == 1);
@@ -80,4 +117,517 @@ TEST_CASE("async_queue")
 
     }
 
-}
\ No newline at end of file
+    SECTION("waiting consumer")
+    {
+        q.async_pop(make_handler());
+        CHECK(poll(ioc) == 1);
+
+        // the first push wakes the consumer, the second rides along with it
+        q.push("a");
+        q.push("b");
+        CHECK(poll(ioc) == 1);
+        CHECK(run(ioc2) == 1);
+        CHECK(value == "a");
+    }
+
+    SECTION("many waiters")
+    {
+        auto got = std::vector<std::string>();
+        auto make_worker = [&](std::string name)
+        {
+            return net::bind_executor(e2, [&got, name](error_code ec, std::string s) {
+                got.push_back(name + ":" + (ec ? ec.message() : s));
+            });
+        };
+
+        q.async_pop(make_worker("w1"));
+        q.async_pop(make_worker("w2"));
+        q.async_pop(make_worker("w3"));
+        poll(ioc);
+
+        // each item goes to exactly one waiter, in the order they arrived
+        q.push("a");
+        q.push("b");
+        poll(ioc);
+        // w3 is still waiting, and keeping ioc2 busy, so poll rather than run
+        CHECK(poll(ioc2) == 2);
+        CHECK(got == std::vector<std::string>{"w1:a", "w2:b"});
+
+        // stopping the queue wakes every waiter
+        q.async_pop(make_worker("w4"));
+        q.stop();
+        poll(ioc);
+        CHECK(run(ioc2) == 2);
+        CHECK(got == std::vector<std::string>{"w1:a", "w2:b",
+                                              "w3:Operation canceled",
+                                              "w4:Operation canceled"});
+    }
+
+    SECTION("worker pool")
+    {
+        // Workers on a thread pool share the items pushed onto one queue.
+        constexpr int items = 10000;
+        auto seen = std::vector<std::atomic<int>>(items);
+        auto received = std::atomic<int>(0);
+        auto pool = net::thread_pool(4);
+
+        struct worker
+        {
+            void
+            operator()(error_code ec, std::string s)
+            {
+                if (ec)
+                    return;
+                ++(*seen)[std::stoi(s)];
+                ++*received;
+                q->async_pop(net::bind_executor(exec, *this));
+            }
+
+            async_queue<std::string> *q;
+            net::thread_pool::executor_type exec;
+            std::vector<std::atomic<int>> *seen;
+            std::atomic<int> *received;
+        };
+
+        net::any_io_executor work =
+            net::prefer(e, net::execution::outstanding_work.tracked);
+        auto consumer_thread = std::thread([&] { ioc.run(); });
+        for (int w = 0; w < 4; ++w)
+            q.async_pop(net::bind_executor(
+                pool.get_executor(),
+                worker { &q, pool.get_executor(), &seen, &received }));
+        for (int i = 0; i < items; ++i)
+            q.push(std::to_string(i));
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (received < items and std::chrono::steady_clock::now() < deadline)
+            std::this_thread::yield();
+        q.stop();
+        pool.join();
+        work = net::any_io_executor();
+        consumer_thread.join();
+
+        CHECK(received == items);
+        CHECK(std::all_of(seen.begin(), seen.end(), [](auto &n) { return n == 1; }));
+    }
+
+    SECTION("lanes")
+    {
+        using lane_queue_t = basic_async_queue<std::string, net::any_io_executor, two_lanes>;
+        auto lq = lane_queue_t(e);
+
+        lq.push("bulk 1");
+        lq.push("bulk 2");
+        lq.push("urgent 1", lq.urgent_lane);
+        CHECK(lq.try_push("urgent 2", lq.urgent_lane));
+        lq.push("bulk 3", lq.bulk_lane);
+
+        // a single pop takes the most urgent element
+        lq.async_pop(make_handler());
+        poll(ioc);
+        CHECK(run(ioc2) == 1);
+        CHECK(value == "urgent 1");
+
+        // a batch is ordered by lane, then by push order
+        lq.async_pop_all(make_batch_handler());
+        poll(ioc);
+        CHECK(run(ioc2) == 1);
+        CHECK(batch == std::vector<std::string>{"urgent 2", "bulk 1", "bulk 2", "bulk 3"});
+    }
+
+    SECTION("immediate completion")
+    {
+        // A consumer on the queue's own executor which waits again from its
+        // handler. Values which are already queued are handed over before
+        // async_pop returns, but only so many times in a row.
+        struct consumer
+        {
+            void
+            operator()(error_code ec, std::string s)
+            {
+                if (ec)
+                    return;
+                received->push_back(s);
+                if (s == "99")
+                    return;
+                *max_depth = std::max(*max_depth, ++*depth);
+                q->async_pop(*this);
+                --*depth;
+            }
+
+            async_queue<std::string> *q;
+            std::vector<std::string> *received;
+            int *depth;
+            int *max_depth;
+        };
+
+        auto received = std::vector<std::string>();
+        int depth = 0;
+        int max_depth = 0;
+        for (int i = 0; i < 100; ++i)
+            q.push(std::to_string(i));
+
+        // from outside the queue's executor nothing completes immediately
+        q.async_pop(consumer { &q, &received, &depth, &max_depth });
+        CHECK(received.empty());
+
+        run(ioc);
+        REQUIRE(received.size() == 100);
+        CHECK(received.front() == "0");
+        CHECK(received.back() == "99");
+        CHECK(max_depth > 1);
+        CHECK(max_depth <= 17);
+
+        // a handler bound to another executor is always posted
+        q.push("x");
+        net::post(e, [&] { q.async_pop(make_handler()); });
+        run(ioc);
+        CHECK(value == "");
+        CHECK(run(ioc2) == 1);
+        CHECK(value == "x");
+
+        q.stop();
+        run(ioc);
+    }
+
+    SECTION("stats")
+    {
+        using stats_queue_t = basic_async_queue<std::string, net::any_io_executor, instrumented>;
+        auto sq = stats_queue_t(e);
+
+        sq.push("a");
+        auto range = std::vector<std::string>{"b", "c", "d"};
+        sq.push_range(range.begin(), range.end());
+        auto s = sq.snapshot();
+        CHECK(s.enqueued == 4);
+        CHECK(s.depth == 4);
+        CHECK(s.high_water == 4);
+
+        sq.async_pop(make_handler());
+        poll(ioc);
+        CHECK(run(ioc2) == 1);
+        sq.async_pop_some(2, make_batch_handler());
+        poll(ioc);
+        CHECK(run(ioc2) == 1);
+        s = sq.snapshot();
+        CHECK(s.dequeued == 3);
+        CHECK(s.depth == 1);
+        CHECK(s.high_water == 4);
+        CHECK(std::accumulate(s.latency.begin(), s.latency.end(), std::uint64_t(0)) == 3);
+        CHECK(s.latency_percentile(1.0) > std::chrono::microseconds(0));
+
+        // stopping the queue discards what is left
+        sq.stop();
+        poll(ioc);
+        s = sq.snapshot();
+        CHECK(s.discarded == 1);
+        CHECK(s.depth == 0);
+
+        using std::chrono::microseconds;
+        CHECK(async_queue_snapshot::latency_bucket(std::chrono::nanoseconds(500)) == 0);
+        CHECK(async_queue_snapshot::latency_bucket(microseconds(1)) == 1);
+        CHECK(async_queue_snapshot::latency_bucket(microseconds(3)) == 2);
+        CHECK(async_queue_snapshot::latency_bound(2) == microseconds(4));
+        CHECK(async_queue_snapshot::latency_bucket(std::chrono::hours(1)) ==
+              async_queue_snapshot::latency_buckets - 1);
+
+        // snapshots of several queues aggregate
+        auto total = async_queue_snapshot();
+        total += s;
+        total += s;
+        CHECK(total.enqueued == 8);
+        CHECK(total.high_water == 4);
+
+        // an uninstrumented queue reports nothing
+        q.push("x");
+        CHECK(q.snapshot().enqueued == 0);
+    }
+
+    SECTION("foreign thread producers")
+    {
+        constexpr int producers = 4;
+        constexpr int per_producer = 1000;
+
+        auto threads = std::vector<std::thread>();
+        for (int p = 0; p < producers; ++p)
+            threads.emplace_back([&q, p] {
+                for (int i = 0; i < per_producer; ++i)
+                    q.push(std::to_string(p) + ":" + std::to_string(i));
+            });
+        for (auto &t : threads)
+            t.join();
+
+        // however the pushes interleaved, nobody was waiting, so the consumer
+        // was not woken at all
+        CHECK(poll(ioc) == 0);
+
+        int next[producers] = {};
+        for (int i = 0; i < producers * per_producer; ++i)
+        {
+            q.async_pop(make_handler());
+            CHECK(poll(ioc) == 1);
+            CHECK(run(ioc2) == 1);
+            REQUIRE(error.message() == "Success");
+            auto colon = value.find(':');
+            auto p = std::stoi(value.substr(0, colon));
+            auto n = std::stoi(value.substr(colon + 1));
+            // each producer's items arrive in the order they were pushed
+            REQUIRE(n == next[p]);
+            ++next[p];
+        }
+    }
+
+    SECTION("batches")
+    {
+        auto source = std::vector<std::string>();
+        for (int i = 0; i < 500; ++i)
+            source.push_back(std::to_string(i));
+
+        q.push_range(source.begin(), source.end());
+        q.push("500");
+        CHECK(poll(ioc) == 0);
+
+        q.async_pop_some(10, make_batch_handler());
+        CHECK(poll(ioc) == 1);
+        CHECK(run(ioc2) == 1);
+        CHECK(error.message() == "Success");
+        REQUIRE(batch.size() == 10);
+        CHECK(batch.front() == "0");
+        CHECK(batch.back() == "9");
+
+        // everything else arrives in one completion
+        q.async_pop_all(make_batch_handler());
+        CHECK(poll(ioc) == 1);
+        CHECK(run(ioc2) == 1);
+        CHECK(error.message() == "Success");
+        REQUIRE(batch.size() == 491);
+        CHECK(batch.front() == "10");
+        CHECK(batch.back() == "500");
+
+        // single pops and batch pops can be mixed
+        q.push("x");
+        q.async_pop(make_handler());
+        CHECK(poll(ioc) == 1);
+        CHECK(run(ioc2) == 1);
+        CHECK(value == "x");
+
+        q.async_pop_all(make_batch_handler());
+        q.stop();
+        CHECK(poll(ioc) == 2);
+        CHECK(run(ioc2) == 1);
+        CHECK(error.message() == "Operation canceled");
+        CHECK(batch.empty());
+    }
+
+    SECTION("bounded by count")
+    {
+        auto bq = async_queue<std::string>(e, async_queue_limits{2});
+        CHECK(bq.try_push("a"));
+        CHECK(bq.try_push("b"));
+        CHECK(not bq.try_push("c"));
+        CHECK(poll(ioc) == 0);
+
+        int pushes = 0;
+        auto push_handler = [&] {
+            return net::bind_executor(e2, [&](error_code ec) {
+                error = ec;
+                ++pushes;
+            });
+        };
+
+        // the queue is full so this producer is suspended
+        bq.async_push("c", push_handler());
+        poll(ioc);
+        CHECK(poll(ioc2) == 0);
+        CHECK(pushes == 0);
+
+        // a try_push may not overtake a suspended producer
+        std::string d = "d";
+        CHECK(not bq.try_push(std::move(d)));
+        CHECK(d == "d");
+
+        // popping makes room, which admits the suspended producer
+        bq.async_pop(make_handler());
+        poll(ioc);
+        CHECK(poll(ioc2) == 2);
+        CHECK(value == "a");
+        CHECK(pushes == 1);
+        CHECK(error.message() == "Success");
+
+        bq.async_pop(make_handler());
+        poll(ioc);
+        CHECK(poll(ioc2) == 1);
+        CHECK(value == "b");
+
+        bq.async_pop(make_handler());
+        poll(ioc);
+        CHECK(poll(ioc2) == 1);
+        CHECK(value == "c");
+
+        // stopping the queue releases suspended producers with an error
+        CHECK(bq.try_push("e"));
+        CHECK(bq.try_push("f"));
+        bq.async_push("g", push_handler());
+        bq.stop();
+        poll(ioc);
+        CHECK(poll(ioc2) == 1);
+        CHECK(pushes == 2);
+        CHECK(error.message() == "Operation canceled");
+    }
+
+    SECTION("pushes after stop")
+    {
+        auto bq = async_queue<std::string>(e, async_queue_limits{2});
+        bq.stop();
+        poll(ioc);
+
+        // a stopped queue takes nothing, however much room it has
+        auto a = std::string("a");
+        CHECK(not bq.try_push(std::move(a)));
+        CHECK(a == "a");
+        bq.push("b");
+        auto more = std::vector<std::string>{"c", "d"};
+        bq.push_range(more.begin(), more.end());
+
+        bq.async_pop(make_handler());
+        CHECK(poll(ioc) == 1);
+        CHECK(run(ioc2) == 1);
+        CHECK(error.message() == "Operation canceled");
+        CHECK(value == "");
+    }
+
+    SECTION("bounded by bytes")
+    {
+        auto limits = async_queue_limits();
+        limits.max_bytes = 8;
+        auto bq = async_queue<std::string>(e, limits);
+        CHECK(bq.try_push("12345"));
+        CHECK(not bq.try_push("1234"));
+        CHECK(bq.try_push("123"));
+        CHECK(not bq.try_push("x"));
+        poll(ioc);
+
+        bq.async_pop_all(make_batch_handler());
+        poll(ioc);
+        CHECK(run(ioc2) == 1);
+        CHECK(batch.size() == 2);
+
+        // an element larger than the limit is admitted into an empty queue
+        CHECK(bq.try_push(std::string(100, 'x')));
+        CHECK(not bq.try_push("1"));
+    }
+
+    SECTION("steady state does not allocate")
+    {
+        // A consumer which pushes the next value each time it is handed one.
+        // Everything runs on ioc's thread, so once the queue's node pool and
+        // asio's handler recycling have warmed up, a push/pop cycle should not
+        // touch the heap.
+        struct consumer
+        {
+            void
+            operator()(error_code ec, std::string)
+            {
+                if (ec)
+                    return;
+                if (++*count == 100)
+                    *mark = testing::allocations();
+                if (*count == 1100)
+                    *allocated = testing::allocations() - *mark;
+                else
+                {
+                    q->push("x");
+                    q->async_pop(*this);
+                }
+            }
+
+            async_queue<std::string> *q;
+            int *count;
+            std::size_t *mark;
+            std::size_t *allocated;
+        };
+
+        int count = 0;
+        std::size_t mark = 0;
+        std::size_t allocated = 1;
+        net::post(e, [&] {
+            q.push("x");
+            q.async_pop(consumer { &q, &count, &mark, &allocated });
+        });
+        run(ioc);
+        CHECK(count == 1100);
+        CHECK(allocated == 0);
+    }
+}
+
+TEST_CASE("async_queue on a strand")
+{
+    auto ioc = net::io_context(2);
+    auto strand = net::make_strand(ioc);
+    auto exec = net::any_io_executor(strand);
+    auto q = async_queue<std::string>(exec);
+
+    // a strand is only running in this thread if this thread is in it, even
+    // though another thread of the same io_context may be
+    std::atomic<int> outside { -1 };
+    std::atomic<int> inside { -1 };
+    net::post(ioc, [&] { outside = detail::running_in_this_thread(exec); });
+    net::post(strand, [&] { inside = detail::running_in_this_thread(exec); });
+
+    // popping from outside the strand must not complete inline, off the
+    // strand, even though a value is ready
+    std::atomic<bool> initiating { false };
+    auto initiator = std::thread::id();
+    std::atomic<bool> completed_inline { false };
+    std::atomic<bool> completed_on_strand { false };
+    std::string value;
+    q.push("a");
+    net::post(ioc, [&] {
+        initiator = std::this_thread::get_id();
+        initiating = true;
+        q.async_pop(net::bind_executor(strand, [&](error_code ec, std::string s) {
+            completed_inline = initiating and std::this_thread::get_id() == initiator;
+            completed_on_strand = strand.running_in_this_thread();
+            if (not ec)
+                value = s;
+        }));
+        initiating = false;
+    });
+
+    auto other = std::thread([&] { ioc.run(); });
+    ioc.run();
+    other.join();
+
+    CHECK(outside == 0);
+    CHECK(inside == 1);
+    CHECK(value == "a");
+    CHECK(not completed_inline);
+    CHECK(completed_on_strand);
+}
+
+TEST_CASE("async_queue on an allocator-bound executor")
+{
+    // as the cxx20 server's connections are
+    auto ioc = net::io_context(1);
+    auto exec = net::any_io_executor(
+        net::require(ioc.get_executor(), net::execution::allocator(recycling_allocator<void>())));
+    auto q = async_queue<std::string>(exec);
+
+    bool initiating = false;
+    bool completed_inline = false;
+    std::string value;
+    net::post(exec, [&] {
+        q.push("a");
+        initiating = true;
+        q.async_pop([&](error_code ec, std::string s) {
+            completed_inline = initiating;
+            if (not ec)
+                value = s;
+        });
+        initiating = false;
+    });
+    ioc.run();
+
+    CHECK(value == "a");
+    CHECK(completed_inline);
+}
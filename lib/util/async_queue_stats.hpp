@@ -0,0 +1,225 @@
+#pragma once
+#include "util/detail/mpsc_list.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace beast_fun_times::util
+{
+    /// A point-in-time copy of a queue's instrumentation.
+    ///
+    /// Snapshots of several queues can be added together, for example to
+    /// report on every connection of a server at once.
+    struct async_queue_snapshot
+    {
+        /// The number of buckets in the latency histogram
+        static constexpr std::size_t latency_buckets = 24;
+
+        /// The number of elements in the queue
+        std::uint64_t depth = 0;
+
+        /// The greatest depth the queue has reached
+        std::uint64_t high_water = 0;
+
+        /// The number of elements pushed
+        std::uint64_t enqueued = 0;
+
+        /// The number of elements delivered to consumers
+        std::uint64_t dequeued = 0;
+
+        /// The number of elements thrown away when the queue was stopped
+        std::uint64_t discarded = 0;
+
+        /// A histogram of the time from push to delivery. Bucket 0 counts
+        /// waits of less than 1us, and bucket i > 0 counts waits of at least
+        /// 2^(i-1)us and less than 2^i us. The last bucket also counts
+        /// everything longer.
+        std::array< std::uint64_t, latency_buckets > latency {};
+
+        /// The exclusive upper bound of a latency bucket
+        static std::chrono::microseconds
+        latency_bound(std::size_t bucket) noexcept
+        {
+            return std::chrono::microseconds(std::uint64_t(1) << bucket);
+        }
+
+        /// The latency bucket which counts a wait of the given duration
+        static std::size_t
+        latency_bucket(std::chrono::nanoseconds wait) noexcept
+        {
+            auto        us     = std::uint64_t(std::max(
+                std::chrono::duration_cast< std::chrono::microseconds >(wait)
+                    .count(),
+                std::chrono::microseconds::rep(0)));
+            std::size_t bucket = 0;
+            while (us and bucket + 1 < latency_buckets)
+            {
+                us >>= 1;
+                ++bucket;
+            }
+            return bucket;
+        }
+
+        /// An upper bound on the latency of the given fraction of delivered
+        /// elements, e.g. 0.99 for the 99th percentile. Zero if nothing has
+        /// been delivered.
+        std::chrono::microseconds
+        latency_percentile(double fraction) const noexcept
+        {
+            std::uint64_t total = 0;
+            for (auto n : latency)
+                total += n;
+            if (total == 0)
+                return std::chrono::microseconds(0);
+
+            auto          wanted = std::uint64_t(double(total) * fraction);
+            std::uint64_t seen   = 0;
+            for (std::size_t i = 0; i < latency_buckets; ++i)
+            {
+                seen += latency[i];
+                if (seen >= wanted and seen != 0)
+                    return latency_bound(i);
+            }
+            return latency_bound(latency_buckets - 1);
+        }
+
+        /// Aggregate another queue's snapshot into this one. Counts are
+        /// summed. The high water mark is the greater of the two.
+        async_queue_snapshot &
+        operator+=(async_queue_snapshot const &other) noexcept
+        {
+            depth += other.depth;
+            high_water = std::max(high_water, other.high_water);
+            enqueued += other.enqueued;
+            dequeued += other.dequeued;
+            discarded += other.discarded;
+            for (std::size_t i = 0; i < latency_buckets; ++i)
+                latency[i] += other.latency[i];
+            return *this;
+        }
+    };
+
+    /// The default instrumentation of a basic_async_queue: none.
+    ///
+    /// Every hook is an empty inline function and the per-element stamp is
+    /// an empty base class, so a queue with these stats is exactly the size
+    /// and speed of one without.
+    struct null_async_queue_stats
+    {
+        static constexpr bool enabled = false;
+
+        /// Stored with each element
+        struct stamp
+        {
+        };
+
+        void
+        on_push(stamp &) noexcept
+        {
+        }
+
+        void
+        on_pop(stamp const &) noexcept
+        {
+        }
+
+        void
+        on_discard(stamp const &) noexcept
+        {
+        }
+
+        async_queue_snapshot
+        snapshot() const noexcept
+        {
+            return {};
+        }
+    };
+
+    /// Instrumentation for a basic_async_queue: depth, high water mark,
+    /// element counts and a histogram of the time elements spend queued.
+    ///
+    /// Select it with the stats_type of the queue's Traits. It costs two
+    /// clock reads and a handful of relaxed atomic increments per element.
+    /// snapshot may be called on any thread.
+    struct async_queue_stats
+    {
+        using clock = std::chrono::steady_clock;
+
+        static constexpr bool enabled = true;
+
+        /// Stored with each element
+        struct stamp
+        {
+            clock::time_point pushed;
+        };
+
+        /// Called by producers, on any thread
+        void
+        on_push(stamp &s) noexcept
+        {
+            s.pushed   = clock::now();
+            auto depth = enqueued_.fetch_add(1, std::memory_order_relaxed) + 1;
+            auto gone  = dequeued_.load(std::memory_order_relaxed) +
+                        discarded_.load(std::memory_order_relaxed);
+            // the counters are read independently, so they may be out of
+            // step with each other
+            depth     = depth > gone ? depth - gone : 0;
+            auto high = high_water_.load(std::memory_order_relaxed);
+            while (depth > high and
+                   not high_water_.compare_exchange_weak(
+                       high, depth, std::memory_order_relaxed))
+                ;
+        }
+
+        /// Called on the queue's executor when an element is delivered
+        void
+        on_pop(stamp const &s) noexcept
+        {
+            auto bucket =
+                async_queue_snapshot::latency_bucket(clock::now() - s.pushed);
+            latency_[bucket].fetch_add(1, std::memory_order_relaxed);
+            dequeued_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Called on the queue's executor when an element is thrown away
+        void
+        on_discard(stamp const &) noexcept
+        {
+            discarded_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        async_queue_snapshot
+        snapshot() const noexcept
+        {
+            auto s       = async_queue_snapshot();
+            s.dequeued   = dequeued_.load(std::memory_order_relaxed);
+            s.discarded  = discarded_.load(std::memory_order_relaxed);
+            s.enqueued   = enqueued_.load(std::memory_order_relaxed);
+            s.high_water = high_water_.load(std::memory_order_relaxed);
+            auto gone    = s.dequeued + s.discarded;
+            s.depth      = s.enqueued > gone ? s.enqueued - gone : 0;
+            for (std::size_t i = 0; i < s.latency.size(); ++i)
+                s.latency[i] = latency_[i].load(std::memory_order_relaxed);
+            return s;
+        }
+
+      private:
+        // Written by producers
+        std::atomic< std::uint64_t > enqueued_ { 0 };
+        std::atomic< std::uint64_t > high_water_ { 0 };
+
+        // Written by the consumer. Kept on its own cache line so that
+        // producers and consumer do not contend for one.
+        alignas(detail::cache_line_size)
+            std::atomic< std::uint64_t > dequeued_ { 0 };
+        std::atomic< std::uint64_t > discarded_ { 0 };
+        std::array< std::atomic< std::uint64_t >,
+                    async_queue_snapshot::latency_buckets >
+            latency_ {};
+    };
+
+}   // namespace beast_fun_times::util
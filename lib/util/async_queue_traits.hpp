@@ -0,0 +1,96 @@
+#pragma once
+#include "util/async_queue_stats.hpp"
+#include "util/net.hpp"
+
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+namespace beast_fun_times::util
+{
+    namespace detail
+    {
+        template < class T, class = void >
+        struct is_buffer_convertible : std::false_type
+        {
+        };
+
+        template < class T >
+        struct is_buffer_convertible<
+            T,
+            std::void_t< decltype(net::buffer(std::declval< T const & >())) > >
+        : std::true_type
+        {
+        };
+    }   // namespace detail
+
+    /// Customisation point for basic_async_queue.
+    ///
+    /// Specialise, or derive from and pass as the Traits argument of
+    /// basic_async_queue, to change how the queue treats its elements.
+    template < class T >
+    struct async_queue_traits
+    {
+        /// The number of bytes an element is charged against a queue's byte
+        /// limit.
+        ///
+        /// By default this is the size of the payload for anything that
+        /// net::buffer understands (strings, vectors, arrays...) and for
+        /// buffer sequences such as shared_message, and sizeof(T) for
+        /// everything else.
+        static std::size_t
+        size_of(T const &v) noexcept
+        {
+            if constexpr (detail::is_buffer_convertible< T >::value)
+                return net::buffer(v).size();
+            else if constexpr (net::is_const_buffer_sequence< T >::value)
+                return net::buffer_size(v);
+            else
+                return sizeof(T);
+        }
+
+        /// The number of priority lanes in the queue.
+        ///
+        /// Elements are delivered from the most urgent lane which has any,
+        /// and in push order within a lane, so urgent elements overtake bulk
+        /// traffic at element boundaries. One lane is a plain FIFO.
+        static constexpr std::size_t lanes = 1;
+
+        /// The queue's instrumentation.
+        ///
+        /// null_async_queue_stats costs nothing. Use async_queue_stats to
+        /// measure depth and wait times.
+        using stats_type = null_async_queue_stats;
+    };
+
+    /// Names a lane of a basic_async_queue. Lane 0 is the most urgent.
+    enum class async_queue_lane : std::size_t
+    {
+        urgent = 0
+    };
+
+    /// The capacity limits of a basic_async_queue.
+    ///
+    /// A queue with default limits is unbounded and pays nothing for
+    /// accounting.
+    struct async_queue_limits
+    {
+        static constexpr std::size_t unlimited =
+            std::numeric_limits< std::size_t >::max();
+
+        /// The maximum number of elements in the queue
+        std::size_t max_items = unlimited;
+
+        /// The maximum total size of the elements in the queue, as measured by
+        /// the queue's Traits::size_of
+        std::size_t max_bytes = unlimited;
+
+        bool
+        bounded() const noexcept
+        {
+            return max_items != unlimited or max_bytes != unlimited;
+        }
+    };
+
+}   // namespace beast_fun_times::util
@@ -0,0 +1,425 @@
+#pragma once
+
+#include <boost/beast/core/flat_buffer.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace beast_fun_times::util
+{
+    /// Whether the buffer pool's slabs should be backed by huge pages
+    struct buffer_pool_settings
+    {
+        /// Map slabs with MAP_HUGETLB, which needs pages reserved with
+        /// vm.nr_hugepages. Without them, slabs are mapped normally and
+        /// advised to use transparent huge pages. Pages of spare blocks are
+        /// not given back to the system, as a huge page cannot be given back
+        /// a block at a time.
+        bool huge_pages = false;
+
+        /// The settings named by the environment, on top of the defaults.
+        /// BUFFER_POOL_HUGE_PAGES=1 asks for huge pages.
+        static buffer_pool_settings
+        from_env()
+        {
+            auto s = buffer_pool_settings();
+            if (auto value = std::getenv("BUFFER_POOL_HUGE_PAGES"))
+                s.huge_pages = std::strcmp(value, "1") == 0 or
+                               std::strcmp(value, "on") == 0 or
+                               std::strcmp(value, "true") == 0;
+            return s;
+        }
+    };
+
+    /// Memory for receive buffers, shared by every connection in the
+    /// process.
+    ///
+    /// Blocks come in power-of-two size classes from min_block to
+    /// max_block, carved from slabs of slab_size bytes which are mapped on
+    /// demand. A connection borrows a block when a message starts to arrive
+    /// and returns it when the message has been consumed, so memory follows
+    /// the messages in flight rather than the number of connections.
+    ///
+    /// Each thread keeps up to max_cached_bytes of spare blocks per class, so
+    /// borrowing and returning costs a pop and a push. Spares beyond that go
+    /// to a depot shared by every thread, and their pages are given back to
+    /// the system until the block is borrowed again. Memory freed on a
+    /// thread other than the one which allocated it joins the freeing
+    /// thread's spares. Bigger blocks go straight to operator new.
+    ///
+    /// Slabs are never unmapped, so the address space reserved is that of
+    /// the peak.
+    class buffer_pool
+    {
+      public:
+        static constexpr std::size_t min_block    = 256;
+        static constexpr std::size_t size_classes = 13;
+        static constexpr std::size_t max_block =
+            min_block << (size_classes - 1);
+        static constexpr std::size_t slab_size        = 2 * 1024 * 1024;
+        static constexpr std::size_t max_cached_bytes = 1024 * 1024;
+
+        /// What the calling thread has asked of the pool
+        struct counters
+        {
+            std::size_t allocations;   // every allocation
+            std::size_t recycled;      // of which served from its spares
+            std::size_t oversize;      // of which too big to be pooled
+        };
+
+        /// The size of the block which serves an allocation of size bytes.
+        /// A buffer may as well use all of it.
+        static constexpr std::size_t
+        block_size(std::size_t size) noexcept
+        {
+            auto c = size_class(size);
+            return c < size_classes ? min_block << c : size;
+        }
+
+        static void *
+        allocate(std::size_t size)
+        {
+            ++stats.allocations;
+            auto c = size_class(size);
+            if (c >= size_classes)
+            {
+                ++stats.oversize;
+                return ::operator new(size);
+            }
+
+            if (not torn_down)
+            {
+                auto &spares = cache().spares[c];
+                if (spares.head)
+                {
+                    ++stats.recycled;
+                    --spares.count;
+                    auto b      = spares.head;
+                    spares.head = b->next;
+                    return b;
+                }
+            }
+            return depot::instance().take(c);
+        }
+
+        static void
+        deallocate(void *p, std::size_t size) noexcept
+        {
+            auto c = size_class(size);
+            if (c >= size_classes)
+            {
+                ::operator delete(p);
+                return;
+            }
+
+            if (not torn_down)
+            {
+                auto &spares = cache().spares[c];
+                if ((spares.count + 1) * (min_block << c) <= max_cached_bytes)
+                {
+                    ++spares.count;
+                    spares.head = new (p) block { spares.head };
+                    return;
+                }
+            }
+            depot::instance().give(c, p);
+        }
+
+        /// The calling thread's counters since it started
+        static counters
+        thread_stats() noexcept
+        {
+            return stats;
+        }
+
+        /// The bytes of slabs mapped by the process
+        static std::size_t
+        mapped_bytes()
+        {
+            return depot::instance().mapped_bytes();
+        }
+
+        /// Whether the slabs are backed by huge pages, as the environment
+        /// asked and the system allowed
+        static bool
+        huge_pages()
+        {
+            return depot::instance().huge_pages();
+        }
+
+      private:
+        struct block
+        {
+            block *next;
+        };
+
+        struct free_list
+        {
+            block *     head  = nullptr;
+            std::size_t count = 0;
+        };
+
+        struct thread_cache
+        {
+            thread_cache() = default;
+
+            thread_cache(thread_cache const &) = delete;
+
+            thread_cache &
+            operator=(thread_cache const &) = delete;
+
+            ~thread_cache()
+            {
+                // buffers released later in this thread's exit go straight
+                // to the depot, as do the spares
+                torn_down = true;
+                for (std::size_t c = 0; c < size_classes; ++c)
+                    while (auto b = spares[c].head)
+                    {
+                        spares[c].head = b->next;
+                        depot::instance().give(c, b);
+                    }
+            }
+
+            std::array< free_list, size_classes > spares;
+        };
+
+        /// The blocks spare to every thread, and the slabs they are carved
+        /// from. Its free lists are kept apart from the blocks, so that
+        /// parking a block does not touch the pages given back.
+        class depot
+        {
+          public:
+            static depot &
+            instance()
+            {
+                // never destroyed, as buffers may be released by the
+                // destructors of other statics
+                static auto d = new depot(buffer_pool_settings::from_env());
+                return *d;
+            }
+
+            void *
+            take(std::size_t c)
+            {
+                auto lock = std::lock_guard(mutex_);
+                auto &v   = spares_[c];
+                if (not v.empty())
+                {
+                    auto p = v.back();
+                    v.pop_back();
+                    return p;
+                }
+                return carve(min_block << c);
+            }
+
+            void
+            give(std::size_t c, void *p) noexcept
+            {
+                release_pages(p, min_block << c);
+                auto lock = std::lock_guard(mutex_);
+                try
+                {
+                    spares_[c].push_back(p);
+                }
+                catch (std::bad_alloc &)
+                {
+                    // lost until exit: the slab cannot be given back
+                }
+            }
+
+            std::size_t
+            mapped_bytes()
+            {
+                auto lock = std::lock_guard(mutex_);
+                return slabs_ * slab_size;
+            }
+
+            bool
+            huge_pages()
+            {
+                auto lock = std::lock_guard(mutex_);
+                return hugetlb_;
+            }
+
+          private:
+            explicit depot(buffer_pool_settings const &settings)
+            : settings_(settings)
+            {
+            }
+
+            /// Carve a block from the current slab, mapping a new one if it
+            /// is too full. What is left of the old one is parked in the
+            /// biggest blocks which fit. Called with the lock held.
+            void *
+            carve(std::size_t size)
+            {
+                if (left_ < size)
+                {
+                    for (auto c = size_classes; c-- > 0 and left_;)
+                        while (left_ >= (min_block << c))
+                            spares_[c].push_back(bump(min_block << c));
+                    next_ = map_slab();
+                    left_ = slab_size;
+                }
+                return bump(size);
+            }
+
+            char *
+            bump(std::size_t size) noexcept
+            {
+                left_ -= size;
+                return std::exchange(next_, next_ + size);
+            }
+
+            char *
+            map_slab()
+            {
+                void *p = nullptr;
+#ifdef __linux__
+                p = MAP_FAILED;
+                if (settings_.huge_pages)
+                {
+                    p = ::mmap(nullptr,
+                               slab_size,
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                               -1,
+                               0);
+                    if (p != MAP_FAILED)
+                        hugetlb_ = true;
+                }
+                if (p == MAP_FAILED)
+                {
+                    p = ::mmap(nullptr,
+                               slab_size,
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS,
+                               -1,
+                               0);
+                    if (p == MAP_FAILED)
+                        throw std::bad_alloc();
+                    if (settings_.huge_pages)
+                        ::madvise(p, slab_size, MADV_HUGEPAGE);
+                }
+#else
+                p = ::operator new(slab_size);
+#endif
+                ++slabs_;
+                return static_cast< char * >(p);
+            }
+
+            /// Let the system have a spare block's whole pages back. They
+            /// read as zeroes when next touched.
+            void
+            release_pages(void *p, std::size_t size) noexcept
+            {
+#ifdef __linux__
+                constexpr auto page = std::size_t(4096);
+                if (settings_.huge_pages or size < page)
+                    return;
+                auto first = (reinterpret_cast< std::uintptr_t >(p) + page - 1) &
+                             ~(page - 1);
+                auto last = (reinterpret_cast< std::uintptr_t >(p) + size) &
+                            ~(page - 1);
+                if (first < last)
+                    ::madvise(reinterpret_cast< void * >(first),
+                              last - first,
+                              MADV_DONTNEED);
+#else
+                (void)p;
+                (void)size;
+#endif
+            }
+
+            buffer_pool_settings const settings_;
+            std::mutex                 mutex_;
+            std::array< std::vector< void * >, size_classes > spares_;
+            char *                     next_    = nullptr;
+            std::size_t                left_    = 0;
+            std::size_t                slabs_   = 0;
+            bool                       hugetlb_ = false;
+        };
+
+        static constexpr std::size_t
+        size_class(std::size_t size) noexcept
+        {
+            auto c = std::size_t(0);
+            while (c < size_classes and (min_block << c) < size)
+                ++c;
+            return c;
+        }
+
+        static thread_cache &
+        cache()
+        {
+            thread_local thread_cache c;
+            return c;
+        }
+
+        static inline thread_local bool     torn_down = false;
+        static inline thread_local counters stats {};
+    };
+
+    /// An allocator whose memory comes from the buffer_pool. Stateless, so
+    /// every buffer_pool_allocator compares equal.
+    template < class T >
+    class buffer_pool_allocator
+    {
+      public:
+        using value_type = T;
+
+        constexpr buffer_pool_allocator() noexcept = default;
+
+        template < class U >
+        constexpr buffer_pool_allocator(
+            buffer_pool_allocator< U > const &) noexcept
+        {
+        }
+
+        T *
+        allocate(std::size_t n)
+        {
+            static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                          "over-aligned types are not supported");
+            return static_cast< T * >(buffer_pool::allocate(n * sizeof(T)));
+        }
+
+        void
+        deallocate(T *p, std::size_t n) noexcept
+        {
+            buffer_pool::deallocate(p, n * sizeof(T));
+        }
+    };
+
+    template < class T, class U >
+    constexpr bool
+    operator==(buffer_pool_allocator< T > const &,
+               buffer_pool_allocator< U > const &) noexcept
+    {
+        return true;
+    }
+
+    template < class T, class U >
+    constexpr bool
+    operator!=(buffer_pool_allocator< T > const &,
+               buffer_pool_allocator< U > const &) noexcept
+    {
+        return false;
+    }
+
+    /// A DynamicBuffer whose storage is borrowed from the buffer_pool
+    using pooled_flat_buffer =
+        boost::beast::basic_flat_buffer< buffer_pool_allocator< char > >;
+
+}   // namespace beast_fun_times::util
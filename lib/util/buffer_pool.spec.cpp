@@ -0,0 +1,110 @@
+#include <catch2/catch.hpp>
+
+#include "util/buffer_pool.hpp"
+#include "util/net.hpp"
+#include "util/testing/allocation_counter.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace beast_fun_times::util;
+
+TEST_CASE("util::buffer_pool")
+{
+    SECTION("sizes are rounded up to a size class")
+    {
+        CHECK(buffer_pool::block_size(0) == buffer_pool::min_block);
+        CHECK(buffer_pool::block_size(1) == 256);
+        CHECK(buffer_pool::block_size(256) == 256);
+        CHECK(buffer_pool::block_size(257) == 512);
+        CHECK(buffer_pool::block_size(1536) == 2048);
+        CHECK(buffer_pool::block_size(buffer_pool::max_block) ==
+              buffer_pool::max_block);
+        CHECK(buffer_pool::block_size(buffer_pool::max_block + 1) ==
+              buffer_pool::max_block + 1);
+    }
+
+    SECTION("a returned block is borrowed again, without the heap")
+    {
+        auto p = buffer_pool::allocate(1000);
+        std::memset(p, 'x', buffer_pool::block_size(1000));
+        buffer_pool::deallocate(p, 1000);
+
+        auto before = testing::allocations();
+        auto stats  = buffer_pool::thread_stats();
+        auto q      = buffer_pool::allocate(1024);
+        CHECK(q == p);
+        CHECK(buffer_pool::thread_stats().recycled == stats.recycled + 1);
+        buffer_pool::deallocate(q, 1024);
+        CHECK(testing::allocations() == before);
+    }
+
+    SECTION("blocks freed on another thread join that thread's spares")
+    {
+        auto p = buffer_pool::allocate(4096);
+        std::thread([p] {
+            buffer_pool::deallocate(p, 4096);
+            auto q = buffer_pool::allocate(4096);
+            CHECK(q == p);
+            buffer_pool::deallocate(q, 4096);
+        }).join();
+    }
+
+    SECTION("spares beyond a thread's share are shared with other threads")
+    {
+        // more 64 KiB blocks than one thread keeps
+        auto size   = std::size_t(64 * 1024);
+        auto blocks = std::vector< void * >();
+        for (std::size_t i = 0; i < 2 * buffer_pool::max_cached_bytes / size;
+             ++i)
+            blocks.push_back(buffer_pool::allocate(size));
+        std::thread([&] {
+            for (auto p : blocks)
+                buffer_pool::deallocate(p, size);
+        }).join();
+
+        auto mapped = buffer_pool::mapped_bytes();
+        for (auto &p : blocks)
+        {
+            p = buffer_pool::allocate(size);
+            std::memset(p, 'x', size);
+        }
+        CHECK(buffer_pool::mapped_bytes() == mapped);
+        for (auto p : blocks)
+            buffer_pool::deallocate(p, size);
+    }
+
+    SECTION("bigger blocks are not pooled")
+    {
+        auto stats = buffer_pool::thread_stats();
+        auto p     = buffer_pool::allocate(buffer_pool::max_block + 1);
+        CHECK(buffer_pool::thread_stats().oversize == stats.oversize + 1);
+        buffer_pool::deallocate(p, buffer_pool::max_block + 1);
+    }
+
+    SECTION("a pooled_flat_buffer borrows from the pool")
+    {
+        auto stats  = buffer_pool::thread_stats();
+        auto buffer = pooled_flat_buffer();
+        buffer.commit(
+            net::buffer_copy(buffer.prepare(5), net::buffer("hello", 5)));
+        CHECK(buffer.size() == 5);
+        CHECK(buffer_pool::thread_stats().allocations ==
+              stats.allocations + 1);
+    }
+}
+
+TEST_CASE("util::buffer_pool_settings")
+{
+    CHECK(not buffer_pool_settings().huge_pages);
+
+    ::setenv("BUFFER_POOL_HUGE_PAGES", "1", 1);
+    CHECK(buffer_pool_settings::from_env().huge_pages);
+
+    ::setenv("BUFFER_POOL_HUGE_PAGES", "0", 1);
+    CHECK(not buffer_pool_settings::from_env().huge_pages);
+
+    ::unsetenv("BUFFER_POOL_HUGE_PAGES");
+}
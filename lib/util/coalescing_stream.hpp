@@ -0,0 +1,333 @@
+#pragma once
+#include "util/net.hpp"
+#include "util/poly_handler.hpp"
+
+#include <boost/asio/compose.hpp>
+#include <boost/beast/core/buffers_cat.hpp>
+#include <boost/beast/core/role.hpp>
+#include <boost/beast/websocket/teardown.hpp>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace beast_fun_times::util
+{
+    /// A stream layer which gathers many small writes into one.
+    ///
+    /// Put it beneath a websocket stream. Between cork() and async_uncork(),
+    /// each complete frame the websocket writes is copied to a staging
+    /// buffer and its write completes at once. Uncorking sends everything
+    /// staged in one write. Frames are staged whole, so message boundaries
+    /// are preserved. When the staged bytes would exceed the budget, they
+    /// go out together with the new frame in one gather write, which
+    /// bounds the memory used.
+    ///
+    /// While a write is in progress, for example while uncorking, any other
+    /// write (such as a pong or close frame from the websocket's read
+    /// operation) is staged behind it. Only one write reaches the next layer
+    /// at a time. Closing the websocket flushes anything still staged.
+    ///
+    /// Not thread-safe: use it from one thread or strand, like the stream it
+    /// wraps. Uncorked, writes go straight through.
+    template < class NextLayer >
+    class coalescing_stream
+    {
+      public:
+        using next_layer_type = std::remove_reference_t< NextLayer >;
+        using executor_type   = typename next_layer_type::executor_type;
+
+        static constexpr std::size_t default_budget = 64 * 1024;
+
+        template < class... Args >
+        explicit coalescing_stream(Args &&...args)
+        : next_(std::forward< Args >(args)...)
+        {
+        }
+
+        next_layer_type &
+        next_layer() noexcept
+        {
+            return next_;
+        }
+
+        next_layer_type const &
+        next_layer() const noexcept
+        {
+            return next_;
+        }
+
+        executor_type
+        get_executor() noexcept
+        {
+            return next_.get_executor();
+        }
+
+        /// The most bytes held back while corked
+        std::size_t
+        budget() const noexcept
+        {
+            return budget_;
+        }
+
+        void
+        set_budget(std::size_t bytes) noexcept
+        {
+            budget_ = bytes;
+        }
+
+        /// Free the staging buffers' storage, if nothing is staged or being
+        /// written. For a connection gone quiet, whose last burst may have
+        /// left them big. Returns true if there was storage to free.
+        bool
+        shrink_to_fit() noexcept
+        {
+            if (corked_ or writing_ or not staged_.empty() or
+                staged_.capacity() + sending_.capacity() == 0)
+                return false;
+            staged_  = std::vector< char >();
+            sending_ = std::vector< char >();
+            return true;
+        }
+
+        /// Stage subsequent writes until async_uncork
+        void
+        cork() noexcept
+        {
+            corked_ = true;
+        }
+
+        bool
+        corked() const noexcept
+        {
+            return corked_;
+        }
+
+        /// Stop staging writes and send everything staged, in one write.
+        ///
+        /// Completes when the staged bytes have been written. An error from
+        /// writing bytes whose writes already completed is reported here.
+        /// Signature: void(error_code)
+        template < class CompletionToken =
+                       net::default_completion_token_t< executor_type > >
+        auto
+        async_uncork(CompletionToken &&token =
+                         net::default_completion_token_t< executor_type >())
+        {
+            return net::async_compose< CompletionToken, void(error_code) >(
+                uncork_op { *this }, token, next_);
+        }
+
+        template < class MutableBufferSequence,
+                   class ReadHandler =
+                       net::default_completion_token_t< executor_type > >
+        auto
+        async_read_some(MutableBufferSequence const &buffers,
+                        ReadHandler &&               handler =
+                            net::default_completion_token_t< executor_type >())
+        {
+            return next_.async_read_some(buffers,
+                                         std::forward< ReadHandler >(handler));
+        }
+
+        template < class ConstBufferSequence,
+                   class WriteHandler =
+                       net::default_completion_token_t< executor_type > >
+        auto
+        async_write_some(ConstBufferSequence const &buffers,
+                         WriteHandler &&             handler =
+                             net::default_completion_token_t< executor_type >())
+        {
+            return net::async_compose< WriteHandler,
+                                       void(error_code, std::size_t) >(
+                write_op< ConstBufferSequence > { *this, buffers }, handler,
+                next_);
+        }
+
+      private:
+        /// Append buffers to the staging buffer
+        template < class ConstBufferSequence >
+        void
+        stage(ConstBufferSequence const &buffers)
+        {
+            auto size = staged_.size();
+            staged_.resize(size + net::buffer_size(buffers));
+            net::buffer_copy(net::buffer(staged_.data() + size,
+                                         staged_.size() - size),
+                             buffers);
+        }
+
+        /// Take the staged bytes, to be written
+        net::const_buffer
+        take_staged()
+        {
+            sending_.clear();
+            std::swap(sending_, staged_);
+            return net::buffer(sending_);
+        }
+
+        /// After a write to the next layer. Returns true if there are staged
+        /// bytes which should follow it now.
+        bool
+        wrote(error_code ec)
+        {
+            writing_ = false;
+            if (ec and not ec_)
+                ec_ = ec;
+            if (not ec_ and not corked_ and not staged_.empty())
+            {
+                writing_ = true;
+                return true;
+            }
+            if (waiter_)
+                net::post(get_executor(), std::exchange(waiter_, {}));
+            return false;
+        }
+
+        template < class ConstBufferSequence >
+        struct write_op
+        {
+            coalescing_stream & s;
+            ConstBufferSequence buffers;
+            std::size_t         size = 0;
+            enum
+            {
+                starting,
+                staged,
+                writing
+            } state = starting;
+
+            template < class Self >
+            void
+            operator()(Self &self, error_code ec = {}, std::size_t = 0)
+            {
+                switch (state)
+                {
+                case starting:
+                    size = net::buffer_size(buffers);
+                    if (not s.ec_ and
+                        (s.writing_ or
+                         (s.corked_ and s.staged_.size() + size <= s.budget_)))
+                    {
+                        s.stage(buffers);
+                        state = staged;
+                        net::post(s.get_executor(), std::move(self));
+                        return;
+                    }
+                    if (s.ec_)
+                    {
+                        state = staged;
+                        net::post(s.get_executor(), std::move(self));
+                        return;
+                    }
+                    // anything already staged goes first, in the same write
+                    state      = writing;
+                    s.writing_ = true;
+                    net::async_write(
+                        s.next_,
+                        boost::beast::buffers_cat(s.take_staged(), buffers),
+                        std::move(self));
+                    return;
+
+                case staged:
+                    self.complete(s.ec_, s.ec_ ? 0 : size);
+                    return;
+
+                case writing:
+                    if (s.wrote(ec))
+                    {
+                        net::async_write(
+                            s.next_, s.take_staged(), std::move(self));
+                        return;
+                    }
+                    self.complete(s.ec_, s.ec_ ? 0 : size);
+                    return;
+                }
+            }
+        };
+
+        struct uncork_op
+        {
+            coalescing_stream &s;
+            bool               started = false;
+
+            template < class Self >
+            void
+            operator()(Self &self, error_code ec = {}, std::size_t = 0)
+            {
+                if (not started)
+                {
+                    s.corked_ = false;
+                    if (s.writing_)
+                    {
+                        // another write is in progress. It sends what is
+                        // staged before it finishes.
+                        s.waiter_ = [self = std::move(self)]() mutable {
+                            self();
+                        };
+                        return;
+                    }
+                    started = true;
+                    if (s.ec_ or s.staged_.empty())
+                    {
+                        net::post(s.get_executor(), std::move(self));
+                        return;
+                    }
+                    s.writing_ = true;
+                    net::async_write(
+                        s.next_, s.take_staged(), std::move(self));
+                    return;
+                }
+
+                if (s.writing_ and s.wrote(ec))
+                {
+                    net::async_write(s.next_, s.take_staged(), std::move(self));
+                    return;
+                }
+                self.complete(s.ec_);
+            }
+        };
+
+      private:
+        NextLayer   next_;
+        std::size_t budget_  = default_budget;
+        bool        corked_  = false;
+        bool        writing_ = false;
+        error_code  ec_;
+
+        std::vector< char > staged_;
+        std::vector< char > sending_;
+
+        // an async_uncork waiting for a write in progress to finish
+        poly_handler< void() > waiter_;
+    };
+
+    /// Flush anything staged, then tear down the next layer
+    template < class NextLayer, class TeardownHandler >
+    void
+    async_teardown(boost::beast::role_type         role,
+                   coalescing_stream< NextLayer > &stream,
+                   TeardownHandler &&              handler)
+    {
+        auto exec =
+            net::get_associated_executor(handler, stream.get_executor());
+        stream.async_uncork(net::bind_executor(
+            exec,
+            [&stream, role, handler = std::forward< TeardownHandler >(handler)](
+                error_code) mutable {
+                using boost::beast::websocket::async_teardown;
+                async_teardown(role, stream.next_layer(), std::move(handler));
+            }));
+    }
+
+    template < class NextLayer >
+    void
+    teardown(boost::beast::role_type         role,
+             coalescing_stream< NextLayer > &stream,
+             error_code &                    ec)
+    {
+        using boost::beast::websocket::teardown;
+        teardown(role, stream.next_layer(), ec);
+    }
+
+}   // namespace beast_fun_times::util
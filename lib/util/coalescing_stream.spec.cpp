@@ -0,0 +1,194 @@
+#include <catch2/catch.hpp>
+
+#include "util/coalescing_stream.hpp"
+
+#include <boost/beast/core/buffers_to_string.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/websocket.hpp>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace beast_fun_times::util;
+namespace websocket = boost::beast::websocket;
+
+namespace
+{
+    /// A socket which counts the writes made to it
+    struct counting_socket : net::ip::tcp::socket
+    {
+        using net::ip::tcp::socket::socket;
+
+        template < class ConstBufferSequence, class WriteHandler >
+        auto
+        async_write_some(ConstBufferSequence const &buffers,
+                         WriteHandler &&            handler)
+        {
+            ++writes;
+            return net::ip::tcp::socket::async_write_some(
+                buffers, std::forward< WriteHandler >(handler));
+        }
+
+        int writes = 0;
+    };
+
+    template < class TeardownHandler >
+    void
+    async_teardown(boost::beast::role_type role,
+                   counting_socket &       s,
+                   TeardownHandler &&      handler)
+    {
+        websocket::async_teardown(role,
+                                  static_cast< net::ip::tcp::socket & >(s),
+                                  std::forward< TeardownHandler >(handler));
+    }
+
+    struct fixture
+    {
+        fixture()
+        {
+            auto acceptor = net::ip::tcp::acceptor(
+                ioc, { net::ip::address_v4::loopback(), 0 });
+            client.next_layer().connect(acceptor.local_endpoint());
+            acceptor.accept(socket());
+
+            server.async_accept([](error_code ec) { REQUIRE(not ec); });
+            client.async_handshake("localhost", "/", [](error_code ec) {
+                REQUIRE(not ec);
+            });
+            run();
+            socket().writes = 0;
+        }
+
+        counting_socket &
+        socket()
+        {
+            return server.next_layer().next_layer();
+        }
+
+        void
+        run()
+        {
+            ioc.restart();
+            ioc.run();
+        }
+
+        /// Write each message in turn, then uncork
+        void
+        write_all(std::vector< std::string > const &messages,
+                  std::size_t                       i = 0)
+        {
+            if (i == messages.size())
+            {
+                server.next_layer().async_uncork(
+                    [](error_code ec) { REQUIRE(not ec); });
+                return;
+            }
+            server.async_write(
+                net::buffer(messages[i]),
+                [this, &messages, i](error_code ec, std::size_t) {
+                    REQUIRE(not ec);
+                    write_all(messages, i + 1);
+                });
+        }
+
+        std::vector< std::string >
+        read(std::size_t n)
+        {
+            auto result = std::vector< std::string >();
+            while (result.size() < n)
+            {
+                auto buf = boost::beast::flat_buffer();
+                client.read(buf);
+                result.push_back(boost::beast::buffers_to_string(buf.data()));
+            }
+            return result;
+        }
+
+        net::io_context                                         ioc { 1 };
+        websocket::stream< coalescing_stream< counting_socket > > server {
+            ioc
+        };
+        websocket::stream< net::ip::tcp::socket > client { ioc };
+    };
+}   // namespace
+
+TEST_CASE("util::coalescing_stream")
+{
+    auto f        = fixture();
+    auto messages = std::vector< std::string > { "one", "two", "three" };
+
+    SECTION("uncorked writes go straight through")
+    {
+        f.write_all(messages);
+        f.run();
+        CHECK(f.socket().writes == 3);
+        CHECK(f.read(3) == messages);
+    }
+
+    SECTION("corked writes leave in one write, frames intact")
+    {
+        f.server.next_layer().cork();
+        f.write_all(messages);
+        f.run();
+        CHECK(not f.server.next_layer().corked());
+        CHECK(f.socket().writes == 1);
+        CHECK(f.read(3) == messages);
+    }
+
+    SECTION("the budget bounds what is staged")
+    {
+        // each unmasked frame is 2 bytes of header and the payload
+        f.server.next_layer().set_budget(6);
+        messages = { "1234", "abcd", "wxyz" };
+        f.server.next_layer().cork();
+        f.write_all(messages);
+        f.run();
+
+        // the second frame goes out with the first, the third on uncork
+        CHECK(f.socket().writes == 2);
+        CHECK(f.read(3) == messages);
+    }
+
+    SECTION("the staging buffers are freed once everything has left")
+    {
+        CHECK(not f.server.next_layer().shrink_to_fit());
+        f.server.next_layer().cork();
+        f.write_all(messages);
+        f.run();
+        CHECK(f.read(3) == messages);
+        CHECK(f.server.next_layer().shrink_to_fit());
+        CHECK(not f.server.next_layer().shrink_to_fit());
+    }
+
+    SECTION("a close frame is staged like any other")
+    {
+        auto closed = error_code(net::error::would_block);
+        f.server.next_layer().cork();
+        f.server.async_write(net::buffer(messages[0]),
+                             [&](error_code ec, std::size_t) {
+                                 REQUIRE(not ec);
+                                 f.server.async_close(
+                                     websocket::close_code::normal,
+                                     [&](error_code ec) { closed = ec; });
+                             });
+        f.ioc.restart();
+        f.ioc.run_for(std::chrono::milliseconds(50));
+        CHECK(f.socket().writes == 0);
+
+        // uncorking sends the message and the close frame together, and the
+        // close handshake completes
+        f.server.next_layer().async_uncork([](error_code) {});
+        auto buf = boost::beast::flat_buffer();
+        f.client.async_read(buf, [&](error_code ec, std::size_t) {
+            REQUIRE(not ec);
+            CHECK(boost::beast::buffers_to_string(buf.data()) == "one");
+            f.client.async_read(buf, [](error_code ec, std::size_t) {
+                CHECK(ec == websocket::error::closed);
+            });
+        });
+        f.run();
+        CHECK(f.socket().writes == 1);
+        CHECK(not closed);
+    }
+}
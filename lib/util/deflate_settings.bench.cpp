@@ -0,0 +1,158 @@
+#include "util/deflate_settings.hpp"
+#include "util/net.hpp"
+#include "util/testing/benchmark.hpp"
+
+#include <boost/beast/zlib/deflate_stream.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace beast_fun_times::util;
+namespace zlib = boost::beast::zlib;
+
+namespace
+{
+    /// A connection's outgoing traffic, as a cycle of payloads
+    enum class traffic
+    {
+        chat,             // short lines
+        json,             // 1 KiB documents which compress well
+        incompressible,   // 1 KiB of already compressed data
+    };
+
+    std::vector< std::string >
+    make_payloads(traffic t)
+    {
+        auto rng    = std::mt19937(42);
+        auto result = std::vector< std::string >();
+        for (int i = 0; i < 64; ++i)
+        {
+            auto s = std::string();
+            switch (t)
+            {
+            case traffic::chat:
+                s = "message " + std::to_string(rng() % 100000) + " from alice";
+                break;
+            case traffic::json:
+                while (s.size() < 1024)
+                    s += R"({"user":")" + std::to_string(rng() % 1000) +
+                         R"(","text":"hello, world","seq":)" +
+                         std::to_string(i) + "},";
+                s.resize(1024);
+                break;
+            case traffic::incompressible:
+                s.resize(1024);
+                for (auto &c : s)
+                    c = char(rng());
+                break;
+            }
+            result.push_back(std::move(s));
+        }
+        return result;
+    }
+
+    /// Send `iterations` messages as a permessage-deflate server would, with
+    /// context takeover, at the given level, and count the bytes that reach
+    /// the wire. A level below zero sends the messages plain.
+    void
+    run(traffic t, int level, std::size_t iterations)
+    {
+        static auto const payloads = std::vector< std::vector< std::string > > {
+            make_payloads(traffic::chat),
+            make_payloads(traffic::json),
+            make_payloads(traffic::incompressible),
+        };
+        auto const &messages = payloads[std::size_t(t)];
+
+        auto settings = deflate_settings();
+        auto stream   = zlib::deflate_stream();
+        if (level >= 0)
+            stream.reset(level,
+                         settings.window_bits,
+                         settings.mem_level,
+                         zlib::Strategy::normal);
+        auto out = std::vector< unsigned char >(4096);
+
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            auto const &m = messages[i % messages.size()];
+            if (level < 0)
+            {
+                testing::benchmark_bytes() += m.size();
+                continue;
+            }
+
+            auto zs      = zlib::z_params();
+            zs.next_in   = m.data();
+            zs.avail_in  = m.size();
+            zs.next_out  = out.data();
+            zs.avail_out = out.size();
+            auto ec      = error_code();
+            stream.write(zs, zlib::Flush::sync, ec);
+            testing::benchmark_bytes() += zs.total_out - 4;
+            testing::escape(out.data());
+        }
+    }
+}   // namespace
+
+// Time is the CPU spent compressing; bytes/op is the payload put on the
+// wire. Each row is a DEFLATE_LEVEL, against sending plain.
+UTIL_BENCHMARK("deflate", "chat, level 1")
+{
+    run(traffic::chat, 1, iterations);
+}
+
+UTIL_BENCHMARK("deflate", "chat, level 6")
+{
+    run(traffic::chat, 6, iterations);
+}
+
+UTIL_BENCHMARK("deflate", "chat, level 9")
+{
+    run(traffic::chat, 9, iterations);
+}
+
+UTIL_BENCHMARK("deflate", "chat, plain")
+{
+    run(traffic::chat, -1, iterations);
+}
+
+UTIL_BENCHMARK("deflate", "json 1k, level 1")
+{
+    run(traffic::json, 1, iterations);
+}
+
+UTIL_BENCHMARK("deflate", "json 1k, level 6")
+{
+    run(traffic::json, 6, iterations);
+}
+
+UTIL_BENCHMARK("deflate", "json 1k, level 9")
+{
+    run(traffic::json, 9, iterations);
+}
+
+UTIL_BENCHMARK("deflate", "json 1k, plain")
+{
+    run(traffic::json, -1, iterations);
+}
+
+UTIL_BENCHMARK("deflate", "incompressible 1k, level 1")
+{
+    run(traffic::incompressible, 1, iterations);
+}
+
+UTIL_BENCHMARK("deflate", "incompressible 1k, level 6")
+{
+    run(traffic::incompressible, 6, iterations);
+}
+
+UTIL_BENCHMARK("deflate", "incompressible 1k, level 9")
+{
+    run(traffic::incompressible, 9, iterations);
+}
+
+UTIL_BENCHMARK("deflate", "incompressible 1k, plain")
+{
+    run(traffic::incompressible, -1, iterations);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "util/detail/env_number.hpp"
+
+#include <boost/beast/websocket/option.hpp>
+#include <algorithm>
+
+namespace beast_fun_times::util
+{
+    /// How a deployment uses permessage-deflate.
+    ///
+    /// Once permessage-deflate has been negotiated, beast compresses every
+    /// message, so these settings are the whole of the trade between the CPU
+    /// spent and the bytes saved.
+    struct deflate_settings
+    {
+        /// Deflate compression level, 0..9. Lower is cheaper.
+        int level = 6;
+
+        /// LZ77 window, 9..15 bits. Each compressing connection holds a
+        /// window of 2^window_bits bytes, and more for the hash chains.
+        int window_bits = 15;
+
+        /// Deflate memory level, 1..9
+        int mem_level = 4;
+
+        /// The settings named by the environment, on top of the defaults.
+        ///
+        /// DEFLATE_LEVEL, DEFLATE_WINDOW_BITS and DEFLATE_MEM_LEVEL are read.
+        /// Values which are missing, negative or not numbers are ignored; the
+        /// rest are clamped to their valid ranges.
+        static deflate_settings
+        from_env()
+        {
+            using detail::env_number;
+            auto s  = deflate_settings();
+            s.level = std::clamp(env_number("DEFLATE_LEVEL", s.level), 0, 9);
+            s.window_bits = std::clamp(
+                env_number("DEFLATE_WINDOW_BITS", s.window_bits), 9, 15);
+            s.mem_level =
+                std::clamp(env_number("DEFLATE_MEM_LEVEL", s.mem_level), 1, 9);
+            return s;
+        }
+
+        /// The websocket option which offers these settings as a server
+        boost::beast::websocket::permessage_deflate
+        server_option() const
+        {
+            auto opt          = boost::beast::websocket::permessage_deflate();
+            opt.server_enable = true;
+            opt.server_max_window_bits = window_bits;
+            opt.compLevel              = level;
+            opt.memLevel               = mem_level;
+            return opt;
+        }
+
+    };
+
+}   // namespace beast_fun_times::util
@@ -0,0 +1,30 @@
+#include <catch2/catch.hpp>
+
+#include "util/deflate_settings.hpp"
+
+#include <cstdlib>
+
+using namespace beast_fun_times::util;
+
+TEST_CASE("util::deflate_settings::from_env")
+{
+    ::setenv("DEFLATE_LEVEL", "-1", 1);
+    CHECK(deflate_settings::from_env().level == deflate_settings().level);
+
+    ::setenv("DEFLATE_LEVEL", "12", 1);
+    ::setenv("DEFLATE_WINDOW_BITS", "10", 1);
+    ::setenv("DEFLATE_MEM_LEVEL", "fast", 1);
+    auto s = deflate_settings::from_env();
+    ::unsetenv("DEFLATE_LEVEL");
+    ::unsetenv("DEFLATE_WINDOW_BITS");
+    ::unsetenv("DEFLATE_MEM_LEVEL");
+
+    CHECK(s.level == 9);
+    CHECK(s.window_bits == 10);
+    CHECK(s.mem_level == deflate_settings().mem_level);
+
+    auto opt = s.server_option();
+    CHECK(opt.server_enable);
+    CHECK(opt.server_max_window_bits == 10);
+    CHECK(opt.compLevel == 9);
+}
@@ -1,157 +1,941 @@
 #pragma once
+#include "util/async_queue_traits.hpp"
+#include "util/detail/mpsc_list.hpp"
+#include "util/detail/node_pool.hpp"
 #include "util/net.hpp"
 #include "util/poly_handler.hpp"
+#include "util/recycling_allocator.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <boost/smart_ptr/intrusive_ptr.hpp>
 #include <boost/smart_ptr/intrusive_ref_counter.hpp>
 #include <deque>
-#include <queue>
+#include <memory>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
 
 namespace beast_fun_times::util::detail {
-template < class T, class Executor >
+/// A queue element. Nodes outlive their values so that they can be recycled:
+/// the value is constructed and destroyed explicitly.
+///
+/// Stamp is the per-element state of the queue's instrumentation. It is
+/// usually empty, in which case it takes no space.
+template < class T, class Stamp >
+struct async_queue_node : Stamp
+{
+    async_queue_node() noexcept
+    {
+    }
+
+    ~async_queue_node()
+    {
+    }
+
+    async_queue_node *next = nullptr;
+    union
+    {
+        T value;
+    };
+};
+
+/// Per-thread state for completions which are invoked immediately, from
+/// within the initiating function, rather than posted.
+///
+/// A consumer which re-arms from its completion handler would recurse once
+/// per element, so immediate completions nest at most max_depth deep. After
+/// that the completion is posted, which unwinds the stack.
+struct immediate_completion
+{
+    static constexpr std::size_t max_depth = 16;
+
+    static bool
+    available() noexcept
+    {
+        return depth < max_depth;
+    }
+
+    /// Marks the calling thread as inside an immediate completion
+    struct scope
+    {
+        scope() noexcept
+        {
+            ++depth;
+        }
+
+        ~scope()
+        {
+            --depth;
+        }
+
+        scope(scope const &) = delete;
+
+        scope &
+        operator=(scope const &) = delete;
+    };
+
+    static inline thread_local std::size_t depth = 0;
+};
+
+template < class Executor, class = void >
+struct has_running_in_this_thread : std::false_type
+{
+};
+
+template < class Executor >
+struct has_running_in_this_thread<
+    Executor,
+    std::void_t< decltype(std::declval< Executor const & >()
+                              .running_in_this_thread()) > > : std::true_type
+{
+};
+
+template < class... Allocators >
+struct allocator_list
+{
+};
+
+/// The allocators of the io_context executors which running_in_this_thread
+/// can find inside an any_io_executor. A queue on an executor whose
+/// allocator is not listed never completes immediately.
+using io_executor_allocators =
+    allocator_list< std::allocator< void >, recycling_allocator< void > >;
+
+/// True if ex holds a Target and the calling thread is running a function
+/// submitted to it. any_io_executor::target() does not check the type it is
+/// asked for, so the type is compared first.
+template < class Target >
+bool
+running_in_target(net::any_io_executor const &ex) noexcept
+{
+#if !defined(BOOST_ASIO_NO_TYPEID)
+    if (ex.target_type() != typeid(Target))
+        return false;
+    return ex.template target< Target >()->running_in_this_thread();
+#else
+    return false;
+#endif
+}
+
+template < class... Allocators >
+bool
+running_in_io_executor(net::any_io_executor const &ex,
+                       allocator_list< Allocators... >) noexcept
+{
+    using net::io_context;
+    return (... or
+            (running_in_target< io_context::basic_executor_type< Allocators,
+                                                                 0 > >(ex) or
+             running_in_target< net::strand<
+                 io_context::basic_executor_type< Allocators, 0 > > >(ex)));
+}
+
+/// True if we know that the calling thread is running a function submitted
+/// to ex. False if we do not know.
+template < class Executor >
+bool
+running_in_this_thread(Executor const &ex) noexcept
+{
+    if constexpr (has_running_in_this_thread< Executor >::value)
+        return ex.running_in_this_thread();
+    else if constexpr (std::is_same_v< Executor, net::any_io_executor >)
+        return running_in_io_executor(ex, io_executor_allocators()) or
+               running_in_target< net::strand< net::any_io_executor > >(ex);
+    else
+        return false;
+}
+
+template < class T, class Executor, class Traits >
 struct async_queue_impl
-: boost::intrusive_ref_counter< async_queue_impl< T, Executor > >
+: boost::intrusive_ref_counter< async_queue_impl< T, Executor, Traits > >
 {
     using value_type    = T;
+    using batch_type    = std::vector< T >;
     using executor_type = Executor;
+    using traits_type   = Traits;
+    using stats_type    = typename traits_type::stats_type;
     using ptr           = boost::intrusive_ptr< async_queue_impl >;
 
-    enum waiting_state
-    {
-        not_waiting,
-        waiting
-    };
-
-    async_queue_impl(executor_type exec)
-    : state_(not_waiting)
-    , handler_()
-    , handler_executor_()
+    async_queue_impl(executor_type exec, async_queue_limits limits)
+    : inbox_()
+    , pool_(std::min(limits.max_items, max_pooled_nodes))
+    , limits_(limits)
+    , waiter_pool_(max_pooled_waiters)
+    , waiters_()
     , values_()
+    , pending_()
     , default_executor_(exec)
     {
     }
 
+    ~async_queue_impl();
+
     template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, value_type))
                    WaitHandler >
     BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler,
                                        void(error_code, value_type))
     async_pop(WaitHandler &&handler);
 
+    template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, batch_type))
+                   WaitHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler,
+                                       void(error_code, batch_type))
+    async_pop_some(std::size_t max_items, WaitHandler &&handler);
+
+    template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code))
+                   PushHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(PushHandler, void(error_code))
+    async_push(value_type v, std::size_t lane, PushHandler &&handler);
+
     static ptr
-    construct(executor_type exec);
+    construct(executor_type exec, async_queue_limits limits);
 
     void
-    push(value_type v);
+    push(value_type v, std::size_t lane);
+
+    bool
+    try_push(value_type &&v, std::size_t lane);
+
+    template < class InputIterator >
+    void
+    push_range(InputIterator first, InputIterator last, std::size_t lane);
 
     void
     stop();
 
+    stats_type const &
+    stats() const noexcept
+    {
+        return stats_;
+    }
+
   private:
+    using node_type =
+        async_queue_node< value_type, typename stats_type::stamp >;
+
+    static constexpr std::size_t lane_count = traits_type::lanes;
+    static_assert(lane_count > 0, "a queue needs at least one lane");
+
+    /// The most spare nodes a queue keeps for reuse. Once a queue has been
+    /// this deep, pushes stop allocating.
+    static constexpr std::size_t max_pooled_nodes = 1024;
+
+    /// The most spare waiters a queue keeps for reuse
+    static constexpr std::size_t max_pooled_waiters = 64;
+
+    /// A consumer waiting in async_pop or async_pop_some. Waiters are
+    /// recycled, so the handler slots double as the queue's inline storage
+    /// for completion handlers.
+    struct waiter
+    {
+        waiter *next = nullptr;
+
+        // async_pop stores its handler in handler, async_pop_some in
+        // batch_handler, with a batch_limit greater than zero
+        poly_handler< void(error_code, value_type) > handler;
+        poly_handler< void(error_code, batch_type) > batch_handler;
+        std::size_t                                  batch_limit = 0;
+
+        // The handler's associated executor, and outstanding work on it
+        net::any_io_executor executor;
+        net::any_io_executor work;
+    };
+
+    /// A producer suspended in async_push, waiting for capacity
+    struct pending_push
+    {
+        value_type                       value;
+        std::size_t                      lane;
+        poly_handler< void(error_code) > handler;
+        net::any_io_executor             executor;
+    };
+
+    /// Store the handler in a waiter and join the queue of waiters on the
+    /// default executor. May be called on any thread.
+    template < class Handler, class Stored >
+    void
+    initiate_wait(Handler &&        handler,
+                  Stored waiter::*stored,
+                  std::size_t       batch_limit);
+
+    /// Wake the consumers if any are waiting and this push was the first of a
+    /// batch
+    void
+    notify(bool was_empty);
+
+    /// Move everything the producers have pushed into values_.
+    /// Must be called on the default executor.
+    void
+    receive();
+
+    /// The number of elements received and ready for delivery
+    std::size_t
+    ready() const noexcept;
+
+    /// Remove the next element to deliver: the oldest in the most urgent
+    /// lane which has any. There must be at least one element ready.
+    node_type *
+    pop_ready() noexcept;
+
     void
     maybe_complete();
 
+    /// Complete waiting consumers, in the order in which they arrived, while
+    /// there is anything to give them.
+    /// @return true if elements were removed from the queue
+    bool
+    deliver();
+
+    /// Complete one waiter with the next element(s) in the queue, or with the
+    /// queue's error, and recycle it. The handler is invoked before this
+    /// function returns if immediately is true, and posted otherwise.
+    /// @return the number of elements removed from the queue
+    std::size_t
+    complete(waiter *w, bool immediately);
+
+    /// True if a waiter may be completed from within its initiating
+    /// function: we are on the default executor, nobody is ahead of it, there
+    /// is something to give it, and its handler would run on this executor
+    /// anyway.
+    bool
+    can_complete_immediately(waiter const &w);
+
+    /// Invoke f now, within an immediate_completion::scope, or post it to ex
+    template < class F >
+    static void
+    invoke_or_post(net::any_io_executor const &ex, bool immediately, F &&f);
+
+    /// Admit suspended producers, in order, while there is capacity.
+    /// Must be called on the default executor.
+    void
+    admit_pushers();
+
+    /// Destroy every element in the queue
+    void
+    clear();
+
+    /// Reserve capacity for one element of the given size.
+    /// Fails if there is no capacity or if a suspended producer is ahead of
+    /// us, unless we are that producer.
+    bool
+    reserve(std::size_t bytes, bool suspended) noexcept;
+
+    /// Account for elements added without regard to capacity
+    void
+    charge(std::size_t items, std::size_t bytes) noexcept;
+
+    /// Return capacity to the queue
+    void
+    release(std::size_t items, std::size_t bytes) noexcept;
+
+    /// Take a spare node, or allocate one, and construct a value in it.
+    /// May be called on any thread.
+    template < class... Args >
+    node_type *
+    make_node(Args &&...args);
+
+    /// Destroy the value in a node and keep the node for reuse
+    void
+    recycle(node_type *n) noexcept;
+
+    /// Recycle a chain of nodes, terminated by nullptr
+    void
+    destroy(node_type *chain) noexcept;
+
   private:
-    std::atomic< waiting_state >                 state_ = not_waiting;
-    poly_handler< void(error_code, value_type) > handler_;
-    net::any_io_executor                         handler_executor_;
+    // Written by producers on any thread. Kept on its own cache line so that
+    // producers do not invalidate the consumer's state on every push.
+    alignas(cache_line_size) std::array< mpsc_list< node_type >, lane_count >
+                           inbox_;
+    node_pool< node_type > pool_;
+
+    // Updated by producers and the consumer. Empty unless the queue is
+    // instrumented.
+    stats_type stats_;
+
+    // Capacity accounting. Only used if the queue is bounded.
+    alignas(cache_line_size) async_queue_limits const limits_;
+    std::atomic< std::size_t >                        items_ { 0 };
+    std::atomic< std::size_t >                        bytes_ { 0 };
+    std::atomic< std::size_t >                        pushers_waiting_ { 0 };
+
+    // Set by stop(), on any thread. Producers check it so that a stopped
+    // queue accepts nothing, and charges nothing.
+    std::atomic< bool > stopped_ { false };
+
+    // The number of consumers waiting. Incremented by consumers on
+    // initiation and decremented by the default executor on completion.
+    alignas(cache_line_size) std::atomic< std::size_t > waiting_ { 0 };
+    node_pool< waiter >                                 waiter_pool_;
 
-    using queue_impl = std::queue< T, std::deque< T > >;
-    queue_impl    values_;
+    // Only touched on the default executor
+    alignas(cache_line_size) intrusive_fifo< waiter > waiters_;
+    std::array< intrusive_fifo< node_type >, lane_count > values_;
+    std::deque< pending_push >                            pending_;
     error_code    ec_;   // error state of the queue
     executor_type default_executor_;
 };
 }   // namespace beast_fun_times::util::detail
 
 namespace beast_fun_times::util::detail {
-template < class T, class Executor >
+template < class T, class Executor, class Traits >
+async_queue_impl< T, Executor, Traits >::~async_queue_impl()
+{
+    for (auto &inbox : inbox_)
+        destroy(inbox.take_all());
+    for (auto &values : values_)
+        while (not values.empty())
+            recycle(values.pop());
+    while (not waiters_.empty())
+        delete waiters_.pop();
+}
+
+template < class T, class Executor, class Traits >
+template < class Handler, class Stored >
+void
+async_queue_impl< T, Executor, Traits >::initiate_wait(
+    Handler &&handler, Stored waiter::*stored, std::size_t batch_limit)
+{
+    auto w = std::unique_ptr< waiter >(waiter_pool_.try_get());
+    if (not w)
+        w.reset(new waiter());
+
+    w->executor    = net::get_associated_executor(handler, default_executor_);
+    w->batch_limit = batch_limit;
+    (*w).*stored   = std::move(handler);
+
+    if (can_complete_immediately(*w))
+    {
+        // The fast path: the value is ready, so skip both trips through the
+        // scheduler
+        if (complete(w.release(), /*immediately =*/true))
+            admit_pushers();
+        return;
+    }
+
+    // Only the waiter's work member maintains outstanding work. If executor
+    // tracked work it would keep the handler's context alive after the
+    // handler had been invoked.
+    w->work =
+        net::prefer(w->executor, net::execution::outstanding_work.tracked);
+
+    ++waiting_;
+    // pairs with the fence in notify(): either a producer sees that we are
+    // waiting, or we see what it pushed
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    net::dispatch(net::bind_executor(
+        default_executor_,
+        [self = boost::intrusive_ptr(this), w = std::move(w)]() mutable {
+            self->waiters_.push(w.release());
+            self->maybe_complete();
+        }));
+}
+
+template < class T, class Executor, class Traits >
 template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, value_type))
                WaitHandler >
 BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler, void(error_code, value_type))
-async_queue_impl< T, Executor >::async_pop(WaitHandler &&handler)
+async_queue_impl< T, Executor, Traits >::async_pop(WaitHandler &&handler)
 {
-    assert(this->state_ == not_waiting);
-
     auto initiate = [this](auto &&deduced_handler) {
+        this->initiate_wait(
+            std::move(deduced_handler), &waiter::handler, /*batch_limit =*/0);
+    };
+
+    return net::async_initiate< WaitHandler, void(error_code, value_type) >(
+        initiate, handler);
+}
+
+template < class T, class Executor, class Traits >
+template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, batch_type))
+               WaitHandler >
+BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler, void(error_code, batch_type))
+async_queue_impl< T, Executor, Traits >::async_pop_some(
+    std::size_t max_items, WaitHandler &&handler)
+{
+    assert(max_items > 0);
+
+    auto initiate = [this, max_items](auto &&deduced_handler) {
+        this->initiate_wait(
+            std::move(deduced_handler), &waiter::batch_handler, max_items);
+    };
+
+    return net::async_initiate< WaitHandler, void(error_code, batch_type) >(
+        initiate, handler);
+}
+
+template < class T, class Executor, class Traits >
+template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code)) PushHandler >
+BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(PushHandler, void(error_code))
+async_queue_impl< T, Executor, Traits >::async_push(value_type     v,
+                                                    std::size_t    lane,
+                                                    PushHandler &&handler)
+{
+    auto initiate = [this, lane](auto &&deduced_handler, value_type v) {
         auto hexec = net::get_associated_executor(deduced_handler,
                                                   this->default_executor_);
-        this->handler_executor_ =
-            net::prefer(hexec, net::execution::outstanding_work.tracked);
-        this->handler_ =
-            [wg = handler_executor_,
-             dh = std::move(deduced_handler)](auto &&...args) mutable -> void {
-            dh(std::forward< decltype(args) >(args)...);
-        };
-
-        this->state_ = waiting;
+        if (this->try_push(std::move(v), lane))
+        {
+            // A stop() on another thread may have raced the push, in which
+            // case the value is discarded with the rest of the queue. Look
+            // again now the value is published, so that the producer is not
+            // told it was delivered. Pairs with the fence in stop().
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto ec = this->stopped_.load(std::memory_order_relaxed)
+                          ? error_code(net::error::operation_aborted)
+                          : error_code();
+            net::post(net::bind_executor(
+                hexec, [h = std::move(deduced_handler), ec]() mutable {
+                    h(ec);
+                }));
+            return;
+        }
 
+        // The queue is full. Suspend this producer until the consumer makes
+        // room. Bookkeeping for suspended producers happens on the default
+        // executor, so it needs no locks. This is the slow path.
+        ++this->pushers_waiting_;
+        auto stored = poly_handler< void(error_code) >(
+            [wg = net::prefer(hexec, net::execution::outstanding_work.tracked),
+             dh = std::move(deduced_handler)](error_code ec) mutable {
+                dh(ec);
+            });
         net::dispatch(net::bind_executor(
             this->default_executor_,
-            [self = boost::intrusive_ptr(this)]() { self->maybe_complete(); }));
+            [self = boost::intrusive_ptr(this),
+             v    = std::move(v),
+             h    = std::move(stored),
+             lane,
+             hexec]() mutable {
+                self->pending_.push_back(
+                    pending_push { std::move(v), lane, std::move(h), hexec });
+                self->maybe_complete();
+            }));
     };
 
-    return net::async_initiate< WaitHandler, void(error_code, value_type) >(
-        initiate, handler);
+    return net::async_initiate< PushHandler, void(error_code) >(
+        initiate, handler, std::move(v));
 }
 
-template < class T, class Executor >
+template < class T, class Executor, class Traits >
 auto
-async_queue_impl< T, Executor >::construct(executor_type exec) -> ptr
+async_queue_impl< T, Executor, Traits >::construct(executor_type      exec,
+                                                   async_queue_limits limits)
+    -> ptr
 {
-    return ptr(new async_queue_impl(exec));
+    return ptr(new async_queue_impl(exec, limits));
 }
 
-template < class T, class Executor >
+template < class T, class Executor, class Traits >
 void
-async_queue_impl< T, Executor >::push(value_type v)
+async_queue_impl< T, Executor, Traits >::push(value_type v, std::size_t lane)
 {
-    net::dispatch(net::bind_executor(
-        this->default_executor_,
-        [self = boost::intrusive_ptr(this), v = std::move(v)]() mutable {
-            self->values_.push(std::move(v));
-            self->maybe_complete();
-        }));
+    assert(lane < lane_count);
+    if (stopped_.load(std::memory_order_acquire))
+        return;
+    if (limits_.bounded())
+        charge(1, traits_type::size_of(v));
+    notify(inbox_[lane].push(make_node(std::move(v))));
 }
 
-template < class T, class Executor >
+template < class T, class Executor, class Traits >
+bool
+async_queue_impl< T, Executor, Traits >::try_push(value_type &&v,
+                                                  std::size_t  lane)
+{
+    assert(lane < lane_count);
+    if (stopped_.load(std::memory_order_acquire))
+        return false;
+    if (limits_.bounded() and
+        not reserve(traits_type::size_of(v), /*suspended =*/false))
+        return false;
+    notify(inbox_[lane].push(make_node(std::move(v))));
+    return true;
+}
+
+template < class T, class Executor, class Traits >
+template < class InputIterator >
 void
-async_queue_impl< T, Executor >::maybe_complete()
+async_queue_impl< T, Executor, Traits >::push_range(InputIterator first,
+                                                    InputIterator last,
+                                                    std::size_t   lane)
 {
-    // running in default executor...
-    if (values_.empty() and not ec_)
+    assert(lane < lane_count);
+    if (first == last or stopped_.load(std::memory_order_acquire))
         return;
-    if (state_.exchange(not_waiting) != waiting)
+
+    // Build the whole chain before publishing it, so that the consumer sees
+    // either none or all of the range
+    node_type * head  = nullptr;
+    node_type * tail  = nullptr;
+    std::size_t items = 0;
+    std::size_t bytes = 0;
+    try
+    {
+        for (; first != last; ++first)
+        {
+            auto n = make_node(*first);
+            if (tail)
+                tail->next = n;
+            else
+                head = n;
+            tail = n;
+            ++items;
+            if (limits_.bounded())
+                bytes += traits_type::size_of(n->value);
+        }
+    }
+    catch (...)
+    {
+        destroy(head);
+        throw;
+    }
+
+    if (limits_.bounded())
+        charge(items, bytes);
+    notify(inbox_[lane].push(head, tail));
+}
+
+template < class T, class Executor, class Traits >
+void
+async_queue_impl< T, Executor, Traits >::notify(bool was_empty)
+{
+    // May be called from any thread. Only the push which finds the inbox
+    // empty schedules the consumer. Subsequent pushes ride along with it.
+    if (not was_empty)
+        return;
+
+    // A consumer which is not waiting will look in the inbox when it next
+    // waits, so if nobody is waiting there is nobody to wake. Skipping the post keeps a
+    // push/pop cycle to a single posted operation.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting_.load() == 0)
         return;
 
+    net::post(net::bind_executor(
+        this->default_executor_,
+        [self = boost::intrusive_ptr(this)]() { self->maybe_complete(); }));
+}
+
+template < class T, class Executor, class Traits >
+void
+async_queue_impl< T, Executor, Traits >::receive()
+{
+    for (std::size_t lane = 0; lane < lane_count; ++lane)
+        values_[lane].splice(inbox_[lane].take_all());
+}
+
+template < class T, class Executor, class Traits >
+std::size_t
+async_queue_impl< T, Executor, Traits >::ready() const noexcept
+{
+    std::size_t n = 0;
+    for (auto &values : values_)
+        n += values.size();
+    return n;
+}
+
+template < class T, class Executor, class Traits >
+auto
+async_queue_impl< T, Executor, Traits >::pop_ready() noexcept -> node_type *
+{
+    for (auto &values : values_)
+        if (not values.empty())
+            return values.pop();
+    assert(not "pop_ready: nothing ready");
+    return nullptr;
+}
+
+template < class T, class Executor, class Traits >
+void
+async_queue_impl< T, Executor, Traits >::maybe_complete()
+{
+    // running in default executor...
+    receive();
+    admit_pushers();
+    if (deliver())
+        admit_pushers();
+}
+
+template < class T, class Executor, class Traits >
+bool
+async_queue_impl< T, Executor, Traits >::deliver()
+{
+    std::size_t delivered = 0;
+    while (not waiters_.empty() and (ec_ or ready()))
+    {
+        auto w = waiters_.pop();
+        --waiting_;
+        delivered += complete(w, /*immediately =*/false);
+    }
+    return delivered != 0;
+}
+
+template < class T, class Executor, class Traits >
+bool
+async_queue_impl< T, Executor, Traits >::can_complete_immediately(
+    waiter const &w)
+{
+    if (not immediate_completion::available() or
+        not running_in_this_thread(default_executor_) or not waiters_.empty())
+        return false;
+    receive();
+    admit_pushers();
+    return (ec_ or ready()) and
+           w.executor == net::any_io_executor(default_executor_);
+}
+
+template < class T, class Executor, class Traits >
+template < class F >
+void
+async_queue_impl< T, Executor, Traits >::invoke_or_post(
+    net::any_io_executor const &ex, bool immediately, F &&f)
+{
+    if (immediately)
+    {
+        auto scope = immediate_completion::scope();
+        f();
+    }
+    else
+        net::post(net::bind_executor(ex, std::forward< F >(f)));
+}
+
+template < class T, class Executor, class Traits >
+std::size_t
+async_queue_impl< T, Executor, Traits >::complete(waiter *w, bool immediately)
+{
+    // Take everything we need from the waiter and recycle it before the
+    // handler runs, so that a consumer which waits again from its handler
+    // can reuse it
+    auto hexec       = std::move(w->executor);
+    auto work        = std::move(w->work);
+    auto batch_limit = w->batch_limit;
+    auto handler     = std::move(w->handler);
+    auto batch_h     = std::move(w->batch_handler);
+    if (not waiter_pool_.put(w))
+        delete w;
+
     if (ec_)
     {
-        net::post(
-            net::bind_executor(this->handler_executor_,
-                               [h  = std::move(this->handler_),
-                                ec = ec_]() mutable { h(ec, value_type()); }));
-        ec_.clear();
+        if (batch_limit)
+            invoke_or_post(hexec,
+                           immediately,
+                           [h  = std::move(batch_h),
+                            wg = std::move(work),
+                            ec = ec_]() mutable { h(ec, batch_type()); });
+        else
+            invoke_or_post(hexec,
+                           immediately,
+                           [h  = std::move(handler),
+                            wg = std::move(work),
+                            ec = ec_]() mutable { h(ec, value_type()); });
+        return 0;
+    }
+
+    std::size_t bytes = 0;
+    if (batch_limit)
+    {
+        // hand over everything that is ready, up to the limit, in one
+        // completion
+        auto batch = batch_type();
+        batch.reserve(std::min(ready(), batch_limit));
+        while (batch.size() < batch_limit and ready())
+        {
+            auto n = pop_ready();
+            stats_.on_pop(*n);
+            if (limits_.bounded())
+                bytes += traits_type::size_of(n->value);
+            batch.push_back(std::move(n->value));
+            recycle(n);
+        }
+        auto items = batch.size();
+        release(items, bytes);
+        invoke_or_post(hexec,
+                       immediately,
+                       [b  = std::move(batch),
+                        h  = std::move(batch_h),
+                        wg = std::move(work)]() mutable {
+                           h(error_code(), std::move(b));
+                       });
+        return items;
     }
     else
     {
-        net::post(net::bind_executor(this->handler_executor_,
-                                     [v = std::move(this->values_.front()),
-                                      h = std::move(this->handler_)]() mutable {
-                                         h(error_code(), std::move(v));
-                                     }));
-        values_.pop();
+        auto n = pop_ready();
+        stats_.on_pop(*n);
+        if (limits_.bounded())
+            bytes = traits_type::size_of(n->value);
+        auto v = std::move(n->value);
+        recycle(n);
+        release(1, bytes);
+        invoke_or_post(hexec,
+                       immediately,
+                       [v  = std::move(v),
+                        h  = std::move(handler),
+                        wg = std::move(work)]() mutable {
+                           h(error_code(), std::move(v));
+                       });
+        return 1;
+    }
+}
+
+template < class T, class Executor, class Traits >
+void
+async_queue_impl< T, Executor, Traits >::admit_pushers()
+{
+    while (not pending_.empty())
+    {
+        auto &p  = pending_.front();
+        auto  ec = ec_;
+        if (not ec)
+        {
+            if (not reserve(traits_type::size_of(p.value),
+                            /*suspended =*/true))
+                break;
+            values_[p.lane].push(make_node(std::move(p.value)));
+        }
+        net::post(net::bind_executor(
+            p.executor,
+            [h = std::move(p.handler), ec]() mutable { h(ec); }));
+        pending_.pop_front();
+        --pushers_waiting_;
+    }
+}
+
+template < class T, class Executor, class Traits >
+void
+async_queue_impl< T, Executor, Traits >::clear()
+{
+    std::size_t items = 0;
+    std::size_t bytes = 0;
+    while (ready())
+    {
+        auto n = pop_ready();
+        stats_.on_discard(*n);
+        ++items;
+        if (limits_.bounded())
+            bytes += traits_type::size_of(n->value);
+        recycle(n);
+    }
+    release(items, bytes);
+}
+
+template < class T, class Executor, class Traits >
+bool
+async_queue_impl< T, Executor, Traits >::reserve(std::size_t bytes,
+                                                 bool        suspended) noexcept
+{
+    if (not limits_.bounded())
+        return true;
+
+    // producers which have been suspended have priority
+    if (not suspended and pushers_waiting_.load(std::memory_order_acquire))
+        return false;
+
+    auto items = items_.load(std::memory_order_relaxed);
+    do
+        if (items >= limits_.max_items)
+            return false;
+    while (not items_.compare_exchange_weak(items, items + 1));
+
+    // An element larger than the byte limit is admitted into an empty queue.
+    // Otherwise it could never be admitted at all.
+    auto total = bytes_.load(std::memory_order_relaxed);
+    do
+        if (items != 0 and
+            (total > limits_.max_bytes or bytes > limits_.max_bytes - total))
+        {
+            items_.fetch_sub(1);
+            return false;
+        }
+    while (not bytes_.compare_exchange_weak(total, total + bytes));
+
+    return true;
+}
+
+template < class T, class Executor, class Traits >
+void
+async_queue_impl< T, Executor, Traits >::charge(std::size_t items,
+                                                std::size_t bytes) noexcept
+{
+    items_.fetch_add(items);
+    bytes_.fetch_add(bytes);
+}
+
+template < class T, class Executor, class Traits >
+void
+async_queue_impl< T, Executor, Traits >::release(std::size_t items,
+                                                 std::size_t bytes) noexcept
+{
+    if (limits_.bounded())
+    {
+        items_.fetch_sub(items);
+        bytes_.fetch_sub(bytes);
     }
 }
 
-template < class T, class Executor >
+template < class T, class Executor, class Traits >
 void
-async_queue_impl< T, Executor >::stop()
+async_queue_impl< T, Executor, Traits >::stop()
 {
+    // Refuse new pushes from now on. A push already under way may still land
+    // in the inbox; it is destroyed with the queue.
+    stopped_.store(true, std::memory_order_release);
+    // either an async_push sees stopped_, or its value is published before
+    // the inbox is emptied below
+    std::atomic_thread_fence(std::memory_order_seq_cst);
     net::dispatch(net::bind_executor(
         this->default_executor_, [self = boost::intrusive_ptr(this)]() mutable {
             self->ec_ = net::error::operation_aborted;
-            while (not self->values_.empty())
-                self->values_.pop();
+            self->receive();
+            self->clear();
             self->maybe_complete();
         }));
 }
 
-}   // namespace beast_fun_times::util::detail
\ No newline at end of file
+template < class T, class Executor, class Traits >
+template < class... Args >
+auto
+async_queue_impl< T, Executor, Traits >::make_node(Args &&...args)
+    -> node_type *
+{
+    auto n = pool_.try_get();
+    if (not n)
+        n = new node_type();
+    try
+    {
+        new (&n->value) value_type(std::forward< Args >(args)...);
+    }
+    catch (...)
+    {
+        if (not pool_.put(n))
+            delete n;
+        throw;
+    }
+    n->next = nullptr;
+    stats_.on_push(*n);
+    return n;
+}
+
+template < class T, class Executor, class Traits >
+void
+async_queue_impl< T, Executor, Traits >::recycle(node_type *n) noexcept
+{
+    n->value.~value_type();
+    if (not pool_.put(n))
+        delete n;
+}
+
+template < class T, class Executor, class Traits >
+void
+async_queue_impl< T, Executor, Traits >::destroy(node_type *chain) noexcept
+{
+    while (chain)
+        recycle(std::exchange(chain, chain->next));
+}
+
+}   // namespace beast_fun_times::util::detail
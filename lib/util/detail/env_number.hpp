@@ -0,0 +1,31 @@
+#pragma once
+
+#include <charconv>
+#include <cstdlib>
+#include <string_view>
+#include <type_traits>
+
+namespace beast_fun_times::util::detail {
+/// The value of the environment variable name, read as a decimal number.
+///
+/// If the variable is unset, is not wholly a number, is negative, or does
+/// not fit in a T, otherwise is returned instead. None of the settings read
+/// from the environment has a meaning for a negative number.
+template < class T >
+T
+env_number(char const *name, T otherwise)
+{
+    static_assert(std::is_integral_v< T >);
+
+    auto value = std::getenv(name);
+    if (not value)
+        return otherwise;
+    auto s      = std::string_view(value);
+    auto result = T();
+    auto r      = std::from_chars(s.data(), s.data() + s.size(), result);
+    if (r.ec != std::errc() or r.ptr != s.data() + s.size() or result < T())
+        return otherwise;
+    return result;
+}
+
+}   // namespace beast_fun_times::util::detail
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace beast_fun_times::util::detail {
+/// A per-thread cache of memory for type-erased handlers which are too big to
+/// be stored inline, and for anything else allocated through a
+/// recycling_allocator.
+///
+/// Blocks are grouped in size classes of granularity bytes, up to
+/// max_cached_size. Each thread keeps up to max_cached_blocks spare blocks
+/// per class, so a handler which is stored and invoked repeatedly on a thread
+/// allocates only the first time. Memory freed on a thread other than the one
+/// which allocated it joins the freeing thread's cache. Bigger blocks go
+/// straight to operator new.
+struct handler_memory
+{
+    static constexpr std::size_t granularity       = 64;
+    static constexpr std::size_t size_classes      = 8;
+    static constexpr std::size_t max_cached_size   = granularity * size_classes;
+    static constexpr std::size_t max_cached_blocks = 16;
+
+    /// What the calling thread has asked of its cache
+    struct counters
+    {
+        std::size_t allocations;   // every allocation
+        std::size_t recycled;      // of which served from the cache
+        std::size_t oversize;      // of which too big to be cached
+    };
+
+    static void *
+    allocate(std::size_t size)
+    {
+        ++stats.allocations;
+        auto c = size_class(size);
+        if (c >= size_classes)
+        {
+            ++stats.oversize;
+            return ::operator new(size);
+        }
+
+        if (not torn_down)
+        {
+            auto &spares = cache().spares[c];
+            if (spares.head)
+            {
+                ++stats.recycled;
+                --spares.count;
+                auto b      = spares.head;
+                spares.head = b->next;
+                return b;
+            }
+        }
+        return ::operator new((c + 1) * granularity);
+    }
+
+    static void
+    deallocate(void *p, std::size_t size) noexcept
+    {
+        auto c = size_class(size);
+        if (c < size_classes and not torn_down)
+        {
+            auto &spares = cache().spares[c];
+            if (spares.count < max_cached_blocks)
+            {
+                ++spares.count;
+                spares.head = new (p) block { spares.head };
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+
+  private:
+    struct block
+    {
+        block *next;
+    };
+
+    struct free_list
+    {
+        block *     head  = nullptr;
+        std::size_t count = 0;
+    };
+
+    struct thread_cache
+    {
+        thread_cache() = default;
+
+        thread_cache(thread_cache const &) = delete;
+
+        thread_cache &
+        operator=(thread_cache const &) = delete;
+
+        ~thread_cache()
+        {
+            // handlers destroyed later in this thread's exit bypass the cache
+            torn_down = true;
+            for (auto &spares : this->spares)
+                while (spares.head)
+                    ::operator delete(std::exchange(spares.head,
+                                                    spares.head->next));
+        }
+
+        std::array< free_list, size_classes > spares;
+    };
+
+    static std::size_t
+    size_class(std::size_t size) noexcept
+    {
+        return size ? (size - 1) / granularity : 0;
+    }
+
+    static thread_cache &
+    cache()
+    {
+        thread_local thread_cache c;
+        return c;
+    }
+
+    static inline thread_local bool torn_down = false;
+
+  public:
+    static inline thread_local counters stats {};
+};
+
+}   // namespace beast_fun_times::util::detail
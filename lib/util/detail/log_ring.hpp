@@ -0,0 +1,167 @@
+#pragma once
+#include "util/detail/mpsc_list.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+namespace beast_fun_times::util::detail {
+/// One formatted log line, stored in a log_ring.
+struct log_record
+{
+    static constexpr std::size_t size = 256;
+
+    std::chrono::system_clock::time_point when;
+    std::uint16_t                         length;
+    std::uint8_t                          level;
+    bool                                  truncated;
+    std::array< char,
+                size - sizeof(std::chrono::system_clock::time_point) - 4 >
+        text;
+};
+
+static_assert(sizeof(log_record) == log_record::size);
+
+/// Formats the parts of a log line into a log_record, truncating at the
+/// end of the record.
+///
+/// A part may be anything convertible to std::string_view, a char, or an
+/// arithmetic type, which is formatted with std::to_chars.
+struct log_writer
+{
+    explicit log_writer(log_record &r) noexcept
+    : rec(r)
+    , out(r.text.data())
+    , end(r.text.data() + r.text.size())
+    {
+    }
+
+    template < class Part >
+    void
+    append(Part const &part) noexcept
+    {
+        if constexpr (std::is_convertible_v< Part const &, std::string_view >)
+            append_chars(std::string_view(part));
+        else if constexpr (std::is_same_v< Part, char >)
+            append_chars(std::string_view(&part, 1));
+        else if constexpr (std::is_same_v< Part, bool >)
+            append_chars(part ? "true" : "false");
+        else if constexpr (std::is_arithmetic_v< Part >)
+        {
+            char buf[32];
+            auto r = std::to_chars(buf, buf + sizeof(buf), part);
+            append_chars(std::string_view(buf, std::size_t(r.ptr - buf)));
+        }
+        else
+            static_assert(std::is_arithmetic_v< Part >,
+                          "log parts must be strings, chars or numbers");
+    }
+
+    void
+    append_chars(std::string_view s) noexcept
+    {
+        auto n = std::min(s.size(), std::size_t(end - out));
+        if (n < s.size())
+            rec.truncated = true;
+        std::memcpy(out, s.data(), n);
+        out += n;
+    }
+
+    void
+    finish() noexcept
+    {
+        rec.length = std::uint16_t(out - rec.text.data());
+    }
+
+    log_record &rec;
+    char *      out;
+    char *      end;
+};
+
+/// A fixed-size, lock-free, single producer single consumer queue of log
+/// records.
+///
+/// Each logging thread owns one. When it is full, records are dropped and
+/// counted rather than making the producer wait.
+class log_ring
+{
+  public:
+    static constexpr std::size_t capacity = 512;   // a power of 2
+
+    /// The next free record, or nullptr if the ring is full.
+    /// Called by the producer.
+    log_record *
+    prepare() noexcept
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == capacity)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &records_[head % capacity];
+    }
+
+    /// Publish the record returned by prepare. Called by the producer.
+    /// Returns true if the consumer had taken everything before it, and so
+    /// may be asleep.
+    bool
+    commit() noexcept
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        head_.store(head + 1, std::memory_order_release);
+        return tail_.load(std::memory_order_acquire) == head;
+    }
+
+    /// True if nothing is waiting to be consumed. Called by the consumer.
+    bool
+    empty() const noexcept
+    {
+        return head_.load(std::memory_order_acquire) ==
+               tail_.load(std::memory_order_relaxed);
+    }
+
+    /// Pass every published record to f, oldest first, then release them.
+    /// Called by the consumer. Returns the number of records consumed.
+    template < class F >
+    std::size_t
+    consume(F &&f)
+    {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        auto head = head_.load(std::memory_order_acquire);
+        for (auto i = tail; i != head; ++i)
+            f(records_[i % capacity]);
+        tail_.store(head, std::memory_order_release);
+        return std::size_t(head - tail);
+    }
+
+    /// The number of records dropped since the last call
+    std::uint64_t
+    take_dropped() noexcept
+    {
+        return dropped_.exchange(0, std::memory_order_relaxed);
+    }
+
+    /// Set when the owning thread exits. The consumer discards the ring
+    /// once it has drained it.
+    std::atomic< bool > abandoned { false };
+
+  private:
+    // Written by the producer
+    alignas(cache_line_size) std::atomic< std::uint64_t > head_ { 0 };
+    std::atomic< std::uint64_t > dropped_ { 0 };
+
+    // Written by the consumer
+    alignas(cache_line_size) std::atomic< std::uint64_t > tail_ { 0 };
+
+    std::array< log_record, capacity > records_;
+};
+
+}   // namespace beast_fun_times::util::detail
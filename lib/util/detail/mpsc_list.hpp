@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace beast_fun_times::util::detail {
+/// The size of a cache line on the platforms we care about.
+///
+/// std::hardware_destructive_interference_size would be the portable answer,
+/// but gcc warns that its value is not ABI-stable, so we simply say 64.
+constexpr std::size_t cache_line_size = 64;
+
+/// An intrusive, lock-free, multi-producer single-consumer list.
+///
+/// Any thread may push. Exactly one thread at a time may take.
+/// Node must have a public member `Node *next`.
+///
+/// Producers push onto a lock-free stack. The consumer takes the entire stack
+/// in one atomic exchange and reverses it, so items are delivered in the order
+/// in which they were pushed. Because take_all() empties the list, the first
+/// push after a take_all() can report that the consumer needs waking. This
+/// gives us a wake-up of at most once per batch, rather than once per item.
+template < class Node >
+struct mpsc_list
+{
+    mpsc_list() = default;
+
+    mpsc_list(mpsc_list const &) = delete;
+
+    mpsc_list &
+    operator=(mpsc_list const &) = delete;
+
+    /// Push a single node.
+    /// @return true if the list was empty before the push, i.e. the consumer
+    /// needs to be woken
+    bool
+    push(Node *n) noexcept
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        do
+            n->next = head;
+        while (not head_.compare_exchange_weak(
+            head, n, std::memory_order_release, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    /// Push a pre-linked chain of nodes [first ... last] in one operation.
+    /// The chain must be linked first->next->...->last in FIFO order.
+    /// @return true if the list was empty before the push
+    bool
+    push(Node *first, Node *last) noexcept
+    {
+        // the list is stored newest-first, so reverse the chain before
+        // publishing it
+        Node *top = nullptr;
+        for (auto n = first; n;)
+        {
+            auto next = n == last ? nullptr : n->next;
+            n->next   = top;
+            top       = n;
+            n         = next;
+        }
+
+        auto head = head_.load(std::memory_order_relaxed);
+        do
+            first->next = head;
+        while (not head_.compare_exchange_weak(
+            head, top, std::memory_order_release, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    /// Take every node in the list.
+    /// @return a chain of nodes in push order, terminated by nullptr
+    Node *
+    take_all() noexcept
+    {
+        auto  top  = head_.exchange(nullptr, std::memory_order_acquire);
+        Node *fifo = nullptr;
+        while (top)
+        {
+            auto next = top->next;
+            top->next = fifo;
+            fifo      = top;
+            top       = next;
+        }
+        return fifo;
+    }
+
+    bool
+    empty() const noexcept
+    {
+        return head_.load(std::memory_order_relaxed) == nullptr;
+    }
+
+  private:
+    std::atomic< Node * > head_ { nullptr };
+};
+
+/// A non-thread-safe intrusive FIFO of nodes, used on the consumer side.
+template < class Node >
+struct intrusive_fifo
+{
+    bool
+    empty() const noexcept
+    {
+        return head_ == nullptr;
+    }
+
+    std::size_t
+    size() const noexcept
+    {
+        return size_;
+    }
+
+    Node &
+    front() noexcept
+    {
+        return *head_;
+    }
+
+    /// Append a chain of nodes, terminated by nullptr
+    void
+    splice(Node *chain) noexcept
+    {
+        if (not chain)
+            return;
+        if (tail_)
+            tail_->next = chain;
+        else
+            head_ = chain;
+        for (tail_ = chain, ++size_; tail_->next; tail_ = tail_->next)
+            ++size_;
+    }
+
+    void
+    push(Node *n) noexcept
+    {
+        n->next = nullptr;
+        splice(n);
+    }
+
+    Node *
+    pop() noexcept
+    {
+        auto n = head_;
+        head_  = n->next;
+        if (not head_)
+            tail_ = nullptr;
+        --size_;
+        n->next = nullptr;
+        return n;
+    }
+
+  private:
+    Node *      head_ = nullptr;
+    Node *      tail_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+}   // namespace beast_fun_times::util::detail
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace beast_fun_times::util::detail {
+/// A bounded, lock-free pool of spare nodes.
+///
+/// Any thread may put a node back. Any thread may try to get one, but only
+/// one getter at a time gets anywhere: a getter which finds another getter
+/// busy comes away empty-handed and should allocate instead. Having a single
+/// getter is what makes popping from the underlying stack immune to ABA.
+/// Node must have a public member `Node *next`.
+template < class Node >
+struct node_pool
+{
+    explicit node_pool(std::size_t capacity) noexcept
+    : capacity_(capacity)
+    {
+    }
+
+    node_pool(node_pool const &) = delete;
+
+    node_pool &
+    operator=(node_pool const &) = delete;
+
+    ~node_pool()
+    {
+        auto n = head_.load(std::memory_order_acquire);
+        while (n)
+        {
+            auto next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+
+    /// Offer a spare node to the pool.
+    /// @return false if the pool is full, in which case the caller still owns
+    /// the node
+    bool
+    put(Node *n) noexcept
+    {
+        if (size_.fetch_add(1, std::memory_order_relaxed) >= capacity_)
+        {
+            size_.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        auto head = head_.load(std::memory_order_relaxed);
+        do
+            n->next = head;
+        while (not head_.compare_exchange_weak(
+            head, n, std::memory_order_release, std::memory_order_relaxed));
+        return true;
+    }
+
+    /// Take a spare node.
+    /// @return nullptr if the pool is empty or another thread is taking
+    Node *
+    try_get() noexcept
+    {
+        if (busy_.test_and_set(std::memory_order_acquire))
+            return nullptr;
+
+        // No other getter can remove head, so head->next cannot change
+        // underneath us. Concurrent puts only make the exchange fail.
+        auto head = head_.load(std::memory_order_acquire);
+        while (head and not head_.compare_exchange_weak(
+                            head,
+                            head->next,
+                            std::memory_order_acquire,
+                            std::memory_order_acquire))
+            ;
+        busy_.clear(std::memory_order_release);
+
+        if (head)
+            size_.fetch_sub(1, std::memory_order_relaxed);
+        return head;
+    }
+
+  private:
+    std::atomic< Node * >      head_ { nullptr };
+    std::atomic< std::size_t > size_ { 0 };
+    std::atomic_flag           busy_ = ATOMIC_FLAG_INIT;
+    std::size_t const          capacity_;
+};
+
+}   // namespace beast_fun_times::util::detail
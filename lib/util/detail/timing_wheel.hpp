@@ -0,0 +1,282 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+
+namespace beast_fun_times::util::detail {
+/// An entry in a timing_wheel. The wheel links entries in place, so
+/// scheduling and cancelling never allocate.
+struct wheel_entry
+{
+    static constexpr std::uint16_t unscheduled =
+        std::numeric_limits< std::uint16_t >::max();
+
+    bool
+    scheduled() const noexcept
+    {
+        return slot != unscheduled;
+    }
+
+    /// The tick at which the entry expires
+    std::uint64_t expiry = 0;
+
+    wheel_entry * prev = nullptr;
+    wheel_entry * next = nullptr;
+    std::uint16_t slot = unscheduled;
+};
+
+/// A hierarchical timing wheel, counting time in ticks.
+///
+/// Level 0 has a slot for each of the next 64 ticks. Each higher level has
+/// 64 slots, each covering a whole cycle of the level below. An entry is
+/// placed in the lowest level whose cycle contains its expiry, and moves down
+/// a level ("cascades") when the level below reaches its slot. Entries too
+/// far ahead for the top level wait in an overflow list, which is looked at
+/// once per top-level cycle.
+///
+/// Scheduling and cancelling are O(1). Advancing is O(1) per expired or
+/// cascaded entry, plus O(levels) per cycle of level 0: quiet ticks are
+/// skipped, not stepped through.
+///
+/// Not thread-safe.
+class timing_wheel
+{
+  public:
+    static constexpr unsigned    slot_bits = 6;
+    static constexpr std::size_t slots     = std::size_t(1) << slot_bits;
+    static constexpr std::size_t levels    = 4;
+
+    timing_wheel() = default;
+
+    timing_wheel(timing_wheel const &) = delete;
+
+    timing_wheel &
+    operator=(timing_wheel const &) = delete;
+
+    /// The tick the wheel has reached. Everything which expires at or
+    /// before it has been expired.
+    std::uint64_t
+    now() const noexcept
+    {
+        return now_;
+    }
+
+    /// The number of scheduled entries
+    std::size_t
+    size() const noexcept
+    {
+        return size_;
+    }
+
+    bool
+    empty() const noexcept
+    {
+        return size_ == 0;
+    }
+
+    /// Schedule an entry which is not scheduled. An expiry which has been
+    /// reached already is moved to the next tick.
+    void
+    schedule(wheel_entry &e, std::uint64_t expiry) noexcept
+    {
+        assert(not e.scheduled());
+        e.expiry = expiry > now_ ? expiry : now_ + 1;
+        link(e);
+        ++size_;
+    }
+
+    /// Remove an entry from the wheel. Returns false if it was not scheduled.
+    bool
+    cancel(wheel_entry &e) noexcept
+    {
+        if (not e.scheduled())
+            return false;
+        unlink(e);
+        --size_;
+        return true;
+    }
+
+    /// Advance to tick `to`, calling expire(wheel_entry&) with each entry
+    /// whose expiry is reached, in expiry order. Each entry is unscheduled
+    /// before it is passed to expire.
+    template < class Expire >
+    void
+    advance(std::uint64_t to, Expire &&expire)
+    {
+        while (now_ < to)
+        {
+            if (size_ == 0)
+            {
+                now_ = to;
+                return;
+            }
+
+            // the next occupied slot of level 0, or the end of its cycle
+            auto base = now_ & ~std::uint64_t(slots - 1);
+            auto next = base + slots;
+            if (auto s = next_occupied(0, index(now_, 0) + 1))
+                next = base + *s;
+            if (next > to)
+            {
+                now_ = to;
+                return;
+            }
+
+            now_ = next;
+            if (index(now_, 0) == 0)
+                cascade();
+
+            auto &head = heads_[slot_of(0, index(now_, 0))];
+            while (head)
+            {
+                auto &e = *head;
+                unlink(e);
+                --size_;
+                expire(e);
+            }
+        }
+    }
+
+    /// Remove every entry, calling f(wheel_entry&) with each after it is
+    /// unscheduled
+    template < class F >
+    void
+    clear(F &&f)
+    {
+        for (auto &head : heads_)
+            while (head)
+            {
+                auto &e = *head;
+                unlink(e);
+                --size_;
+                f(e);
+            }
+    }
+
+    /// The next tick at which advance has something to do, if anything is
+    /// scheduled. This is the next expiry in level 0, or the end of level
+    /// 0's cycle when an entry may have to cascade.
+    std::optional< std::uint64_t >
+    next_tick() const noexcept
+    {
+        if (size_ == 0)
+            return std::nullopt;
+        auto base = now_ & ~std::uint64_t(slots - 1);
+        if (auto s = next_occupied(0, index(now_, 0) + 1))
+            return base + *s;
+        return base + slots;
+    }
+
+  private:
+    static constexpr std::uint16_t overflow = levels * slots;
+
+    static std::size_t
+    index(std::uint64_t tick, std::size_t level) noexcept
+    {
+        return std::size_t(tick >> (level * slot_bits)) & (slots - 1);
+    }
+
+    static std::uint16_t
+    slot_of(std::size_t level, std::size_t index) noexcept
+    {
+        return std::uint16_t(level * slots + index);
+    }
+
+    /// The first occupied slot of a level at or after index `from`
+    std::optional< std::size_t >
+    next_occupied(std::size_t level, std::size_t from) const noexcept
+    {
+        if (from >= slots)
+            return std::nullopt;
+        auto bits = occupied_[level] & (~std::uint64_t(0) << from);
+        if (bits == 0)
+            return std::nullopt;
+#if defined(__GNUC__)
+        return std::size_t(__builtin_ctzll(bits));
+#else
+        auto n = std::size_t(0);
+        while (not(bits & 1))
+        {
+            bits >>= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    void
+    link(wheel_entry &e) noexcept
+    {
+        // the lowest level at which the expiry falls in the current cycle
+        auto level = std::size_t(0);
+        while (level < levels and
+               (e.expiry >> ((level + 1) * slot_bits)) !=
+                   (now_ >> ((level + 1) * slot_bits)))
+            ++level;
+
+        e.slot = level < levels ? slot_of(level, index(e.expiry, level))
+                                : overflow;
+        e.prev = nullptr;
+        e.next = heads_[e.slot];
+        if (e.next)
+            e.next->prev = &e;
+        heads_[e.slot] = &e;
+        if (level < levels)
+            occupied_[level] |= std::uint64_t(1) << index(e.expiry, level);
+    }
+
+    void
+    unlink(wheel_entry &e) noexcept
+    {
+        if (e.prev)
+            e.prev->next = e.next;
+        else
+            heads_[e.slot] = e.next;
+        if (e.next)
+            e.next->prev = e.prev;
+        if (not heads_[e.slot] and e.slot != overflow)
+            occupied_[e.slot / slots] &=
+                ~(std::uint64_t(1) << (e.slot % slots));
+        e.prev = e.next = nullptr;
+        e.slot          = wheel_entry::unscheduled;
+    }
+
+    /// Move entries down from each level whose slot now_ has reached, and
+    /// out of overflow when the top level's cycle is over
+    void
+    cascade() noexcept
+    {
+        auto level = std::size_t(1);
+        for (; level < levels; ++level)
+        {
+            relink(slot_of(level, index(now_, level)));
+            if (index(now_, level) != 0)
+                return;
+        }
+        relink(overflow);
+    }
+
+    void
+    relink(std::uint16_t slot) noexcept
+    {
+        auto e = heads_[slot];
+        while (e)
+        {
+            auto next = e->next;
+            unlink(*e);
+            link(*e);
+            e = next;
+        }
+    }
+
+    std::uint64_t                                   now_  = 0;
+    std::size_t                                     size_ = 0;
+    std::array< wheel_entry *, levels * slots + 1 > heads_ {};
+    std::array< std::uint64_t, levels >             occupied_ {};
+};
+
+}   // namespace beast_fun_times::util::detail
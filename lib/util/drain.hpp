@@ -0,0 +1,211 @@
+#pragma once
+#include "util/detail/env_number.hpp"
+#include "util/net.hpp"
+
+#include <boost/asio/compose.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace beast_fun_times::util
+{
+    /// How a server closes its connections when it is stopped
+    struct drain_settings
+    {
+        /// Connections asked to close at a time
+        std::size_t batch_size = 256;
+
+        /// The pause between batches, which lets the close frames of one
+        /// batch go out before the next is started
+        std::chrono::milliseconds batch_interval { 1 };
+
+        /// How long connections have to close before those left are closed
+        /// hard
+        std::chrono::milliseconds timeout { 5000 };
+
+        /// How often progress is reported
+        std::chrono::milliseconds report_interval { 500 };
+
+        /// The settings named by the environment, on top of the defaults.
+        /// DRAIN_BATCH_SIZE and DRAIN_TIMEOUT_MS are read. Values which are
+        /// missing, negative or not numbers are ignored.
+        static drain_settings
+        from_env()
+        {
+            auto s       = drain_settings();
+            s.batch_size = std::max< std::size_t >(
+                detail::env_number("DRAIN_BATCH_SIZE", s.batch_size), 1);
+            s.timeout = std::chrono::milliseconds(
+                detail::env_number("DRAIN_TIMEOUT_MS", s.timeout.count()));
+            return s;
+        }
+    };
+
+    /// How far a drain has got
+    struct drain_progress
+    {
+        std::size_t total    = 0;   // connections to drain
+        std::size_t stopping = 0;   // asked to close so far
+        std::size_t closed   = 0;   // gone
+        std::size_t aborted  = 0;   // closed hard at the deadline
+
+        std::chrono::steady_clock::duration elapsed {};
+    };
+
+    namespace detail
+    {
+        template < class Connection, class OnProgress >
+        struct drain_op
+        {
+            using clock_type = std::chrono::steady_clock;
+
+            struct state
+            {
+                net::steady_timer                          timer;
+                std::vector< std::weak_ptr< Connection > > connections;
+                drain_settings                             settings;
+                clock_type::time_point                     deadline;
+                OnProgress                                 on_progress;
+                drain_progress                             progress;
+                clock_type::time_point                     start;
+                clock_type::time_point                     report = start;
+                std::size_t                                next   = 0;
+                bool                                       waited = false;
+            };
+
+            // The connections are kept in three runs: [0, closed) are gone,
+            // [closed, next) have been asked to close, and [next, end) have
+            // not been asked yet. Each tick looks only at the middle run.
+
+            std::unique_ptr< state > s;
+
+            /// How often to look for connections having gone, once every
+            /// connection has been asked to close
+            static constexpr auto poll_interval = std::chrono::milliseconds(10);
+
+            template < class Self >
+            void
+            operator()(Self &self, error_code = {})
+            {
+                auto &st  = *s;
+                auto  now = clock_type::now();
+
+                // ask the next batch to close
+                auto end = std::min(st.next + st.settings.batch_size,
+                                    st.connections.size());
+                for (; st.next < end; ++st.next)
+                    if (auto c = st.connections[st.next].lock())
+                    {
+                        c->stop();
+                        ++st.progress.stopping;
+                    }
+                    else
+                        gone(st.next);
+
+                for (auto i = st.progress.closed; i < st.next; ++i)
+                    if (st.connections[i].expired())
+                        gone(i);
+                st.progress.elapsed = now - st.start;
+
+                // the first pass always waits, so the completion is never
+                // invoked from within async_drain
+                auto done = st.waited and
+                            (st.progress.closed == st.progress.total or
+                             now >= st.deadline);
+                if (done)
+                    return finish(self);
+
+                if (now >= st.report)
+                {
+                    st.report = now + st.settings.report_interval;
+                    st.on_progress(std::as_const(st.progress));
+                }
+
+                auto pause =
+                    st.next < st.connections.size()
+                        ? clock_type::duration(st.settings.batch_interval)
+                        : clock_type::duration(poll_interval);
+                st.waited = true;
+                st.timer.expires_at(std::min(st.deadline, now + pause));
+                st.timer.async_wait(std::move(self));
+            }
+
+            /// Close what is left hard, and complete
+            template < class Self >
+            void
+            finish(Self &self)
+            {
+                auto &st = *s;
+                for (auto i = st.progress.closed; i < st.connections.size();
+                     ++i)
+                    if (auto c = st.connections[i].lock())
+                    {
+                        c->abort();
+                        ++st.progress.aborted;
+                    }
+                    else
+                        gone(i);
+                auto p = st.progress;
+                s.reset();
+                self.complete(p);
+            }
+
+            /// Count connection i as closed, moving it to the end of the
+            /// closed run. i is at or after that run.
+            void
+            gone(std::size_t i) noexcept
+            {
+                auto &st = *s;
+                std::swap(st.connections[st.progress.closed],
+                          st.connections[i]);
+                ++st.progress.closed;
+            }
+        };
+    }   // namespace detail
+
+    /// Close connections gracefully, a batch at a time, and hard once a
+    /// deadline passes.
+    ///
+    /// Every settings.batch_interval, the next settings.batch_size
+    /// connections have stop() called, which should start a graceful close.
+    /// A connection is closed when its last shared_ptr is released. Those
+    /// still open at the deadline have abort() called, which should close
+    /// them at once, and the drain completes. on_progress(drain_progress
+    /// const&) is called every settings.report_interval until then.
+    ///
+    /// stop() and abort() are called on exec. Connections on other executors
+    /// must dispatch to their own.
+    ///
+    /// Signature: void(drain_progress)
+    template < class Connection,
+               class OnProgress,
+               class CompletionToken = net::default_completion_token_t<
+                   net::any_io_executor > >
+    auto
+    async_drain(net::any_io_executor                       exec,
+                std::vector< std::weak_ptr< Connection > > connections,
+                drain_settings const &                     settings,
+                std::chrono::steady_clock::time_point      deadline,
+                OnProgress                                 on_progress,
+                CompletionToken &&token = net::default_completion_token_t<
+                    net::any_io_executor >())
+    {
+        using op = detail::drain_op< Connection, OnProgress >;
+        auto total = connections.size();
+        auto s     = std::unique_ptr< typename op::state >(
+            new typename op::state { net::steady_timer(exec),
+                                     std::move(connections),
+                                     settings,
+                                     deadline,
+                                     std::move(on_progress),
+                                     drain_progress { total },
+                                     std::chrono::steady_clock::now() });
+        auto &timer = s->timer;
+        return net::async_compose< CompletionToken, void(drain_progress) >(
+            op { std::move(s) }, token, timer);
+    }
+
+}   // namespace beast_fun_times::util
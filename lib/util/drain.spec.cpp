@@ -0,0 +1,167 @@
+#include <catch2/catch.hpp>
+
+#include "util/drain.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <vector>
+
+using namespace beast_fun_times::util;
+using namespace std::literals;
+
+namespace
+{
+    /// A connection which closes on the next turn of the context when asked
+    /// to, unless it is stubborn, in which case only abort closes it
+    struct fake_connection
+    {
+        fake_connection(net::io_context &                                  ioc,
+                        std::vector< std::shared_ptr< fake_connection > > &owner,
+                        std::size_t                                        index,
+                        bool stubborn)
+        : ioc(ioc)
+        , owner(owner)
+        , index(index)
+        , stubborn(stubborn)
+        {
+        }
+
+        void
+        stop()
+        {
+            ++stops;
+            if (not stubborn)
+                net::post(ioc, [this] { owner[index].reset(); });
+        }
+
+        void
+        abort()
+        {
+            ++aborts;
+            owner[index].reset();
+        }
+
+        net::io_context &                                  ioc;
+        std::vector< std::shared_ptr< fake_connection > > &owner;
+        std::size_t                                        index;
+        bool                                               stubborn;
+
+        static inline int stops  = 0;
+        static inline int aborts = 0;
+    };
+
+    struct fixture
+    {
+        fixture(std::size_t n, std::size_t stubborn)
+        {
+            fake_connection::stops  = 0;
+            fake_connection::aborts = 0;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                owned.push_back(std::make_shared< fake_connection >(
+                    ioc, owned, i, i < stubborn));
+                weak.push_back(owned.back());
+            }
+        }
+
+        net::io_context                                   ioc { 1 };
+        std::vector< std::shared_ptr< fake_connection > > owned;
+        std::vector< std::weak_ptr< fake_connection > >   weak;
+    };
+}   // namespace
+
+TEST_CASE("util::async_drain")
+{
+    auto settings            = drain_settings();
+    settings.batch_size      = 10;
+    settings.batch_interval  = 1ms;
+    settings.report_interval = 0ms;
+
+    SECTION("connections which close are drained a batch at a time")
+    {
+        auto f       = fixture(95, 0);
+        auto reports = std::vector< drain_progress >();
+        auto result  = std::optional< drain_progress >();
+        async_drain(
+            f.ioc.get_executor(),
+            f.weak,
+            settings,
+            std::chrono::steady_clock::now() + 10s,
+            [&](drain_progress const &p) { reports.push_back(p); },
+            [&](drain_progress p) { result = p; });
+        CHECK(not result);
+        CHECK(fake_connection::stops == 10);
+
+        f.ioc.run();
+        REQUIRE(result);
+        CHECK(result->total == 95);
+        CHECK(result->stopping == 95);
+        CHECK(result->closed == 95);
+        CHECK(result->aborted == 0);
+        CHECK(fake_connection::aborts == 0);
+
+        // a report for each batch, at least, each adding a batch at most
+        REQUIRE(reports.size() >= 10);
+        for (std::size_t i = 1; i < reports.size(); ++i)
+            CHECK(reports[i].stopping - reports[i - 1].stopping <= 10);
+    }
+
+    SECTION("connections still open at the deadline are aborted")
+    {
+        auto f      = fixture(50, 7);
+        auto result = std::optional< drain_progress >();
+        auto start  = std::chrono::steady_clock::now();
+        async_drain(
+            f.ioc.get_executor(),
+            f.weak,
+            settings,
+            start + 50ms,
+            [](drain_progress const &) {},
+            [&](drain_progress p) { result = p; });
+        f.ioc.run();
+        REQUIRE(result);
+        CHECK(result->closed == 43);
+        CHECK(result->aborted == 7);
+        CHECK(fake_connection::aborts == 7);
+        CHECK(std::chrono::steady_clock::now() - start >= 50ms);
+        for (auto &c : f.owned)
+            CHECK(not c);
+    }
+
+    SECTION("connections gone already are counted as closed")
+    {
+        auto f = fixture(3, 0);
+        f.owned[1].reset();
+        auto result = std::optional< drain_progress >();
+        async_drain(
+            f.ioc.get_executor(),
+            f.weak,
+            settings,
+            std::chrono::steady_clock::now() + 10s,
+            [](drain_progress const &) {},
+            [&](drain_progress p) { result = p; });
+        f.ioc.run();
+        REQUIRE(result);
+        CHECK(result->stopping == 2);
+        CHECK(result->closed == 3);
+    }
+}
+
+TEST_CASE("util::drain_settings::from_env")
+{
+    ::setenv("DRAIN_BATCH_SIZE", "0", 1);
+    ::setenv("DRAIN_TIMEOUT_MS", "-1", 1);
+    auto s = drain_settings::from_env();
+    CHECK(s.batch_size == 1);
+    CHECK(s.timeout == drain_settings().timeout);
+
+    ::setenv("DRAIN_BATCH_SIZE", "64", 1);
+    ::setenv("DRAIN_TIMEOUT_MS", "250", 1);
+    s = drain_settings::from_env();
+    ::unsetenv("DRAIN_BATCH_SIZE");
+    ::unsetenv("DRAIN_TIMEOUT_MS");
+    CHECK(s.batch_size == 64);
+    CHECK(s.timeout == 250ms);
+}
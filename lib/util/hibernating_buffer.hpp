@@ -0,0 +1,249 @@
+#pragma once
+#include "util/buffer_pool.hpp"
+#include "util/detail/env_number.hpp"
+#include "util/net.hpp"
+
+#include <boost/asio/compose.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <utility>
+
+namespace beast_fun_times::util
+{
+    namespace detail
+    {
+        template < class Stream >
+        struct read_message_op;
+    }
+
+    /// A receive buffer which holds no storage while it is idle.
+    ///
+    /// It is a DynamicBuffer over a pooled_flat_buffer. Storage is borrowed
+    /// from the buffer_pool when something is first read into it, a whole
+    /// block at a time, and hibernate() returns it once the buffer is empty
+    /// again. An idle connection then costs the size of this object, however
+    /// big the messages it has received. A connection which is busy borrows
+    /// and returns a block per message, which costs no allocation.
+    ///
+    /// A websocket read prepares storage before anything has arrived, so
+    /// read messages with async_read_message, which waits for the first
+    /// byte of a message without any.
+    ///
+    /// Not thread-safe.
+    class hibernating_buffer
+    {
+      public:
+        using const_buffers_type   = pooled_flat_buffer::const_buffers_type;
+        using mutable_buffers_type = pooled_flat_buffer::mutable_buffers_type;
+
+        hibernating_buffer() = default;
+
+        hibernating_buffer(hibernating_buffer &&other) noexcept
+        : buffer_(std::move(other.buffer_))
+        , reading_(std::exchange(other.reading_, false))
+        {
+        }
+
+        hibernating_buffer &
+        operator=(hibernating_buffer &&other) noexcept
+        {
+            buffer_  = std::move(other.buffer_);
+            reading_ = std::exchange(other.reading_, false);
+            return *this;
+        }
+
+        std::size_t
+        size() const noexcept
+        {
+            return buffer_.size();
+        }
+
+        std::size_t
+        max_size() const noexcept
+        {
+            return buffer_.max_size();
+        }
+
+        std::size_t
+        capacity() const noexcept
+        {
+            return buffer_.capacity();
+        }
+
+        const_buffers_type
+        data() const noexcept
+        {
+            return buffer_.data();
+        }
+
+        const_buffers_type
+        cdata() const noexcept
+        {
+            return buffer_.cdata();
+        }
+
+        /// Storage for n more bytes, waking the buffer if it is hibernating.
+        /// The buffer grows a whole pool block at a time.
+        mutable_buffers_type
+        prepare(std::size_t n)
+        {
+            auto size = buffer_.size();
+            if (buffer_.capacity() - size < n)
+                buffer_.reserve(
+                    buffer_pool::block_size(std::max(size + n, 2 * size)));
+            reading_ = true;
+            return buffer_.prepare(n);
+        }
+
+        void
+        commit(std::size_t n) noexcept
+        {
+            reading_ = false;
+            buffer_.commit(n);
+        }
+
+        void
+        consume(std::size_t n) noexcept
+        {
+            buffer_.consume(n);
+        }
+
+        /// Return the storage to the pool, if the buffer is empty and
+        /// nothing is being read into it. A read may be pending, so long as
+        /// it has not prepared storage. Returns true if storage was given
+        /// back.
+        bool
+        hibernate() noexcept
+        {
+            if (reading_ or buffer_.size() or buffer_.capacity() == 0)
+                return false;
+            buffer_ = pooled_flat_buffer();
+            return true;
+        }
+
+        bool
+        hibernating() const noexcept
+        {
+            return buffer_.capacity() == 0;
+        }
+
+        /// Take the storage and what it holds, leaving this buffer
+        /// hibernating
+        pooled_flat_buffer
+        release() noexcept
+        {
+            reading_ = false;
+            return std::exchange(buffer_, pooled_flat_buffer());
+        }
+
+      private:
+        template < class Stream >
+        friend struct detail::read_message_op;
+
+        pooled_flat_buffer buffer_;
+
+        // storage has been prepared and not yet committed
+        bool reading_ = false;
+
+        // where the first byte of a message is read while there is no
+        // storage
+        char first_ = 0;
+    };
+
+    namespace detail
+    {
+        template < class Stream >
+        struct read_message_op
+        {
+            Stream &            ws;
+            hibernating_buffer &buffer;
+            std::size_t         first = 0;
+            enum
+            {
+                starting,
+                dozing,
+                reading
+            } state = starting;
+
+            template < class Self >
+            void
+            operator()(Self &self, error_code ec = {}, std::size_t n = 0)
+            {
+                switch (state)
+                {
+                case starting:
+                    state = dozing;
+                    ws.async_read_some(net::buffer(&buffer.first_, 1),
+                                       std::move(self));
+                    return;
+
+                case dozing:
+                    if (n)
+                    {
+                        auto b = buffer.prepare(1);
+                        *static_cast< char * >(b.data()) = buffer.first_;
+                        buffer.commit(1);
+                    }
+                    if (ec or ws.is_message_done())
+                    {
+                        self.complete(ec, n);
+                        return;
+                    }
+                    first = n;
+                    state = reading;
+                    ws.async_read(buffer, std::move(self));
+                    return;
+
+                case reading:
+                    self.complete(ec, first + n);
+                    return;
+                }
+            }
+        };
+    }   // namespace detail
+
+    /// Read a complete websocket message into a hibernating_buffer.
+    ///
+    /// Until the message starts to arrive, the read holds no storage: it
+    /// waits for the first byte in the buffer itself, so that a connection
+    /// waiting on a quiet peer can hibernate its buffer. The rest is read
+    /// with ws.async_read. This costs one more operation per message than
+    /// reading with ws.async_read alone.
+    /// Signature: void(error_code, std::size_t)
+    template < class Stream, class CompletionToken >
+    auto
+    async_read_message(Stream &            ws,
+                       hibernating_buffer &buffer,
+                       CompletionToken &&  token)
+    {
+        return net::async_compose< CompletionToken,
+                                   void(error_code, std::size_t) >(
+            detail::read_message_op< Stream > { ws, buffer }, token, ws);
+    }
+
+    /// How long a connection must be quiet before it gives back its buffers
+    struct hibernation_settings
+    {
+        /// Zero turns hibernation off
+        std::chrono::milliseconds quiet_period { 10000 };
+
+        bool
+        enabled() const noexcept
+        {
+            return quiet_period.count() > 0;
+        }
+
+        /// The settings named by the environment, on top of the defaults.
+        /// HIBERNATE_AFTER_MS is read.
+        static hibernation_settings
+        from_env()
+        {
+            auto s         = hibernation_settings();
+            s.quiet_period = std::chrono::milliseconds(detail::env_number(
+                "HIBERNATE_AFTER_MS", s.quiet_period.count()));
+            return s;
+        }
+    };
+
+}   // namespace beast_fun_times::util
@@ -0,0 +1,168 @@
+#include <catch2/catch.hpp>
+
+#include "util/hibernating_buffer.hpp"
+#include "util/shared_message.hpp"
+
+#include <algorithm>
+#include <boost/beast/core/buffers_to_string.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace beast_fun_times::util;
+using namespace std::literals;
+
+namespace
+{
+    /// Stands in for a websocket stream with one message to deliver. It
+    /// remembers whether the buffer held storage while the read was waiting
+    /// for the message to start.
+    struct fake_websocket
+    {
+        using executor_type = net::io_context::executor_type;
+
+        fake_websocket(net::io_context &         ioc,
+                       std::string               message,
+                       hibernating_buffer const &buffer)
+        : ioc(ioc)
+        , message(std::move(message))
+        , buffer(buffer)
+        {
+        }
+
+        executor_type
+        get_executor()
+        {
+            return ioc.get_executor();
+        }
+
+        bool
+        is_message_done() const
+        {
+            return pos == message.size();
+        }
+
+        template < class Handler >
+        void
+        async_read_some(net::mutable_buffer b, Handler &&handler)
+        {
+            idle_storage = buffer.capacity();
+            auto n       = std::min(b.size(), message.size() - pos);
+            std::memcpy(b.data(), message.data() + pos, n);
+            pos += n;
+            complete(std::forward< Handler >(handler), n);
+        }
+
+        template < class DynamicBuffer, class Handler >
+        void
+        async_read(DynamicBuffer &b, Handler &&handler)
+        {
+            auto n = message.size() - pos;
+            std::memcpy(b.prepare(n).data(), message.data() + pos, n);
+            b.commit(n);
+            pos += n;
+            complete(std::forward< Handler >(handler), n);
+        }
+
+        template < class Handler >
+        void
+        complete(Handler &&handler, std::size_t n)
+        {
+            net::post(ioc,
+                      [handler = std::forward< Handler >(handler), n]() mutable {
+                          handler(error_code(), n);
+                      });
+        }
+
+        net::io_context &         ioc;
+        std::string               message;
+        hibernating_buffer const &buffer;
+        std::size_t               pos          = 0;
+        std::size_t               idle_storage = ~std::size_t(0);
+    };
+
+    std::string
+    read_message(std::string const &message, hibernating_buffer &buffer)
+    {
+        auto ioc    = net::io_context();
+        auto ws     = fake_websocket(ioc, message, buffer);
+        auto result = std::size_t(0);
+        async_read_message(ws, buffer, [&](error_code ec, std::size_t n) {
+            CHECK(not ec);
+            result = n;
+        });
+        ioc.run();
+        CHECK(ws.idle_storage == 0);
+        CHECK(result == message.size());
+        return boost::beast::buffers_to_string(buffer.data());
+    }
+}   // namespace
+
+TEST_CASE("util::hibernating_buffer")
+{
+    auto buffer = hibernating_buffer();
+    CHECK(buffer.hibernating());
+
+    SECTION("storage is taken when something is read, and given back after")
+    {
+        auto b = buffer.prepare(100);
+        CHECK(not buffer.hibernating());
+
+        // not while a read may be writing to it
+        CHECK(not buffer.hibernate());
+        std::memcpy(b.data(), "hello", 5);
+        buffer.commit(5);
+
+        // nor while it holds something
+        CHECK(not buffer.hibernate());
+        CHECK(boost::beast::buffers_to_string(buffer.data()) == "hello");
+
+        buffer.consume(5);
+        CHECK(buffer.hibernate());
+        CHECK(buffer.hibernating());
+        CHECK(not buffer.hibernate());
+    }
+
+    SECTION("a message taken from it leaves it hibernating")
+    {
+        auto b = buffer.prepare(5);
+        std::memcpy(b.data(), "hello", 5);
+        buffer.commit(5);
+        auto message = shared_message::take(buffer);
+        CHECK(message.view() == "hello");
+        CHECK(buffer.hibernating());
+        CHECK(buffer.size() == 0);
+    }
+
+    SECTION("a message is read without storage until it starts")
+    {
+        CHECK(read_message("hello", buffer) == "hello");
+        buffer.consume(buffer.size());
+        CHECK(buffer.hibernate());
+        CHECK(read_message("x", buffer) == "x");
+        buffer.consume(buffer.size());
+        CHECK(buffer.hibernate());
+        CHECK(read_message("", buffer) == "");
+        CHECK(buffer.hibernating());
+    }
+}
+
+TEST_CASE("util::hibernation_settings")
+{
+    CHECK(hibernation_settings().quiet_period == 10s);
+
+    ::setenv("HIBERNATE_AFTER_MS", "250", 1);
+    CHECK(hibernation_settings::from_env().quiet_period == 250ms);
+    CHECK(hibernation_settings::from_env().enabled());
+
+    ::setenv("HIBERNATE_AFTER_MS", "0", 1);
+    CHECK(not hibernation_settings::from_env().enabled());
+
+    ::setenv("HIBERNATE_AFTER_MS", "soon", 1);
+    CHECK(hibernation_settings::from_env().quiet_period == 10s);
+
+    ::setenv("HIBERNATE_AFTER_MS", "-5", 1);
+    CHECK(hibernation_settings::from_env().quiet_period == 10s);
+
+    ::unsetenv("HIBERNATE_AFTER_MS");
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <deque>
+
+namespace beast_fun_times::util
+{
+    /// A FIFO queue with priority lanes, for single-threaded state machines.
+    ///
+    /// front() is the oldest element of the most urgent lane which has any.
+    /// Elements keep their push order within a lane. Lane 0 is the most
+    /// urgent.
+    ///
+    /// front() changes when a more urgent element is pushed. A state machine
+    /// which writes front() asynchronously should therefore move it out and
+    /// pop() it before starting the write. The write in progress is then never
+    /// overtaken part way through, and urgent elements go next.
+    template < class T, std::size_t Lanes = 2 >
+    struct lane_queue
+    {
+        static_assert(Lanes > 0, "a queue needs at least one lane");
+
+        using value_type = T;
+
+        static constexpr std::size_t lanes       = Lanes;
+        static constexpr std::size_t urgent_lane = 0;
+        static constexpr std::size_t bulk_lane   = Lanes - 1;
+
+        bool
+        empty() const noexcept
+        {
+            return size_ == 0;
+        }
+
+        std::size_t
+        size() const noexcept
+        {
+            return size_;
+        }
+
+        /// The number of elements in one lane
+        std::size_t
+        size(std::size_t lane) const noexcept
+        {
+            assert(lane < Lanes);
+            return lanes_[lane].size();
+        }
+
+        void
+        push(T value, std::size_t lane = bulk_lane)
+        {
+            assert(lane < Lanes);
+            lanes_[lane].push_back(std::move(value));
+            ++size_;
+        }
+
+        T &
+        front() noexcept
+        {
+            return next().front();
+        }
+
+        void
+        pop() noexcept
+        {
+            next().pop_front();
+            --size_;
+        }
+
+        void
+        clear() noexcept
+        {
+            for (auto &lane : lanes_)
+                lane.clear();
+            size_ = 0;
+        }
+
+      private:
+        std::deque< T > &
+        next() noexcept
+        {
+            assert(not empty());
+            for (auto &lane : lanes_)
+                if (not lane.empty())
+                    return lane;
+            return lanes_[bulk_lane];
+        }
+
+        std::array< std::deque< T >, Lanes > lanes_;
+        std::size_t                          size_ = 0;
+    };
+
+}   // namespace beast_fun_times::util
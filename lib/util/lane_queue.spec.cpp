@@ -0,0 +1,44 @@
+#include <catch2/catch.hpp>
+
+#include "util/lane_queue.hpp"
+
+#include <string>
+
+using namespace beast_fun_times::util;
+
+TEST_CASE("util::lane_queue")
+{
+    auto q = lane_queue<std::string>();
+    CHECK(q.empty());
+
+    q.push("bulk 1");
+    q.push("bulk 2");
+    q.push("urgent 1", q.urgent_lane);
+    q.push("bulk 3", q.bulk_lane);
+    q.push("urgent 2", q.urgent_lane);
+    CHECK(q.size() == 5);
+    CHECK(q.size(q.urgent_lane) == 2);
+
+    // urgent elements overtake, each lane keeps its order
+    auto order = std::vector<std::string>();
+    while (not q.empty())
+    {
+        order.push_back(std::move(q.front()));
+        q.pop();
+    }
+    CHECK(order == std::vector<std::string>{
+        "urgent 1", "urgent 2", "bulk 1", "bulk 2", "bulk 3"});
+
+    // an element taken for writing is not overtaken; the urgent one goes next
+    q.push("bulk 4");
+    auto in_flight = std::move(q.front());
+    q.pop();
+    q.push("urgent 3", q.urgent_lane);
+    q.push("bulk 5");
+    CHECK(in_flight == "bulk 4");
+    CHECK(q.front() == "urgent 3");
+
+    q.clear();
+    CHECK(q.empty());
+    CHECK(q.size(q.bulk_lane) == 0);
+}
@@ -0,0 +1,58 @@
+#include "util/log.hpp"
+#include "util/testing/benchmark.hpp"
+
+#include <cstdio>
+#include <string>
+
+using namespace beast_fun_times::util;
+
+namespace
+{
+    /// Points the log sink at /dev/null for the life of the object
+    struct null_output
+    {
+        null_output()
+        : file(std::fopen("/dev/null", "w"))
+        {
+            log_sink::instance().set_output(file);
+            log_sink::instance().set_level(log_level::info);
+        }
+
+        ~null_output()
+        {
+            log_sink::instance().flush();
+            log_sink::instance().set_output(stdout);
+            std::fclose(file);
+        }
+
+        std::FILE *file;
+    };
+
+    std::string const message = "a typical chat message of modest length";
+}   // namespace
+
+// The cost to the logging thread. Lines which the drain thread cannot keep up
+// with are dropped, not waited for.
+UTIL_BENCHMARK("log", "info, enabled")
+{
+    auto out = null_output();
+    for (std::size_t i = 0; i < iterations; ++i)
+        UTIL_LOG_INFO("received: ", message, " (", i, ")");
+}
+
+UTIL_BENCHMARK("log", "trace, filtered")
+{
+    auto out = null_output();
+    for (std::size_t i = 0; i < iterations; ++i)
+        UTIL_LOG_TRACE("received: ", message, " (", i, ")");
+}
+
+UTIL_BENCHMARK("log", "fprintf, synchronous")
+{
+    auto out = null_output();
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        std::fprintf(out.file, "received: %s (%zu)\n", message.c_str(), i);
+        std::fflush(out.file);
+    }
+}
@@ -0,0 +1,384 @@
+#pragma once
+#include "util/detail/log_ring.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/// Log statements below this level are compiled out entirely, arguments and
+/// all. 0 keeps everything; 1 strips trace logging; 2 strips debug too.
+#ifndef UTIL_LOG_ACTIVE_LEVEL
+#define UTIL_LOG_ACTIVE_LEVEL 0
+#endif
+
+namespace beast_fun_times::util
+{
+    enum class log_level : std::uint8_t
+    {
+        trace,
+        debug,
+        info,
+        warn,
+        error,
+        off
+    };
+
+    inline std::string_view
+    to_string(log_level l) noexcept
+    {
+        constexpr std::string_view names[] = { "trace", "debug", "info",
+                                                "warn",  "error", "off" };
+        return names[std::size_t(l)];
+    }
+
+    /// The level named s ("trace", "info", ...), if there is one
+    inline std::optional< log_level >
+    parse_log_level(std::string_view s) noexcept
+    {
+        for (auto l = log_level::trace; l <= log_level::off;
+             l      = log_level(std::uint8_t(l) + 1))
+            if (to_string(l) == s)
+                return l;
+        return std::nullopt;
+    }
+
+    /// True if lines of level l are compiled in
+    constexpr bool
+    log_compiled(log_level l) noexcept
+    {
+        return int(l) + 1 > UTIL_LOG_ACTIVE_LEVEL;
+    }
+
+    /// The process's log sink.
+    ///
+    /// Logging formats the line into a ring buffer owned by the calling
+    /// thread, without locking, allocating or making a system call. A
+    /// background thread drains every thread's ring to the output. If a
+    /// thread logs faster than the output can take it, its ring fills and
+    /// further lines are dropped and counted, rather than holding the thread
+    /// up.
+    ///
+    /// Lines below the sink's level cost one relaxed atomic load. Lines below
+    /// UTIL_LOG_ACTIVE_LEVEL cost nothing. Use the UTIL_LOG_* macros.
+    class log_sink
+    {
+      public:
+        static log_sink &
+        instance()
+        {
+            static log_sink sink;
+            return sink;
+        }
+
+        log_sink(log_sink const &) = delete;
+
+        log_sink &
+        operator=(log_sink const &) = delete;
+
+        ~log_sink()
+        {
+            {
+                auto lock = std::lock_guard(wake_mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_one();
+            drainer_.join();
+            flush();
+        }
+
+        bool
+        enabled(log_level l) const noexcept
+        {
+            return l >= level_.load(std::memory_order_relaxed);
+        }
+
+        log_level
+        level() const noexcept
+        {
+            return level_.load(std::memory_order_relaxed);
+        }
+
+        void
+        set_level(log_level l) noexcept
+        {
+            level_.store(l, std::memory_order_relaxed);
+        }
+
+        /// Set the level from the environment variable name, if it is set to
+        /// the name of a level
+        void
+        set_level_from_env(char const *name = "LOG_LEVEL") noexcept
+        {
+            if (auto value = std::getenv(name))
+                if (auto l = parse_log_level(value))
+                    set_level(*l);
+        }
+
+        /// Where lines are written. stdout by default.
+        void
+        set_output(std::FILE *f)
+        {
+            auto lock = std::lock_guard(drain_mutex_);
+            output_   = f;
+        }
+
+        /// Log one line, made of the concatenation of parts
+        template < class... Parts >
+        void
+        write(log_level l, Parts const &...parts)
+        {
+            auto &ring = this_thread_ring();
+            auto  rec  = ring.prepare();
+            if (not rec)
+                return;
+            rec->when      = std::chrono::system_clock::now();
+            rec->level     = std::uint8_t(l);
+            rec->truncated = false;
+            auto w         = detail::log_writer(*rec);
+            (w.append(parts), ...);
+            w.finish();
+            if (ring.commit())
+                wake();
+        }
+
+        /// Write out every line logged so far
+        void
+        flush()
+        {
+            auto lock = std::lock_guard(drain_mutex_);
+            drain();
+        }
+
+      private:
+        log_sink()
+        : drainer_([this] { run(); })
+        {
+        }
+
+        /// Wake the drainer if it is asleep. May be called on any thread.
+        void
+        wake() noexcept
+        {
+            // pairs with the fence in run(): either we see that the drainer
+            // is asleep, or it sees what we published
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (not sleeping_.load(std::memory_order_relaxed))
+                return;
+            auto lock = std::lock_guard(wake_mutex_);
+            woken_    = true;
+            wake_.notify_one();
+        }
+
+        /// The calling thread's ring, registered with the sink on first use
+        detail::log_ring &
+        this_thread_ring()
+        {
+            struct owner
+            {
+                ~owner()
+                {
+                    if (ring)
+                    {
+                        ring->abandoned.store(true, std::memory_order_release);
+                        sink->wake();
+                    }
+                }
+
+                std::shared_ptr< detail::log_ring > ring;
+                log_sink *                          sink = nullptr;
+            };
+
+            thread_local owner mine;
+            if (not mine.ring)
+            {
+                mine.ring = std::make_shared< detail::log_ring >();
+                mine.sink = this;
+                auto lock = std::lock_guard(rings_mutex_);
+                rings_.push_back(mine.ring);
+                generation_.fetch_add(1, std::memory_order_release);
+            }
+            return *mine.ring;
+        }
+
+        /// The drainer. It sleeps until a thread publishes a line into an
+        /// empty ring, or exits.
+        void
+        run()
+        {
+            for (;;)
+            {
+                auto drained = [this] {
+                    auto lock = std::lock_guard(drain_mutex_);
+                    return drain();
+                }();
+
+                auto lock = std::unique_lock(wake_mutex_);
+                if (stopping_)
+                    return;
+                if (drained)
+                    continue;
+
+                sleeping_.store(true, std::memory_order_relaxed);
+                // pairs with the fence in wake()
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (idle())
+                    wake_.wait(lock, [this] { return stopping_ or woken_; });
+                sleeping_.store(false, std::memory_order_relaxed);
+                woken_ = false;
+            }
+        }
+
+        /// True if no ring has anything to drain, or to forget
+        bool
+        idle()
+        {
+            auto lock = std::lock_guard(drain_mutex_);
+            refresh();
+            for (auto &ring : draining_)
+                if (not ring->empty() or
+                    ring->abandoned.load(std::memory_order_acquire))
+                    return false;
+            return true;
+        }
+
+        /// Bring the drainer's list of rings up to date, if a thread has
+        /// registered one since it was last taken. drain_mutex_ must be held.
+        void
+        refresh()
+        {
+            auto generation = generation_.load(std::memory_order_acquire);
+            if (generation == seen_generation_)
+                return;
+            auto lock           = std::lock_guard(rings_mutex_);
+            draining_           = rings_;
+            seen_generation_ = generation;
+        }
+
+        /// Write out and release every thread's published records.
+        /// drain_mutex_ must be held.
+        std::size_t
+        drain()
+        {
+            refresh();
+
+            std::size_t total = 0;
+            auto        gone  = false;
+            for (auto &ring : draining_)
+            {
+                // read abandoned first, so that nothing logged before the
+                // thread exited is missed
+                auto abandoned =
+                    ring->abandoned.load(std::memory_order_acquire);
+                total += ring->consume(
+                    [this](detail::log_record const &r) { print(r); });
+                if (auto n = ring->take_dropped())
+                    std::fprintf(output_,
+                                 "[warn] %llu log lines dropped\n",
+                                 static_cast< unsigned long long >(n));
+                if (abandoned)
+                {
+                    forget(ring);
+                    ring.reset();
+                    gone = true;
+                }
+            }
+            if (gone)
+                draining_.erase(
+                    std::remove(draining_.begin(), draining_.end(), nullptr),
+                    draining_.end());
+            if (total)
+                std::fflush(output_);
+            return total;
+        }
+
+        void
+        print(detail::log_record const &r)
+        {
+            auto t  = std::chrono::system_clock::to_time_t(r.when);
+            auto us = std::chrono::duration_cast< std::chrono::microseconds >(
+                          r.when.time_since_epoch())
+                          .count() %
+                      1000000;
+            std::tm tm;
+            gmtime_r(&t, &tm);
+            char stamp[32];
+            std::strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+            auto level = to_string(log_level(r.level));
+            std::fprintf(output_,
+                         "%s.%06d [%.*s] %.*s%s\n",
+                         stamp,
+                         int(us),
+                         int(level.size()),
+                         level.data(),
+                         int(r.length),
+                         r.text.data(),
+                         r.truncated ? "..." : "");
+        }
+
+        void
+        forget(std::shared_ptr< detail::log_ring > const &ring)
+        {
+            auto lock = std::lock_guard(rings_mutex_);
+            rings_.erase(std::find(rings_.begin(), rings_.end(), ring));
+        }
+
+      private:
+        std::atomic< log_level > level_ { log_level::info };
+
+        // Every registered ring. Bumping generation_ tells the drainer to
+        // take a fresh copy.
+        std::mutex                                         rings_mutex_;
+        std::vector< std::shared_ptr< detail::log_ring > > rings_;
+        std::atomic< std::uint64_t >                       generation_ { 0 };
+
+        // The drainer's copy of rings_, and what it writes to
+        std::mutex                                         drain_mutex_;
+        std::vector< std::shared_ptr< detail::log_ring > > draining_;
+        std::uint64_t                                      seen_generation_ = 0;
+        std::FILE *                                        output_ = stdout;
+
+        std::mutex              wake_mutex_;
+        std::condition_variable wake_;
+        std::atomic< bool >     sleeping_ { false };
+        bool                    woken_    = false;
+        bool                    stopping_ = false;
+        std::thread             drainer_;
+    };
+
+}   // namespace beast_fun_times::util
+
+/// Log a line at the given level, if it is enabled. The arguments are only
+/// evaluated if it is.
+#define UTIL_LOG(level, ...)                                                   \
+    do                                                                         \
+    {                                                                          \
+        if constexpr (::beast_fun_times::util::log_compiled(level))            \
+        {                                                                      \
+            auto &util_log_sink_ =                                             \
+                ::beast_fun_times::util::log_sink::instance();                 \
+            if (util_log_sink_.enabled(level))                                 \
+                util_log_sink_.write(level, __VA_ARGS__);                      \
+        }                                                                      \
+    } while (false)
+
+#define UTIL_LOG_TRACE(...)                                                    \
+    UTIL_LOG(::beast_fun_times::util::log_level::trace, __VA_ARGS__)
+#define UTIL_LOG_DEBUG(...)                                                    \
+    UTIL_LOG(::beast_fun_times::util::log_level::debug, __VA_ARGS__)
+#define UTIL_LOG_INFO(...)                                                     \
+    UTIL_LOG(::beast_fun_times::util::log_level::info, __VA_ARGS__)
+#define UTIL_LOG_WARN(...)                                                     \
+    UTIL_LOG(::beast_fun_times::util::log_level::warn, __VA_ARGS__)
+#define UTIL_LOG_ERROR(...)                                                    \
+    UTIL_LOG(::beast_fun_times::util::log_level::error, __VA_ARGS__)
@@ -0,0 +1,131 @@
+#include <catch2/catch.hpp>
+
+#include "util/log.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace beast_fun_times::util;
+
+namespace
+{
+    /// Redirects the log sink to a temporary file for the life of the object
+    struct captured_log
+    {
+        captured_log()
+        : file(std::tmpfile())
+        , saved(log_sink::instance().level())
+        {
+            log_sink::instance().flush();
+            log_sink::instance().set_output(file);
+        }
+
+        ~captured_log()
+        {
+            log_sink::instance().flush();
+            log_sink::instance().set_output(stdout);
+            log_sink::instance().set_level(saved);
+            std::fclose(file);
+        }
+
+        /// The text of every line written so far, without timestamps
+        std::vector< std::string >
+        lines()
+        {
+            log_sink::instance().flush();
+            std::rewind(file);
+            auto result = std::vector< std::string >();
+            char buf[1024];
+            while (std::fgets(buf, sizeof(buf), file))
+            {
+                auto line = std::string(buf);
+                line.pop_back();
+                result.push_back(line.substr(line.find(' ') + 1));
+            }
+            return result;
+        }
+
+        std::FILE *file;
+        log_level  saved;
+    };
+}   // namespace
+
+TEST_CASE("util::log_sink")
+{
+    auto log = captured_log();
+    log_sink::instance().set_level(log_level::debug);
+
+    auto evaluated = 0;
+    auto count     = [&] { return ++evaluated; };
+    UTIL_LOG_TRACE("not written ", count());
+    UTIL_LOG_DEBUG("answer: ", 42, ' ', 1.5, ' ', true, ' ', std::string("s"));
+    UTIL_LOG_ERROR("count ", count());
+    CHECK(evaluated == 1);
+
+    // long lines are truncated
+    UTIL_LOG_INFO(std::string(1000, 'x'));
+
+    auto lines = log.lines();
+    REQUIRE(lines.size() == 3);
+    CHECK(lines[0] == "[debug] answer: 42 1.5 true s");
+    CHECK(lines[1] == "[error] count 1");
+    CHECK(lines[2].size() < 300);
+    CHECK(lines[2].substr(lines[2].size() - 3) == "...");
+
+    CHECK(parse_log_level("warn") == log_level::warn);
+    CHECK_FALSE(parse_log_level("loud"));
+}
+
+TEST_CASE("util::log_sink collects every thread's lines")
+{
+    auto log = captured_log();
+    log_sink::instance().set_level(log_level::info);
+
+    // fewer lines per thread than a ring holds, so that none are dropped
+    constexpr int per_thread = 100;
+    auto threads = std::vector< std::thread >();
+    for (int t = 0; t < 4; ++t)
+        threads.emplace_back([t] {
+            for (int i = 0; i < per_thread; ++i)
+                UTIL_LOG_INFO("thread ", t, " line ", i);
+        });
+    for (auto &t : threads)
+        t.join();
+
+    auto lines = log.lines();
+    CHECK(lines.size() == 4 * per_thread);
+
+    // each thread's lines are in order
+    for (int t = 0; t < 4; ++t)
+    {
+        auto prefix = "[info] thread " + std::to_string(t) + " line ";
+        int  next   = 0;
+        for (auto &l : lines)
+            if (l.rfind(prefix, 0) == 0)
+                CHECK(l == prefix + std::to_string(next++));
+        CHECK(next == per_thread);
+    }
+}
+
+TEST_CASE("util::log_sink wakes its drainer")
+{
+    auto log = captured_log();
+    log_sink::instance().set_level(log_level::info);
+
+    // let the drainer find nothing to do and go to sleep
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // a line published into an empty ring is written without a flush
+    UTIL_LOG_INFO("wake up");
+    auto written = [&] {
+        std::fflush(log.file);
+        return std::ftell(log.file) > 0;
+    };
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (not written() and std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    CHECK(written());
+}
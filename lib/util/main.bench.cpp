@@ -0,0 +1,38 @@
+// Runs the benchmarks in lib/util and prints a table of results.
+//
+// usage: bench_beast_fun_times_util [filter]
+// Only benchmarks whose "group/name" contains filter are run. Build with
+// optimisation: numbers from a debug build mean nothing.
+#include "util/testing/allocation_counter_src.hpp"
+#include "util/testing/benchmark.hpp"
+
+#include <cstdio>
+#include <string>
+
+int
+main(int argc, char **argv)
+{
+    using namespace beast_fun_times::util::testing;
+
+    auto filter = std::string(argc > 1 ? argv[1] : "");
+
+    std::printf(
+        "%-16s %-44s %12s %12s %12s %12s\n", "group", "benchmark", "ns/op",
+        "allocs/op", "bytes/op", "iterations");
+    for (auto &c : benchmark_registry())
+    {
+        if (not filter.empty() and
+            (c.group + "/" + c.name).find(filter) == std::string::npos)
+            continue;
+
+        auto r = run_benchmark(c.body);
+        std::printf("%-16s %-44s %12.1f %12.3f %12.1f %12zu\n",
+                    c.group.c_str(),
+                    c.name.c_str(),
+                    r.ns_per_op(),
+                    r.allocations_per_op(),
+                    r.bytes_per_op(),
+                    r.iterations);
+        std::fflush(stdout);
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include "util/net.hpp"
+#include "util/shared_message.hpp"
+
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+namespace beast_fun_times::util
+{
+    /// Builds a message from parts, straight into a buffer borrowed from the
+    /// buffer_pool, without iostreams or intermediate strings.
+    ///
+    /// Parts may be strings, chars, numbers or IP addresses.
+    class message_builder
+    {
+      public:
+        /// Room is made for this much up front, so that a short message is
+        /// not reallocated as it grows
+        static constexpr std::size_t initial_capacity = 128;
+
+        message_builder()
+        : buffer_(shared_message::recycled_buffer())
+        {
+            buffer_.reserve(buffer_pool::block_size(initial_capacity));
+        }
+
+        template < class Part >
+        message_builder &
+        append(Part const &part)
+        {
+            if constexpr (std::is_convertible_v< Part const &, std::string_view >)
+                append_chars(std::string_view(part));
+            else if constexpr (std::is_same_v< Part, char >)
+                append_chars(std::string_view(&part, 1));
+            else if constexpr (std::is_same_v< Part, bool >)
+                append_chars(part ? "true" : "false");
+            else if constexpr (std::is_arithmetic_v< Part >)
+            {
+                char buf[32];
+                auto r = std::to_chars(buf, buf + sizeof(buf), part);
+                append_chars(std::string_view(buf, std::size_t(r.ptr - buf)));
+            }
+            else if constexpr (std::is_same_v< Part, net::ip::address >)
+            {
+                if (part.is_v4())
+                    append_address(part.to_v4());
+                else
+                    append_chars(part.to_string());
+            }
+            else if constexpr (std::is_same_v< Part, net::ip::address_v4 >)
+                append_address(part);
+            else
+                static_assert(std::is_arithmetic_v< Part >,
+                              "message parts must be strings, chars, numbers "
+                              "or addresses");
+            return *this;
+        }
+
+        /// The message built so far. The builder is left empty.
+        shared_message
+        release()
+        {
+            return shared_message::take(buffer_);
+        }
+
+      private:
+        void
+        append_chars(std::string_view s)
+        {
+            auto b = buffer_.prepare(s.size());
+            std::memcpy(b.data(), s.data(), s.size());
+            buffer_.commit(s.size());
+        }
+
+        void
+        append_address(net::ip::address_v4 const &a)
+        {
+            char buf[16];
+            auto out = buf;
+            for (auto octet : a.to_bytes())
+            {
+                if (out != buf)
+                    *out++ = '.';
+                out = std::to_chars(out, buf + sizeof(buf), octet).ptr;
+            }
+            append_chars(std::string_view(buf, std::size_t(out - buf)));
+        }
+
+        pooled_flat_buffer buffer_;
+    };
+
+    /// A message made of the concatenation of parts. See message_builder.
+    template < class... Parts >
+    shared_message
+    make_message(Parts const &...parts)
+    {
+        auto b = message_builder();
+        (b.append(parts), ...);
+        return b.release();
+    }
+
+}   // namespace beast_fun_times::util
@@ -0,0 +1,30 @@
+#include <catch2/catch.hpp>
+
+#include "util/message_builder.hpp"
+#include "util/testing/allocation_counter.hpp"
+
+#include <string>
+
+using namespace beast_fun_times::util;
+
+TEST_CASE("util::make_message")
+{
+    using testing::allocations;
+
+    auto ep = net::ip::tcp::endpoint(net::ip::make_address("192.168.0.1"), 80);
+    auto m  = make_message("visitor ", 42, " (", std::size_t(7), " connected) ",
+                          ep.address(), ':', ep.port(), ' ', true);
+    CHECK(m.view() == "visitor 42 (7 connected) 192.168.0.1:80 true");
+
+    auto v6 = make_message(net::ip::make_address("::1"));
+    CHECK(v6.view() == "::1");
+
+    CHECK(make_message().empty());
+
+    // once a message has been released, the next is built in its storage
+    m           = shared_message();
+    auto before = allocations();
+    m           = make_message(std::string_view("seconds remaining: "), 30);
+    CHECK(m.view() == "seconds remaining: 30");
+    CHECK(allocations() == before);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "util/server_metrics.hpp"
+
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/version.hpp>
+#include <cstddef>
+#include <string_view>
+
+namespace beast_fun_times::util
+{
+    /// The most body a plain HTTP request to a websocket port may carry.
+    /// metrics_response ignores the body, but a request such as POST /metrics
+    /// must be read past before it can be answered with 405.
+    constexpr std::size_t max_http_request_body = 1024;
+
+    /// The answer to a plain HTTP request made to a websocket port.
+    ///
+    /// GET /metrics is answered with the snapshot, in the Prometheus text
+    /// format. Any other target is not found, and any other method is not
+    /// allowed. The connection is not kept alive: the servers answer one
+    /// request and close.
+    template < class Body, class Fields >
+    boost::beast::http::response< boost::beast::http::string_body >
+    metrics_response(boost::beast::http::request< Body, Fields > const &req,
+                     metrics_snapshot const &snapshot)
+    {
+        namespace http = boost::beast::http;
+
+        auto target =
+            std::string_view(req.target().data(), req.target().size());
+        target = target.substr(0, target.find('?'));
+
+        auto res = http::response< http::string_body >();
+        res.version(req.version());
+        res.keep_alive(false);
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/plain; charset=utf-8");
+        if (target != "/metrics")
+        {
+            res.result(http::status::not_found);
+            res.body() = "not found\n";
+        }
+        else if (req.method() != http::verb::get)
+        {
+            res.result(http::status::method_not_allowed);
+            res.set(http::field::allow, "GET");
+            res.body() = "method not allowed\n";
+        }
+        else
+        {
+            res.result(http::status::ok);
+            res.set(http::field::content_type,
+                    "text/plain; version=0.0.4; charset=utf-8");
+            res.body() = to_prometheus(snapshot);
+        }
+        res.prepare_payload();
+        return res;
+    }
+
+}   // namespace beast_fun_times::util
@@ -0,0 +1,161 @@
+#include "util/poly_handler.hpp"
+#include "util/testing/benchmark.hpp"
+
+#include <array>
+#include <boost/version.hpp>
+#include <functional>
+#include <memory>
+
+#if BOOST_VERSION >= 108100
+#include <boost/asio/any_completion_handler.hpp>
+#endif
+
+using namespace beast_fun_times::util;
+using testing::escape;
+
+namespace
+{
+    /// Fits in the small buffer of every type erasure measured here
+    struct small_handler
+    {
+        void
+        operator()(int x)
+        {
+            *sink += x;
+        }
+
+        int *sink;
+    };
+
+    /// Too big for any small buffer
+    struct large_handler
+    {
+        void
+        operator()(int x)
+        {
+            *sink += x + int(payload[0] != nullptr);
+        }
+
+        int *                    sink;
+        std::array< void *, 16 > payload {};
+    };
+
+    /// The type erasure written by hand before any_completion_handler: a
+    /// virtual call through a heap-allocated wrapper, with no small buffer
+    template < class Sig >
+    class virtual_handler;
+
+    template < class... Args >
+    class virtual_handler< void(Args...) >
+    {
+        struct base
+        {
+            virtual ~base() = default;
+
+            virtual void
+            invoke(Args... args) = 0;
+        };
+
+        template < class Handler >
+        struct wrapper final : base
+        {
+            explicit wrapper(Handler h)
+            : h(std::move(h))
+            {
+            }
+
+            void
+            invoke(Args... args) override
+            {
+                h(std::move(args)...);
+            }
+
+            Handler h;
+        };
+
+      public:
+        template < class Handler >
+        explicit virtual_handler(Handler h)
+        : p_(std::make_unique< wrapper< Handler > >(std::move(h)))
+        {
+        }
+
+        void
+        operator()(Args... args) &&
+        {
+            auto p = std::move(p_);
+            p->invoke(std::move(args)...);
+        }
+
+      private:
+        std::unique_ptr< base > p_;
+    };
+
+    template < class Erased, class Handler >
+    void
+    construct_and_invoke(std::size_t iterations)
+    {
+        int sink = 0;
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            auto h = Erased(Handler { &sink });
+            escape(&h);
+            std::move(h)(1);
+        }
+        escape(&sink);
+    }
+}   // namespace
+
+UTIL_BENCHMARK("poly_handler", "small: construct+invoke")
+{
+    construct_and_invoke< poly_handler< void(int) >, small_handler >(
+        iterations);
+}
+
+UTIL_BENCHMARK("poly_handler", "large: construct+invoke")
+{
+    construct_and_invoke< poly_handler< void(int) >, large_handler >(
+        iterations);
+}
+
+UTIL_BENCHMARK("std::function", "small: construct+invoke")
+{
+    construct_and_invoke< std::function< void(int) >, small_handler >(
+        iterations);
+}
+
+UTIL_BENCHMARK("std::function", "large: construct+invoke")
+{
+    construct_and_invoke< std::function< void(int) >, large_handler >(
+        iterations);
+}
+
+UTIL_BENCHMARK("virtual", "small: construct+invoke")
+{
+    construct_and_invoke< virtual_handler< void(int) >, small_handler >(
+        iterations);
+}
+
+UTIL_BENCHMARK("virtual", "large: construct+invoke")
+{
+    construct_and_invoke< virtual_handler< void(int) >, large_handler >(
+        iterations);
+}
+
+// any_completion_handler arrived in boost 1.81, after the version this
+// project pins, so it is measured only when built against a newer boost
+#if BOOST_VERSION >= 108100
+
+UTIL_BENCHMARK("any_completion", "small: construct+invoke")
+{
+    construct_and_invoke< net::any_completion_handler< void(int) >,
+                          small_handler >(iterations);
+}
+
+UTIL_BENCHMARK("any_completion", "large: construct+invoke")
+{
+    construct_and_invoke< net::any_completion_handler< void(int) >,
+                          large_handler >(iterations);
+}
+
+#endif
@@ -1,12 +1,31 @@
 #pragma once
+#include "util/detail/handler_memory.hpp"
+#include "util/net.hpp"
+
+#include <cstddef>
+#include <functional>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace beast_fun_times::util
 {
+    /// The default inline capacity of a poly_handler.
+    ///
+    /// Enough for the handlers of asio's coroutines and for lambdas bound to
+    /// an any_io_executor or a strand, which are the completion handlers this
+    /// project actually stores.
+    constexpr std::size_t poly_handler_default_capacity = 10 * sizeof(void *);
+
     namespace detail
     {
+        template < std::size_t Size, std::size_t Align >
         union sbo_storage
         {
+            static_assert(Size >= sizeof(void *),
+                          "the inline buffer must be able to hold a pointer");
+
             sbo_storage() noexcept
             {
             }
@@ -15,172 +34,251 @@ namespace beast_fun_times::util
             {
             }
 
-            void *                             short_[6];
-            std::unique_ptr< unsigned char[] > long_;
+            alignas(Align) unsigned char short_[Size];
+            void *long_;
         };
 
-        template < class Ret, class... Args >
-        struct poly_handler_vtable
+        /// The operations on one type of handler stored in a poly_handler.
+        /// One constant table per handler type, shared by every poly_handler
+        /// which stores that type.
+        template < class Storage, class Ret, class... Args >
+        struct poly_handler_ops
         {
-            // move-construct from value - may throw
-            virtual void
-            move_construct(sbo_storage &storage, void *source) const = 0;
-
-            // move construct from other SBO. May not throw
-            virtual void
-            move_construct(sbo_storage &storage,
-                           sbo_storage &source) const noexcept = 0;
+            // move the handler from source into storage, leaving source empty
+            void (*relocate)(Storage &storage, Storage &source) noexcept;
 
-            virtual Ret
-            invoke(sbo_storage &storage, Args... args) const = 0;
+            // invoke the handler, destroying it first
+            Ret (*invoke)(Storage &storage, Args &&...args);
 
-            virtual void
-            destroy(sbo_storage &storage) const noexcept = 0;
+            void (*destroy)(Storage &storage) noexcept;
         };
 
-        template < class Actual, class Ret, class... Args >
-        static auto
-        make_small_poly_handler_vtable()
+        /// An Actual which is stored in the inline buffer
+        template < class Actual, class Storage, class Ret, class... Args >
+        struct small_poly_handler
         {
-            static_assert(sizeof(Actual) <= sizeof(sbo_storage));
+            static Actual &
+            realise(Storage &storage) noexcept
+            {
+                return *std::launder(
+                    reinterpret_cast< Actual * >(storage.short_));
+            }
 
-            static const struct : poly_handler_vtable< Ret, Args... >
+            template < class Handler >
+            static void
+            construct(Storage &storage, Handler &&handler)
             {
-                static Actual &
-                realise(sbo_storage &storage) noexcept
-                {
-                    return *reinterpret_cast< Actual * >(&storage.short_[0]);
-                }
+                new (storage.short_) Actual(std::forward< Handler >(handler));
+            }
 
-                void
-                move_construct(sbo_storage &storage,
-                               void *       source) const override
-                {
-                    new (&realise(storage)) Actual(
-                        std::move(*reinterpret_cast< Actual * >(source)));
-                }
+            static void
+            relocate(Storage &storage, Storage &source) noexcept
+            {
+                new (storage.short_) Actual(std::move(realise(source)));
+                realise(source).~Actual();
+            }
 
-                void
-                move_construct(sbo_storage &storage,
-                               sbo_storage &source) const noexcept override
-                {
-                    new (&realise(storage)) Actual(std::move(realise(source)));
-                }
+            static Ret
+            invoke(Storage &storage, Args &&...args)
+            {
+                auto act = std::move(realise(storage));
+                realise(storage).~Actual();
+                return act(std::forward< Args >(args)...);
+            }
 
-                Ret
-                invoke(sbo_storage &storage, Args... args) const override
-                {
-                    auto act = std::move(realise(storage));
-                    destroy(storage);
-                    return act(std::move(args)...);
-                }
+            static void
+            destroy(Storage &storage) noexcept
+            {
+                realise(storage).~Actual();
+            }
 
-                void
-                destroy(sbo_storage &storage) const noexcept override
-                {
-                    realise(storage).~Actual();
-                }
-            } x;
-            return &x;
-        }
+            static constexpr poly_handler_ops< Storage, Ret, Args... > ops {
+                &relocate, &invoke, &destroy
+            };
+        };
+
+        /// The allocator used to store an Actual which is too big for the
+        /// small buffer: the handler's associated allocator, rebound.
+        template < class Actual >
+        using big_handler_allocator =
+            typename std::allocator_traits< net::associated_allocator_t<
+                Actual > >::template rebind_alloc< Actual >;
 
-        template < class Actual, class Ret, class... Args >
-        auto
-        make_big_poly_handler_vtable()
+        /// An Actual which is too big for the inline buffer.
+        ///
+        /// If the handler has an associated allocator, its memory comes from
+        /// there. Otherwise it comes from the thread's handler_memory cache.
+        template < class Actual, class Storage, class Ret, class... Args >
+        struct big_poly_handler
         {
-            static_assert(sizeof(Actual) > sizeof(sbo_storage));
+            static constexpr bool recycled =
+                std::is_same_v< net::associated_allocator_t< Actual >,
+                                std::allocator< void > > and
+                alignof(Actual) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+            using alloc_type   = big_handler_allocator< Actual >;
+            using alloc_traits = std::allocator_traits< alloc_type >;
+
+            static Actual &
+            realise(Storage &storage) noexcept
+            {
+                return *static_cast< Actual * >(storage.long_);
+            }
 
-            static const struct : poly_handler_vtable< Ret, Args... >
+            template < class Handler >
+            static void
+            construct(Storage &storage, Handler &&handler)
             {
-                void
-                move_construct(sbo_storage &storage,
-                               void *       source) const override
+                if constexpr (recycled)
                 {
-                    constexpr auto size = sizeof(Actual);
-                    new (&storage.long_) std::unique_ptr< unsigned char[] >();
-                    storage.long_.reset(new unsigned char[size]);
-                    new (storage.long_.get()) Actual(
-                        std::move(*reinterpret_cast< Actual * >(source)));
+                    auto p = handler_memory::allocate(sizeof(Actual));
+                    try
+                    {
+                        storage.long_ =
+                            new (p) Actual(std::forward< Handler >(handler));
+                    }
+                    catch (...)
+                    {
+                        handler_memory::deallocate(p, sizeof(Actual));
+                        throw;
+                    }
                 }
-
-                void
-                move_construct(sbo_storage &storage,
-                               sbo_storage &source) const noexcept override
+                else
                 {
-                    new (&storage.long_) std::unique_ptr<unsigned char[]>(std::move(source.long_));
+                    auto alloc =
+                        alloc_type(net::get_associated_allocator(handler));
+                    auto p = alloc_traits::allocate(alloc, 1);
+                    try
+                    {
+                        alloc_traits::construct(
+                            alloc, p, std::forward< Handler >(handler));
+                    }
+                    catch (...)
+                    {
+                        alloc_traits::deallocate(alloc, p, 1);
+                        throw;
+                    }
+                    storage.long_ = p;
                 }
+            }
+
+            // the allocator which release must use, taken while the handler
+            // still holds it
+            static alloc_type
+            allocator_of(Actual const &act) noexcept
+            {
+                return alloc_type(net::get_associated_allocator(act));
+            }
 
-                Ret
-                invoke(sbo_storage &storage, Args... args) const override
+            // destroy the handler and return its memory to where it came from
+            static void
+            release(Actual *p, alloc_type alloc) noexcept
+            {
+                if constexpr (recycled)
                 {
-                    auto act = std::move(*reinterpret_cast<Actual*>(storage.long_.get()));
-                    storage.long_.reset();
-                    destroy(storage);
-                    return act(std::move(args)...);
+                    p->~Actual();
+                    handler_memory::deallocate(p, sizeof(Actual));
                 }
-
-                void
-                destroy(sbo_storage &storage) const noexcept override
+                else
                 {
-                    if (storage.long_)
-                        reinterpret_cast<Actual*>(storage.long_.get())->~Actual();
-                    storage.long_.~unique_ptr< unsigned char[] >();
+                    alloc_traits::destroy(alloc, p);
+                    alloc_traits::deallocate(alloc, p, 1);
                 }
-            } x;
-            return &x;
-        }
+            }
+
+            static void
+            relocate(Storage &storage, Storage &source) noexcept
+            {
+                storage.long_ = std::exchange(source.long_, nullptr);
+            }
+
+            static Ret
+            invoke(Storage &storage, Args &&...args)
+            {
+                // free the memory before the upcall, so that the handler
+                // may reuse it
+                auto &stored = realise(storage);
+                auto  alloc  = allocator_of(stored);
+                auto  act    = std::move(stored);
+                release(&stored, std::move(alloc));
+                return act(std::forward< Args >(args)...);
+            }
+
+            static void
+            destroy(Storage &storage) noexcept
+            {
+                auto &stored = realise(storage);
+                release(&stored, allocator_of(stored));
+            }
+
+            static constexpr poly_handler_ops< Storage, Ret, Args... > ops {
+                &relocate, &invoke, &destroy
+            };
+        };
 
     }   // namespace detail
+
     /// A polymorphic completion handler
+    ///
+    /// Handlers of up to Size bytes, whose alignment is no stricter than
+    /// Align and which can be moved without throwing, are stored inline.
+    /// Bigger handlers are stored in memory from their associated allocator
+    /// or, if they have none, from a per-thread cache, so storing and
+    /// invoking handlers of the same type over and over does not touch the
+    /// heap.
     /// \tparam Sig
-    template < class Sig >
-    struct poly_handler;
+    /// \tparam Size the capacity of the inline buffer
+    /// \tparam Align the alignment of the inline buffer
+    template < class Sig,
+               std::size_t Size  = poly_handler_default_capacity,
+               std::size_t Align = alignof(std::max_align_t) >
+    class poly_handler;
 
-    template < class Ret, class... Args >
-    class poly_handler< Ret(Args...) >
+    template < class Ret, class... Args, std::size_t Size, std::size_t Align >
+    class poly_handler< Ret(Args...), Size, Align >
     {
-        detail::sbo_storage                                storage_;
-        detail::poly_handler_vtable< Ret, Args... > const *kind_;
+        using storage_type = detail::sbo_storage< Size, Align >;
+        using ops_type = detail::poly_handler_ops< storage_type, Ret, Args... >;
+
+        storage_type    storage_;
+        ops_type const *ops_;
 
       public:
+        /// True if a handler of type Actual is stored inline
+        template < class Actual >
+        static constexpr bool stored_inline =
+            sizeof(Actual) <= sizeof(storage_type) and
+            alignof(Actual) <= alignof(storage_type) and
+            std::is_nothrow_move_constructible_v< Actual >;
+
         poly_handler()
         : storage_ {}
-        , kind_(nullptr)
+        , ops_(nullptr)
         {
         }
 
         template <
-            class Actual,
+            class Handler,
+            class Actual = std::decay_t< Handler >,
             std::enable_if_t< !std::is_same_v< Actual, poly_handler > &&
-                              std::is_invocable_r_v< Ret, Actual, Args... > >
+                              std::is_invocable_r_v< Ret, Actual &, Args... > >
                 * = nullptr >
-        poly_handler(Actual actual)
+        poly_handler(Handler &&handler)
         {
-            constexpr auto size = sizeof(Actual);
-            if constexpr (size > sizeof(storage_))
-            {
-                // non-sbo
-                auto kind = detail::
-                    make_big_poly_handler_vtable< Actual, Ret, Args... >();
-                kind->move_construct(storage_, std::addressof(actual));
-                kind_ = kind;
-            }
-            else
-            {
-                // sbo
-                auto kind = detail::
-                    make_small_poly_handler_vtable< Actual, Ret, Args... >();
-                kind->move_construct(storage_, std::addressof(actual));
-                kind_ = kind;
-            }
+            using kind = std::conditional_t<
+                stored_inline< Actual >,
+                detail::small_poly_handler< Actual, storage_type, Ret, Args... >,
+                detail::big_poly_handler< Actual, storage_type, Ret, Args... > >;
+            kind::construct(storage_, std::forward< Handler >(handler));
+            ops_ = &kind::ops;
         }
 
         poly_handler(poly_handler &&other) noexcept
         : storage_ {}
-        , kind_(std::exchange(other.kind_, nullptr))
+        , ops_(std::exchange(other.ops_, nullptr))
         {
-            if(kind_)
-                kind_->move_construct(storage_, other.storage_);
+            if (ops_)
+                ops_->relocate(storage_, other.storage_);
         }
 
         poly_handler &
@@ -193,16 +291,16 @@ namespace beast_fun_times::util
 
         ~poly_handler()
         {
-            if (kind_)
-                kind_->destroy(storage_);
+            if (ops_)
+                ops_->destroy(storage_);
         }
 
         Ret
         operator()(Args... args)
         {
-            auto k = std::exchange(kind_, nullptr);
-            if (k)
-                return k->invoke(storage_, std::move(args)...);
+            auto ops = std::exchange(ops_, nullptr);
+            if (ops)
+                return ops->invoke(storage_, std::forward< Args >(args)...);
             else
                 throw std::bad_function_call();
         }
@@ -210,11 +308,11 @@ namespace beast_fun_times::util
         bool
         has_value() const
         {
-            return kind_ != nullptr;
+            return ops_ != nullptr;
         }
         operator bool() const
         {
             return has_value();
         }
     };
-}   // namespace beast_fun_times::util
\ No newline at end of file
+}   // namespace beast_fun_times::util
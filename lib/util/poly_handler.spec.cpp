@@ -1,6 +1,11 @@
 #include <catch2/catch.hpp>
 
 #include "util/poly_handler.hpp"
+#include "util/testing/allocation_counter.hpp"
+
+#include <array>
+#include <memory>
+#include <string>
 
 using namespace beast_fun_times::util;
 using namespace std::literals;
@@ -38,4 +43,134 @@ TEST_CASE("util::poly_handler")
     CHECK(target == "test xyz");
     CHECK(f.has_value() == false);
 
-}
\ No newline at end of file
+}
+
+namespace
+{
+    struct alignas(64) overaligned
+    {
+        void operator()(std::string) {}
+    };
+
+    struct throwing_move
+    {
+        throwing_move() = default;
+        throwing_move(throwing_move &&) noexcept(false) {}
+        void operator()(std::string) {}
+    };
+
+    /// Counts the allocations made through it which are outstanding
+    template < class T >
+    struct counting_allocator
+    {
+        using value_type = T;
+
+        counting_allocator(int *count) : count(count) {}
+
+        template < class U >
+        counting_allocator(counting_allocator< U > const &other) : count(other.count) {}
+
+        T *allocate(std::size_t n)
+        {
+            ++*count;
+            return std::allocator< T >().allocate(n);
+        }
+
+        void deallocate(T *p, std::size_t n)
+        {
+            if (count)
+                --*count;
+            std::allocator< T >().deallocate(p, n);
+        }
+
+        bool operator==(counting_allocator const &other) const { return count == other.count; }
+        bool operator!=(counting_allocator const &other) const { return count != other.count; }
+
+        int *count;
+    };
+
+    struct big_with_allocator
+    {
+        using allocator_type = counting_allocator< void >;
+
+        big_with_allocator(allocator_type alloc, std::string *target) : alloc(alloc), target(target) {}
+
+        // like a handler whose allocator lives in its state, a moved-from
+        // handler has lost its allocator
+        big_with_allocator(big_with_allocator &&other) noexcept
+        : alloc(std::exchange(other.alloc, allocator_type(nullptr))), target(other.target) {}
+
+        allocator_type get_allocator() const { return alloc; }
+
+        void operator()(std::string s) { *target = s; }
+
+        allocator_type alloc;
+        std::string *target;
+        std::array< void *, 16 > padding {};
+    };
+}
+
+TEST_CASE("util::poly_handler storage")
+{
+    using handler = poly_handler<void(std::string)>;
+    auto three_strings = [x = ""s, y = ""s, z = ""s](std::string) {};
+    auto pointer = [p = (void *)nullptr](std::string) {};
+
+    CHECK(handler::stored_inline<decltype(pointer)>);
+    CHECK_FALSE(handler::stored_inline<decltype(three_strings)>);
+    CHECK(poly_handler<void(std::string), 4 * sizeof(std::string)>::stored_inline<decltype(three_strings)>);
+    CHECK_FALSE(poly_handler<void(std::string), 8>::stored_inline<decltype(three_strings)>);
+    CHECK_FALSE(handler::stored_inline<overaligned>);
+    CHECK(poly_handler<void(std::string), 64, 64>::stored_inline<overaligned>);
+    CHECK_FALSE(handler::stored_inline<throwing_move>);
+}
+
+TEST_CASE("util::poly_handler destroys handlers exactly once")
+{
+    auto token = std::make_shared<int>(0);
+    auto small = [token](std::string) {};
+    auto big = [token, padding = std::array<void *, 32>()](std::string) {};
+    {
+        auto f = poly_handler<void(std::string)>(small);
+        auto g = poly_handler<void(std::string)>(big);
+        CHECK(token.use_count() == 5);
+        auto f2 = std::move(f);
+        auto g2 = std::move(g);
+        CHECK(token.use_count() == 5);
+        f2("x");
+        CHECK(token.use_count() == 4);
+    }
+    CHECK(token.use_count() == 3);
+}
+
+TEST_CASE("util::poly_handler big handlers recycle their memory")
+{
+    using testing::allocations;
+
+    std::string target;
+    auto big = [&target, padding = std::array<void *, 16>()](std::string s) {
+        target = s;
+    };
+    using handler = poly_handler<void(std::string)>;
+    REQUIRE_FALSE(handler::stored_inline<decltype(big)>);
+
+    auto warm = handler(big);
+    warm("warm up");
+    auto before = allocations();
+    for (int i = 0; i < 100; ++i)
+    {
+        auto f = handler(big);
+        auto g = std::move(f);
+        g("x");
+    }
+    CHECK(allocations() == before);
+    CHECK(target == "x");
+
+    // a handler with an associated allocator uses it
+    int count = 0;
+    auto f = handler(big_with_allocator { counting_allocator<void>(&count), &target });
+    CHECK(count == 1);
+    f("y");
+    CHECK(target == "y");
+    CHECK(count == 0);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "util/detail/handler_memory.hpp"
+
+#include <cstddef>
+#include <new>
+
+namespace beast_fun_times::util
+{
+    /// Counts of what the calling thread has allocated through its recycling
+    /// cache, which is shared by recycling_allocator and poly_handler.
+    using recycling_stats = detail::handler_memory::counters;
+
+    /// The calling thread's recycling statistics since it started
+    inline recycling_stats
+    recycling_allocator_stats() noexcept
+    {
+        return detail::handler_memory::stats;
+    }
+
+    /// An allocator which recycles memory through a per-thread cache.
+    ///
+    /// Objects which are created and destroyed over and over on the same
+    /// thread, such as the operations of an io_context's executor or the
+    /// per-connection objects of a server under a high connection rate,
+    /// reuse the thread's spare blocks rather than going to the global heap.
+    /// Blocks bigger than the cache's largest size class go straight to
+    /// operator new. Memory may be freed on any thread.
+    ///
+    /// It is stateless, so every recycling_allocator compares equal.
+    template < class T >
+    class recycling_allocator
+    {
+      public:
+        using value_type = T;
+
+        constexpr recycling_allocator() noexcept = default;
+
+        template < class U >
+        constexpr recycling_allocator(recycling_allocator< U > const &) noexcept
+        {
+        }
+
+        T *
+        allocate(std::size_t n)
+        {
+            static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                          "over-aligned types are not supported");
+            return static_cast< T * >(
+                detail::handler_memory::allocate(n * sizeof(T)));
+        }
+
+        void
+        deallocate(T *p, std::size_t n) noexcept
+        {
+            detail::handler_memory::deallocate(p, n * sizeof(T));
+        }
+    };
+
+    template < class T, class U >
+    constexpr bool
+    operator==(recycling_allocator< T > const &,
+               recycling_allocator< U > const &) noexcept
+    {
+        return true;
+    }
+
+    template < class T, class U >
+    constexpr bool
+    operator!=(recycling_allocator< T > const &,
+               recycling_allocator< U > const &) noexcept
+    {
+        return false;
+    }
+
+}   // namespace beast_fun_times::util
@@ -0,0 +1,67 @@
+#include <catch2/catch.hpp>
+
+#include "util/net.hpp"
+#include "util/recycling_allocator.hpp"
+#include "util/testing/allocation_counter.hpp"
+
+#include <array>
+#include <list>
+#include <memory>
+
+using namespace beast_fun_times::util;
+
+TEST_CASE("util::recycling_allocator")
+{
+    using testing::allocations;
+
+    auto list = std::list<int, recycling_allocator<int>>();
+    for (int i = 0; i < 10; ++i)
+        list.push_back(i);
+    list.clear();
+
+    // the nodes come back from the thread's cache
+    auto stats  = recycling_allocator_stats();
+    auto before = allocations();
+    for (int i = 0; i < 10; ++i)
+        list.push_back(i);
+    CHECK(allocations() == before);
+    CHECK(recycling_allocator_stats().allocations == stats.allocations + 10);
+    CHECK(recycling_allocator_stats().recycled == stats.recycled + 10);
+    list.clear();
+
+    // big blocks go to the heap, and are counted
+    using big = std::array<char, detail::handler_memory::max_cached_size + 1>;
+    stats     = recycling_allocator_stats();
+    auto p    = std::allocate_shared<big>(recycling_allocator<big>());
+    CHECK(recycling_allocator_stats().oversize == stats.oversize + 1);
+    p.reset();
+
+    static_assert(recycling_allocator<int>() == recycling_allocator<char>());
+}
+
+TEST_CASE("util::recycling_allocator with an io_context")
+{
+    using testing::allocations;
+
+    auto ioc  = net::io_context(1);
+    auto exec = net::require(
+        ioc.get_executor(),
+        net::execution::allocator(recycling_allocator<void>()));
+
+    int  count = 0;
+    auto run   = [&] {
+        for (int i = 0; i < 10; ++i)
+            net::execution::execute(exec, [&count] { ++count; });
+        ioc.restart();
+        ioc.run();
+    };
+    run();
+
+    // the executor's operations are recycled
+    auto stats  = recycling_allocator_stats();
+    auto before = allocations();
+    run();
+    CHECK(count == 20);
+    CHECK(allocations() == before);
+    CHECK(recycling_allocator_stats().recycled == stats.recycled + 10);
+}
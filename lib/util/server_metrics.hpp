@@ -0,0 +1,273 @@
+#pragma once
+#include "util/async_queue_stats.hpp"
+#include "util/detail/mpsc_list.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace beast_fun_times::util
+{
+    /// A counter which only its owning thread adds to, and any thread may
+    /// read. Adding is a relaxed load and store: no locked instruction, and
+    /// no cache line shared with another thread's counters.
+    template < class T >
+    class thread_counter
+    {
+      public:
+        void
+        add(T n = 1) noexcept
+        {
+            value_.store(value_.load(std::memory_order_relaxed) + n,
+                         std::memory_order_relaxed);
+        }
+
+        T
+        value() const noexcept
+        {
+            return value_.load(std::memory_order_relaxed);
+        }
+
+      private:
+        std::atomic< T > value_ { 0 };
+    };
+
+    /// One thread's share of a server's metrics
+    struct alignas(detail::cache_line_size) metrics_counters
+    {
+        thread_counter< std::uint64_t > accepted;
+        thread_counter< std::uint64_t > closed;
+        thread_counter< std::uint64_t > handshake_failures;
+        thread_counter< std::uint64_t > messages_in;
+        thread_counter< std::uint64_t > bytes_in;
+        thread_counter< std::uint64_t > messages_out;
+        thread_counter< std::uint64_t > bytes_out;
+        thread_counter< std::uint64_t > hibernations;
+
+        /// Messages waiting in transmit queues. A message may be queued on
+        /// one thread and leave on another, so one thread's share may be
+        /// negative; the total is not.
+        thread_counter< std::int64_t > queued;
+    };
+
+    /// The metrics of every thread, added together
+    struct metrics_snapshot
+    {
+        std::uint64_t accepted           = 0;
+        std::uint64_t closed             = 0;
+        std::uint64_t handshake_failures = 0;
+        std::uint64_t messages_in        = 0;
+        std::uint64_t bytes_in           = 0;
+        std::uint64_t messages_out       = 0;
+        std::uint64_t bytes_out          = 0;
+        std::uint64_t hibernations       = 0;
+        std::int64_t  queued             = 0;
+
+        /// Connections accepted and not yet closed
+        std::uint64_t
+        active() const noexcept
+        {
+            return accepted > closed ? accepted - closed : 0;
+        }
+
+        metrics_snapshot &
+        operator+=(metrics_counters const &c) noexcept
+        {
+            accepted += c.accepted.value();
+            closed += c.closed.value();
+            handshake_failures += c.handshake_failures.value();
+            messages_in += c.messages_in.value();
+            bytes_in += c.bytes_in.value();
+            messages_out += c.messages_out.value();
+            bytes_out += c.bytes_out.value();
+            hibernations += c.hibernations.value();
+            queued += c.queued.value();
+            return *this;
+        }
+    };
+
+    /// The process's server metrics.
+    ///
+    /// Each thread counts into its own metrics_counters, registered on first
+    /// use, so counting never contends. A scrape adds every thread's
+    /// counters together. The counters of a thread which has exited are kept,
+    /// so that totals never go backwards.
+    class server_metrics
+    {
+      public:
+        static server_metrics &
+        instance()
+        {
+            static server_metrics m;
+            return m;
+        }
+
+        /// The calling thread's counters
+        static metrics_counters &
+        local()
+        {
+            thread_local metrics_counters *mine = nullptr;
+            if (not mine)
+                mine = instance().add_thread();
+            return *mine;
+        }
+
+        server_metrics(server_metrics const &) = delete;
+
+        server_metrics &
+        operator=(server_metrics const &) = delete;
+
+        /// Every thread's counters, added together. Counters are read one at
+        /// a time while other threads count, so a snapshot is not a single
+        /// instant, but each counter in it is one which was reached.
+        metrics_snapshot
+        snapshot() const
+        {
+            auto s    = metrics_snapshot();
+            auto lock = std::lock_guard(mutex_);
+            for (auto &c : threads_)
+                s += *c;
+            if (s.queued < 0)
+                s.queued = 0;
+            return s;
+        }
+
+      private:
+        server_metrics() = default;
+
+        metrics_counters *
+        add_thread()
+        {
+            auto lock = std::lock_guard(mutex_);
+            return threads_.emplace_back(std::make_unique< metrics_counters >())
+                .get();
+        }
+
+        mutable std::mutex                                 mutex_;
+        std::vector< std::unique_ptr< metrics_counters > > threads_;
+    };
+
+    /// Queue instrumentation which keeps the server_metrics queued gauge, on
+    /// top of the instrumentation Inner. Select it with the stats_type of a
+    /// basic_async_queue's Traits.
+    template < class Inner = null_async_queue_stats >
+    struct metered_queue_stats : Inner
+    {
+        using stamp = typename Inner::stamp;
+
+        static constexpr bool enabled = true;
+
+        metered_queue_stats() = default;
+
+        metered_queue_stats(metered_queue_stats const &) = delete;
+
+        metered_queue_stats &
+        operator=(metered_queue_stats const &) = delete;
+
+        /// Elements still queued when the queue is destroyed leave the gauge
+        /// with it
+        ~metered_queue_stats()
+        {
+            if (auto n = held_.load(std::memory_order_relaxed))
+                server_metrics::local().queued.add(-n);
+        }
+
+        void
+        on_push(stamp &s) noexcept
+        {
+            Inner::on_push(s);
+            held_.fetch_add(1, std::memory_order_relaxed);
+            server_metrics::local().queued.add(1);
+        }
+
+        void
+        on_pop(stamp const &s) noexcept
+        {
+            Inner::on_pop(s);
+            gone();
+        }
+
+        void
+        on_discard(stamp const &s) noexcept
+        {
+            Inner::on_discard(s);
+            gone();
+        }
+
+      private:
+        void
+        gone() noexcept
+        {
+            held_.fetch_sub(1, std::memory_order_relaxed);
+            server_metrics::local().queued.add(-1);
+        }
+
+        std::atomic< std::int64_t > held_ { 0 };
+    };
+
+    /// Write a snapshot in the Prometheus text exposition format, each
+    /// metric's name starting with prefix
+    inline std::string
+    to_prometheus(metrics_snapshot const &s,
+                  std::string_view        prefix = "beast_fun_times")
+    {
+        auto out    = std::string();
+        auto metric = [&](std::string_view name,
+                          std::string_view type,
+                          std::string_view help,
+                          auto             value) {
+            auto full = std::string(prefix).append("_").append(name);
+            out.append("# HELP ").append(full).append(" ").append(help);
+            out.append("\n# TYPE ").append(full).append(" ").append(type);
+            out.append("\n").append(full).append(" ");
+            out.append(std::to_string(value)).append("\n");
+        };
+        metric("connections_accepted_total",
+               "counter",
+               "Connections accepted.",
+               s.accepted);
+        metric("connections_closed_total",
+               "counter",
+               "Connections closed.",
+               s.closed);
+        metric("connections_active",
+               "gauge",
+               "Connections accepted and not yet closed.",
+               s.active());
+        metric("handshake_failures_total",
+               "counter",
+               "Websocket handshakes which failed.",
+               s.handshake_failures);
+        metric("messages_received_total",
+               "counter",
+               "Websocket messages received.",
+               s.messages_in);
+        metric("bytes_received_total",
+               "counter",
+               "Websocket message payload bytes received.",
+               s.bytes_in);
+        metric("messages_sent_total",
+               "counter",
+               "Websocket messages sent.",
+               s.messages_out);
+        metric("bytes_sent_total",
+               "counter",
+               "Websocket message payload bytes sent.",
+               s.bytes_out);
+        metric("hibernations_total",
+               "counter",
+               "Quiet connections which gave back their buffers.",
+               s.hibernations);
+        metric("tx_queue_depth",
+               "gauge",
+               "Messages waiting in transmit queues.",
+               s.queued);
+        return out;
+    }
+
+}   // namespace beast_fun_times::util
@@ -0,0 +1,130 @@
+#include <catch2/catch.hpp>
+
+#include "util/async_queue.hpp"
+#include "util/metrics_response.hpp"
+#include "util/server_metrics.hpp"
+
+#include <boost/beast/http/empty_body.hpp>
+#include <boost/beast/http/parser.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace beast_fun_times::util;
+
+namespace
+{
+    struct metered : async_queue_traits< std::string >
+    {
+        using stats_type = metered_queue_stats<>;
+    };
+}   // namespace
+
+TEST_CASE("util::server_metrics")
+{
+    auto &metrics = server_metrics::instance();
+    auto  before  = metrics.snapshot();
+
+    SECTION("each thread counts on its own, and a snapshot adds them up")
+    {
+        auto threads = std::vector< std::thread >();
+        for (int t = 0; t < 4; ++t)
+            threads.emplace_back([] {
+                auto &c = server_metrics::local();
+                for (int i = 0; i < 1000; ++i)
+                {
+                    c.messages_in.add();
+                    c.bytes_in.add(10);
+                }
+                c.accepted.add(3);
+                c.closed.add(1);
+            });
+        for (auto &t : threads)
+            t.join();
+
+        // and a thread's counts outlive it
+        auto after = metrics.snapshot();
+        CHECK(after.messages_in - before.messages_in == 4000);
+        CHECK(after.bytes_in - before.bytes_in == 40000);
+        CHECK(after.accepted - before.accepted == 12);
+        CHECK(after.active() - before.active() == 8);
+        CHECK(&server_metrics::local() == &server_metrics::local());
+    }
+
+    SECTION("metered queues keep the depth gauge")
+    {
+        auto ioc = net::io_context(1);
+        {
+            auto q = basic_async_queue< std::string,
+                                        net::io_context::executor_type,
+                                        metered >(ioc.get_executor());
+            for (int i = 0; i < 5; ++i)
+                q.push("x");
+            CHECK(metrics.snapshot().queued - before.queued == 5);
+
+            q.async_pop([](error_code, std::string) {});
+            ioc.run();
+            CHECK(metrics.snapshot().queued - before.queued == 4);
+        }
+
+        // what is left leaves with the queue
+        ioc.restart();
+        ioc.run();
+        CHECK(metrics.snapshot().queued == before.queued);
+    }
+}
+
+TEST_CASE("util::metrics_response")
+{
+    namespace http = boost::beast::http;
+
+    auto s        = metrics_snapshot();
+    s.accepted    = 7;
+    s.closed      = 2;
+    s.bytes_out   = 1234;
+    s.queued      = 3;
+    auto text     = to_prometheus(s);
+    auto contains = [&](std::string const &line) {
+        return text.find(line + "\n") != std::string::npos;
+    };
+    CHECK(contains("# TYPE beast_fun_times_connections_accepted_total counter"));
+    CHECK(contains("beast_fun_times_connections_accepted_total 7"));
+    CHECK(contains("beast_fun_times_connections_active 5"));
+    CHECK(contains("beast_fun_times_bytes_sent_total 1234"));
+    CHECK(contains("# TYPE beast_fun_times_tx_queue_depth gauge"));
+    CHECK(contains("beast_fun_times_tx_queue_depth 3"));
+
+    auto req = http::request< http::empty_body >(http::verb::get, "/metrics", 11);
+    auto res = metrics_response(req, s);
+    CHECK(res.result() == http::status::ok);
+    CHECK(res.body() == text);
+    CHECK(not res.keep_alive());
+    CHECK(res[http::field::content_type].starts_with("text/plain; version=0.0.4"));
+
+    req.target("/metrics?name[]=x");
+    CHECK(metrics_response(req, s).result() == http::status::ok);
+
+    req.target("/");
+    CHECK(metrics_response(req, s).result() == http::status::not_found);
+
+    req.target("/metrics");
+    req.method(http::verb::post);
+    CHECK(metrics_response(req, s).result() ==
+          http::status::method_not_allowed);
+
+    // a request with a body is read as the servers read it, and refused
+    auto parser = http::request_parser< http::string_body >();
+    parser.body_limit(max_http_request_body);
+    parser.eager(true);
+    auto wire = std::string("POST /metrics HTTP/1.1\r\n"
+                            "Host: localhost\r\n"
+                            "Content-Length: 5\r\n"
+                            "\r\n"
+                            "hello");
+    auto ec   = boost::beast::error_code();
+    parser.put(boost::asio::buffer(wire), ec);
+    REQUIRE(not ec);
+    REQUIRE(parser.is_done());
+    CHECK(metrics_response(parser.get(), s).result() ==
+          http::status::method_not_allowed);
+}
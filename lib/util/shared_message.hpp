@@ -0,0 +1,179 @@
+#pragma once
+#include "util/buffer_pool.hpp"
+#include "util/detail/handler_memory.hpp"
+#include "util/hibernating_buffer.hpp"
+#include "util/net.hpp"
+
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace beast_fun_times::util
+{
+    /// An immutable, reference counted message payload.
+    ///
+    /// Copying a shared_message copies a pointer, not the payload, so one
+    /// message can be queued to any number of connections, on any threads,
+    /// for the price of one. It is a ConstBufferSequence, so it can be passed
+    /// straight to async_write, and it keeps the payload alive for as long as
+    /// the write holds a copy of it.
+    ///
+    /// A message which is forwarded unchanged need not be copied out of the
+    /// buffer it was received into: take() adopts the buffer itself. When
+    /// the last copy of such a message is released, the buffer's storage
+    /// goes back to the buffer_pool, so an echo costs no allocation once
+    /// warmed up.
+    class shared_message
+    {
+        struct body
+        : boost::intrusive_ref_counter< body, boost::thread_safe_counter >
+        {
+            explicit body(std::string s)
+            : payload(std::move(s))
+            , buffer(payload.data(), payload.size())
+            {
+            }
+
+            explicit body(pooled_flat_buffer &&b)
+            : frame(std::move(b))
+            , buffer(frame.data())
+            {
+            }
+
+            body(body const &) = delete;
+
+            body &
+            operator=(body const &) = delete;
+
+            // bodies come and go with every message, so they are recycled
+            static void *
+            operator new(std::size_t size)
+            {
+                return detail::handler_memory::allocate(size);
+            }
+
+            static void
+            operator delete(void *p, std::size_t size) noexcept
+            {
+                detail::handler_memory::deallocate(p, size);
+            }
+
+            // one or the other holds the payload
+            std::string const       payload;
+            pooled_flat_buffer      frame;
+            net::const_buffer const buffer;
+        };
+
+      public:
+        using value_type     = net::const_buffer;
+        using const_iterator = net::const_buffer const *;
+
+        /// An empty message
+        shared_message() noexcept = default;
+
+        /// Take ownership of a payload, without copying it
+        explicit shared_message(std::string payload)
+        : body_(new body(std::move(payload)))
+        {
+        }
+
+        explicit shared_message(std::string_view payload)
+        : shared_message(std::string(payload))
+        {
+        }
+
+        explicit shared_message(char const *payload)
+        : shared_message(std::string(payload))
+        {
+        }
+
+        /// Take ownership of a buffer, without copying it. The buffer's
+        /// readable bytes are the payload.
+        explicit shared_message(pooled_flat_buffer &&buffer)
+        : body_(new body(std::move(buffer)))
+        {
+        }
+
+        /// Take the message in a receive buffer, without copying it, and
+        /// leave the buffer empty and ready for the next read
+        static shared_message
+        take(pooled_flat_buffer &buffer)
+        {
+            return shared_message(std::exchange(buffer, recycled_buffer()));
+        }
+
+        /// Take the message in a hibernating receive buffer, without copying
+        /// it. The buffer is left hibernating, and takes storage again when
+        /// the next message arrives.
+        static shared_message
+        take(hibernating_buffer &buffer)
+        {
+            return shared_message(buffer.release());
+        }
+
+        /// An empty buffer to receive into, whose storage is borrowed from
+        /// the buffer_pool as it is needed
+        static pooled_flat_buffer
+        recycled_buffer() noexcept
+        {
+            return pooled_flat_buffer();
+        }
+
+        const_iterator
+        begin() const noexcept
+        {
+            return body_ ? &body_->buffer : nullptr;
+        }
+
+        const_iterator
+        end() const noexcept
+        {
+            return body_ ? &body_->buffer + 1 : nullptr;
+        }
+
+        net::const_buffer
+        buffer() const noexcept
+        {
+            return body_ ? body_->buffer : net::const_buffer();
+        }
+
+        char const *
+        data() const noexcept
+        {
+            return body_ ? static_cast< char const * >(body_->buffer.data())
+                         : nullptr;
+        }
+
+        std::string_view
+        view() const noexcept
+        {
+            return std::string_view(data(), size());
+        }
+
+        std::size_t
+        size() const noexcept
+        {
+            return body_ ? body_->buffer.size() : 0;
+        }
+
+        bool
+        empty() const noexcept
+        {
+            return size() == 0;
+        }
+
+        /// The number of shared_messages which share this payload
+        std::size_t
+        use_count() const noexcept
+        {
+            return body_ ? body_->use_count() : 0;
+        }
+
+      private:
+        boost::intrusive_ptr< body const > body_;
+    };
+
+}   // namespace beast_fun_times::util
@@ -0,0 +1,120 @@
+#include <catch2/catch.hpp>
+
+#include "util/async_queue.hpp"
+#include "util/shared_message.hpp"
+#include "util/testing/allocation_counter.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace beast_fun_times::util;
+
+TEST_CASE("util::shared_message")
+{
+    auto empty = shared_message();
+    CHECK(empty.empty());
+    CHECK(empty.use_count() == 0);
+    CHECK(net::buffer_size(empty) == 0);
+
+    auto payload = std::string(100, 'x');
+    auto data    = payload.data();
+    auto m       = shared_message(std::move(payload));
+    CHECK(m.size() == 100);
+    CHECK(m.view() == std::string(100, 'x'));
+
+    // the payload was adopted, not copied
+    CHECK(m.buffer().data() == data);
+
+    // copies share the payload
+    auto copies = std::vector<shared_message>(10, m);
+    CHECK(m.use_count() == 11);
+    for (auto &c : copies)
+        CHECK(c.buffer().data() == data);
+    copies.clear();
+    CHECK(m.use_count() == 1);
+
+    // it is a ConstBufferSequence
+    static_assert(net::is_const_buffer_sequence<shared_message>::value);
+    CHECK(net::buffer_size(m) == 100);
+    auto out = std::string(100, '\0');
+    CHECK(net::buffer_copy(net::buffer(out), m) == 100);
+    CHECK(out == m.view());
+
+    auto literal = shared_message("hello");
+    CHECK(literal.view() == "hello");
+}
+
+TEST_CASE("util::shared_message fan out")
+{
+    auto ioc = net::io_context(1);
+    auto m   = shared_message(std::string(1000, 'y'));
+
+    // queues charge the payload against their byte limits
+    auto limits = async_queue_limits { async_queue_limits::unlimited, 2500 };
+    auto queues = std::vector<async_queue<shared_message>>();
+    for (int i = 0; i < 4; ++i)
+        queues.emplace_back(ioc.get_executor(), limits);
+    for (auto &q : queues)
+    {
+        CHECK(q.try_push(shared_message(m)));
+        CHECK(q.try_push(shared_message(m)));
+        CHECK_FALSE(q.try_push(shared_message(m)));
+    }
+    CHECK(m.use_count() == 9);
+
+    // and every consumer sees the same bytes
+    auto seen = std::vector<void const *>();
+    for (auto &q : queues)
+        q.async_pop([&](error_code ec, shared_message v) {
+            CHECK(not ec);
+            seen.push_back(v.buffer().data());
+        });
+    ioc.run();
+    CHECK(seen == std::vector<void const *>(4, m.buffer().data()));
+
+    // the payload may be released on any thread
+    auto t = std::thread([c = m]() mutable { c = shared_message(); });
+    t.join();
+    queues.clear();
+    ioc.restart();
+    ioc.run();
+    CHECK(m.use_count() == 1);
+}
+
+TEST_CASE("util::shared_message taken from a receive buffer")
+{
+    using testing::allocations;
+
+    auto rx   = shared_message::recycled_buffer();
+    auto fill = [&rx](std::string const &s) {
+        rx.commit(net::buffer_copy(rx.prepare(s.size()), net::buffer(s)));
+    };
+
+    fill("hello");
+    auto data = rx.data().data();
+    auto m    = shared_message::take(rx);
+    CHECK(m.view() == "hello");
+    CHECK(rx.size() == 0);
+
+    // the payload is the buffer's own storage
+    CHECK(m.buffer().data() == data);
+
+    // once released, the storage goes back to the pool, and the next
+    // receive borrows it
+    m = shared_message();
+    fill("world");
+    CHECK(rx.data().data() == data);
+
+    // and an echo, warmed up, allocates nothing
+    for (int i = 0; i < 2; ++i)
+    {
+        auto before = allocations();
+        auto echo   = shared_message::take(rx);
+        CHECK(echo.view() == "world");
+        echo = shared_message();
+        fill("world");
+        if (i == 1)
+            CHECK(allocations() == before);
+    }
+}
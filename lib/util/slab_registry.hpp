@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace beast_fun_times::util
+{
+    /// Identifies an element of a slab_registry.
+    ///
+    /// A handle outlives its element safely: once the element is erased, or
+    /// the registry cleared, the handle no longer finds anything, even if
+    /// its slot has been reused.
+    struct slab_handle
+    {
+        std::uint32_t index      = 0;
+        std::uint32_t generation = 0;   // never 0 for a valid handle
+
+        explicit operator bool() const noexcept
+        {
+            return generation != 0;
+        }
+
+        bool
+        operator==(slab_handle const &other) const noexcept
+        {
+            return index == other.index and generation == other.generation;
+        }
+
+        bool
+        operator!=(slab_handle const &other) const noexcept
+        {
+            return not(*this == other);
+        }
+    };
+
+    /// A registry of objects, for single-threaded state machines.
+    ///
+    /// The elements are stored contiguously, so iterating over them is cache
+    /// friendly. Insertion, lookup and erasure are O(1), and so is size().
+    /// Erasure moves the last element into the hole, so iteration order is
+    /// not insertion order, and erasing invalidates iterators but not
+    /// handles. The memory of erased elements is reused, so a registry
+    /// through which many objects pass stays the size of its busiest moment.
+    template < class T >
+    class slab_registry
+    {
+        static constexpr std::uint32_t no_slot =
+            std::numeric_limits< std::uint32_t >::max();
+
+        struct slot
+        {
+            std::uint32_t generation = 1;
+
+            // The position of the element in values_ while the slot is in
+            // use. Otherwise the next free slot.
+            std::uint32_t position = no_slot;
+        };
+
+      public:
+        using value_type     = T;
+        using iterator       = typename std::vector< T >::iterator;
+        using const_iterator = typename std::vector< T >::const_iterator;
+
+        slab_handle
+        insert(T value)
+        {
+            auto index = free_;
+            if (index == no_slot)
+            {
+                index = std::uint32_t(slots_.size());
+                slots_.emplace_back();
+            }
+            values_.push_back(std::move(value));
+            owners_.push_back(index);
+
+            auto &s    = slots_[index];
+            free_      = s.position;
+            s.position = std::uint32_t(values_.size() - 1);
+            return slab_handle { index, s.generation };
+        }
+
+        /// Erase the element identified by h. Returns false if h no longer
+        /// identifies an element.
+        bool
+        erase(slab_handle h) noexcept
+        {
+            auto s = get(h);
+            if (not s)
+                return false;
+
+            // fill the hole with the last element
+            auto pos  = s->position;
+            auto last = std::uint32_t(values_.size() - 1);
+            if (pos != last)
+            {
+                values_[pos]                  = std::move(values_[last]);
+                owners_[pos]                  = owners_[last];
+                slots_[owners_[pos]].position = pos;
+            }
+            values_.pop_back();
+            owners_.pop_back();
+            release(*s, h.index);
+            return true;
+        }
+
+        /// The element identified by h, or nullptr if it has been erased
+        T *
+        find(slab_handle h) noexcept
+        {
+            auto s = get(h);
+            return s ? &values_[s->position] : nullptr;
+        }
+
+        T const *
+        find(slab_handle h) const noexcept
+        {
+            return const_cast< slab_registry * >(this)->find(h);
+        }
+
+        std::size_t
+        size() const noexcept
+        {
+            return values_.size();
+        }
+
+        bool
+        empty() const noexcept
+        {
+            return values_.empty();
+        }
+
+        /// Erase every element. Every outstanding handle is invalidated.
+        void
+        clear() noexcept
+        {
+            for (auto index : owners_)
+                release(slots_[index], index);
+            values_.clear();
+            owners_.clear();
+        }
+
+        iterator
+        begin() noexcept
+        {
+            return values_.begin();
+        }
+
+        iterator
+        end() noexcept
+        {
+            return values_.end();
+        }
+
+        const_iterator
+        begin() const noexcept
+        {
+            return values_.begin();
+        }
+
+        const_iterator
+        end() const noexcept
+        {
+            return values_.end();
+        }
+
+      private:
+        slot *
+        get(slab_handle h) noexcept
+        {
+            if (h.index >= slots_.size())
+                return nullptr;
+            auto &s = slots_[h.index];
+            if (s.generation != h.generation or s.position >= values_.size() or
+                owners_[s.position] != h.index)
+                return nullptr;
+            return &s;
+        }
+
+        void
+        release(slot &s, std::uint32_t index) noexcept
+        {
+            if (++s.generation == 0)
+                s.generation = 1;
+            s.position = free_;
+            free_      = index;
+        }
+
+      private:
+        std::vector< T >             values_;
+        std::vector< std::uint32_t > owners_;   // the slot of each value
+        std::vector< slot >          slots_;
+        std::uint32_t                free_ = no_slot;
+    };
+
+}   // namespace beast_fun_times::util
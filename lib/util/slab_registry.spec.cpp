@@ -0,0 +1,74 @@
+#include <catch2/catch.hpp>
+
+#include "util/slab_registry.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace beast_fun_times::util;
+
+TEST_CASE("util::slab_registry")
+{
+    auto r = slab_registry<std::string>();
+    CHECK(r.empty());
+    CHECK_FALSE(slab_handle());
+
+    auto a = r.insert("a");
+    auto b = r.insert("b");
+    auto c = r.insert("c");
+    CHECK(r.size() == 3);
+    REQUIRE(r.find(b));
+    CHECK(*r.find(b) == "b");
+
+    // erasing fills the hole, and the other handles still work
+    CHECK(r.erase(a));
+    CHECK(r.size() == 2);
+    CHECK(r.find(a) == nullptr);
+    CHECK(*r.find(b) == "b");
+    CHECK(*r.find(c) == "c");
+    auto all = std::vector<std::string>(r.begin(), r.end());
+    std::sort(all.begin(), all.end());
+    CHECK(all == std::vector<std::string>{"b", "c"});
+
+    // a stale handle does not find the element which reuses its slot
+    CHECK_FALSE(r.erase(a));
+    auto d = r.insert("d");
+    CHECK(d.index == a.index);
+    CHECK(d != a);
+    CHECK(r.find(a) == nullptr);
+    CHECK_FALSE(r.erase(a));
+    CHECK(*r.find(d) == "d");
+
+    // clearing invalidates every handle
+    r.clear();
+    CHECK(r.empty());
+    CHECK(r.find(b) == nullptr);
+    CHECK_FALSE(r.erase(c));
+    auto e = r.insert("e");
+    CHECK(r.size() == 1);
+    CHECK(r.find(d) == nullptr);
+    CHECK(*r.find(e) == "e");
+}
+
+TEST_CASE("util::slab_registry reuses its memory")
+{
+    auto r       = slab_registry<std::unique_ptr<int>>();
+    auto handles = std::vector<slab_handle>();
+    for (int i = 0; i < 100; ++i)
+        handles.push_back(r.insert(std::make_unique<int>(i)));
+
+    // erase every other element
+    for (std::size_t i = 0; i < handles.size(); i += 2)
+        CHECK(r.erase(handles[i]));
+    CHECK(r.size() == 50);
+    for (std::size_t i = 1; i < handles.size(); i += 2)
+        CHECK(**r.find(handles[i]) == int(i));
+
+    // churn does not grow the slab
+    for (int round = 0; round < 1000; ++round)
+        CHECK(r.erase(r.insert(std::make_unique<int>(round))));
+    for (int i = 0; i < 50; ++i)
+        CHECK(r.insert(std::make_unique<int>(i)).index < 100);
+}
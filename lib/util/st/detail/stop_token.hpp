@@ -1,62 +1,281 @@
 #pragma once
 
+#include "util/net.hpp"
+#include "util/poly_handler.hpp"
+
+#include <atomic>
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdint>
-#include <functional>
-#include <limits>
-#include <unordered_map>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace util { namespace st { namespace detail {
 
+    namespace net = beast_fun_times::util::net;
+
     using stop_slot_sig = void();
-    using stop_slot     = std::function< stop_slot_sig >;
+    using stop_slot     = beast_fun_times::util::poly_handler< stop_slot_sig >;
 
-    struct stop_source_impl
+    /// A slot connected to a stop_state.
+    ///
+    /// Registrations live inside stop_connection objects and are linked into
+    /// the state's list, so connecting and disconnecting never allocate.
+    /// Every member is guarded by the state's mutex.
+    struct stop_registration
     {
-        static constexpr auto stopped_value =
-            std::numeric_limits< std::uint64_t >::max();
+        enum phase_type
+        {
+            waiting,   // not yet stopped
+            pending,   // posted to its executor
+            running    // the slot is being invoked
+        };
+
+        static constexpr std::size_t no_delivery = std::size_t(-1);
 
-        auto
-        connect(stop_slot slot) -> std::uint64_t
+        stop_registration *prev = nullptr;
+        stop_registration *next = nullptr;
+
+        // Non-zero while linked
+        std::uint64_t   id    = 0;
+        phase_type      phase = waiting;
+        std::thread::id runner;
+
+        // Once stopped, the registration's entry in the state's table of
+        // deliveries. The entry follows the registration if it moves, so a
+        // posted delivery finds it without a search.
+        std::size_t delivery = no_delivery;
+
+        // If empty, the slot is invoked on the thread which calls stop
+        net::any_io_executor executor;
+        stop_slot            slot;
+    };
+
+    struct stop_state
+    : boost::intrusive_ref_counter< stop_state, boost::thread_safe_counter >
+    {
+        bool
+        stopped() const noexcept
+        {
+            return stopped_.load(std::memory_order_acquire);
+        }
+
+        /// Link a registration whose executor and slot have been set. If the
+        /// state has already stopped, deliver the slot instead.
+        void
+        connect(stop_registration &r)
         {
-            auto id = next_id_;
-            if (id == stopped_value)
+            auto lock = std::unique_lock(mutex_);
+            if (not stopped_.load(std::memory_order_relaxed))
             {
-                slot();
+                r.id    = next_id_++;
+                r.phase = stop_registration::waiting;
+                link(r);
+                return;
             }
+            lock.unlock();
+
+            if (r.executor)
+                net::post(r.executor, [slot = std::move(r.slot)]() mutable {
+                    slot();
+                });
             else
+                std::exchange(r.slot, {})();
+        }
+
+        /// Unlink a registration, so that its slot will not be invoked.
+        ///
+        /// If the slot is running on another thread, wait for it to finish.
+        /// A slot may disconnect itself.
+        void
+        disconnect(stop_registration &r) noexcept
+        {
+            auto lock = std::unique_lock(mutex_);
+            if (r.id and r.phase == stop_registration::running and
+                r.runner != std::this_thread::get_id())
+                finished_.wait(lock, [&r] { return r.id == 0; });
+            if (r.id)
+                unlink(r);
+        }
+
+        /// Move a registration to a new address
+        void
+        relocate(stop_registration &to, stop_registration &from) noexcept
+        {
+            auto lock = std::lock_guard(mutex_);
+            if (not from.id)
+                return;
+            to.id       = std::exchange(from.id, 0);
+            to.phase    = from.phase;
+            to.runner   = from.runner;
+            to.executor = std::move(from.executor);
+            to.slot     = std::move(from.slot);
+            to.delivery = std::exchange(from.delivery,
+                                        stop_registration::no_delivery);
+            to.prev     = std::exchange(from.prev, nullptr);
+            to.next     = std::exchange(from.next, nullptr);
+            (to.prev ? to.prev->next : list_of(to)) = &to;
+            if (to.next)
+                to.next->prev = &to;
+            if (to.delivery != stop_registration::no_delivery)
+                deliveries_[to.delivery] = &to;
+        }
+
+        /// Deliver every connected slot, once. May be called on any thread.
+        ///
+        /// If a slot invoked here throws, the remaining slots are still
+        /// delivered, and then the first exception is rethrown.
+        void
+        stop()
+        {
+            auto lock = std::unique_lock(mutex_);
+            if (stopped_.exchange(true, std::memory_order_release))
+                return;
+
+            // Nothing is linked into the waiting list once stopped, so each
+            // slot is taken from its head. Slots which run here release the
+            // lock while they run, and may disconnect others.
+            deliveries_.reserve(waiting_count_);
+            auto error = std::exception_ptr();
+            while (head_)
             {
-                ++next_id_;
-                slots_.emplace(id, std::move(slot));
+                auto &r = *head_;
+                detach(r);
+                r.phase    = r.executor ? stop_registration::pending
+                                        : stop_registration::running;
+                r.delivery = deliveries_.size();
+                deliveries_.push_back(&r);
+                attach(r);
+
+                if (r.executor)
+                    net::post(r.executor,
+                              [self = boost::intrusive_ptr< stop_state >(this),
+                               d    = r.delivery] { self->deliver(d); });
+                else
+                    try
+                    {
+                        run(lock, r);
+                    }
+                    catch (...)
+                    {
+                        if (not error)
+                            error = std::current_exception();
+                    }
             }
-            return id;
+            if (error)
+                std::rethrow_exception(error);
         }
 
+      private:
+        /// Runs on the slot's executor
         void
-        disconnect(std::uint64_t id)
+        deliver(std::size_t d)
         {
-            slots_.erase(id);
+            auto lock = std::unique_lock(mutex_);
+            auto r    = deliveries_[d];
+            if (r and r->phase == stop_registration::pending)
+                run(lock, *r);
         }
 
+        /// Invoke a registration's slot without holding the lock, then unlink
+        /// it
         void
-        stop()
+        run(std::unique_lock< std::mutex > &lock, stop_registration &r)
         {
-            next_id_   = stopped_value;
-            auto slots = std::move(slots_);
-            slots_.clear();
-            for (auto &[id, slot] : slots)
+            r.phase   = stop_registration::running;
+            r.runner  = std::this_thread::get_id();
+            auto d    = r.delivery;
+            auto slot = std::move(r.slot);
+            lock.unlock();
+            try
             {
                 slot();
             }
+            catch (...)
+            {
+                lock.lock();
+                finish(d);
+                throw;
+            }
+            lock.lock();
+            finish(d);
         }
 
-        bool
-        stopped() const
+        void
+        finish(std::size_t d) noexcept
+        {
+            // the slot may have disconnected, or moved, itself
+            if (auto r = deliveries_[d])
+                unlink(*r);
+            finished_.notify_all();
+        }
+
+        /// The list a registration is in: waiting for stop, or being
+        /// delivered
+        stop_registration *&
+        list_of(stop_registration const &r) noexcept
         {
-            return next_id_ == stopped_value;
+            return r.phase == stop_registration::waiting ? head_ : delivering_;
+        }
+
+        void
+        link(stop_registration &r) noexcept
+        {
+            attach(r);
+        }
+
+        void
+        unlink(stop_registration &r) noexcept
+        {
+            detach(r);
+            if (r.delivery != stop_registration::no_delivery)
+                deliveries_[r.delivery] = nullptr;
+            r.delivery = stop_registration::no_delivery;
+            r.id       = 0;
+        }
+
+        /// Put a registration at the head of its list
+        void
+        attach(stop_registration &r) noexcept
+        {
+            auto &head = list_of(r);
+            r.prev     = nullptr;
+            r.next     = head;
+            if (head)
+                head->prev = &r;
+            head = &r;
+            if (r.phase == stop_registration::waiting)
+                ++waiting_count_;
+        }
+
+        /// Take a registration out of its list
+        void
+        detach(stop_registration &r) noexcept
+        {
+            (r.prev ? r.prev->next : list_of(r)) = r.next;
+            if (r.next)
+                r.next->prev = r.prev;
+            r.prev = r.next = nullptr;
+            if (r.phase == stop_registration::waiting)
+                --waiting_count_;
         }
 
       private:
-        std::uint64_t                                  next_id_ = 0;
-        std::unordered_map< std::uint64_t, stop_slot > slots_;
+        std::mutex              mutex_;
+        std::condition_variable finished_;
+        stop_registration *     head_          = nullptr;   // waiting
+        stop_registration *     delivering_    = nullptr;   // once stopped
+        std::size_t             waiting_count_ = 0;
+        std::uint64_t           next_id_       = 1;
+        std::atomic< bool >     stopped_ { false };
+
+        // Indexed by stop_registration::delivery. An entry is cleared when
+        // its registration is unlinked. Filled once, by stop().
+        std::vector< stop_registration * > deliveries_;
     };
-}}}   // namespace util::st::detail
\ No newline at end of file
+}}}   // namespace util::st::detail
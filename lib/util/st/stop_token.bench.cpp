@@ -0,0 +1,71 @@
+#include "util/st/stop_token.hpp"
+#include "util/testing/benchmark.hpp"
+
+#include <array>
+#include <boost/version.hpp>
+
+#if BOOST_VERSION >= 107700
+#include <boost/asio/cancellation_signal.hpp>
+#endif
+
+using beast_fun_times::util::testing::escape;
+
+UTIL_BENCHMARK("stop_token", "connect+disconnect")
+{
+    auto source = util::st::stop_source();
+    auto token  = source.make_token();
+    int  sink   = 0;
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        auto c = token.connect([&sink] { ++sink; });
+        c.disconnect();
+    }
+    escape(&sink);
+}
+
+UTIL_BENCHMARK("stop_token", "new source, connect 4, stop")
+{
+    int sink = 0;
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        auto source      = util::st::stop_source();
+        auto token       = source.make_token();
+        auto connections = std::array< util::st::stop_connection, 4 >();
+        for (std::size_t n = 0; n < 4; ++n)
+            connections[n] = token.connect([&sink] { ++sink; });
+        source.stop();
+    }
+    escape(&sink);
+}
+
+#if BOOST_VERSION >= 107700
+
+UTIL_BENCHMARK("cancel_signal", "assign+clear")
+{
+    auto signal = boost::asio::cancellation_signal();
+    int  sink   = 0;
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        signal.slot().assign([&sink](boost::asio::cancellation_type) {
+            ++sink;
+        });
+        signal.slot().clear();
+    }
+    escape(&sink);
+}
+
+UTIL_BENCHMARK("cancel_signal", "new signal, assign, emit")
+{
+    int sink = 0;
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        auto signal = boost::asio::cancellation_signal();
+        signal.slot().assign([&sink](boost::asio::cancellation_type) {
+            ++sink;
+        });
+        signal.emit(boost::asio::cancellation_type::terminal);
+    }
+    escape(&sink);
+}
+
+#endif
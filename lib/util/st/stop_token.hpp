@@ -2,38 +2,81 @@
 
 #include <util/st/detail/stop_token.hpp>
 
+#include <boost/version.hpp>
+#include <cassert>
+#include <type_traits>
+#include <utility>
+
+#if BOOST_VERSION >= 107700
+#include <boost/asio/bind_cancellation_slot.hpp>
+#include <boost/asio/cancellation_signal.hpp>
+#endif
+
 namespace util { namespace st {
 
     /// The stop_source and stop_token is a simple signal/slot device to
-    /// indicate
-    /// a one-time event. The slots are invoked on the same thread as the
-    /// signal.
+    /// indicate a one-time event.
+    ///
+    /// stop may be called on any thread. A slot with an associated executor
+    /// (see net::bind_executor) is invoked on that executor. Any other slot is
+    /// invoked on the thread which calls stop. Connecting and disconnecting
+    /// slots does not allocate.
 
     using stop_slot = detail::stop_slot;
     struct stop_source;
     struct stop_token;
 
+    /// A slot's connection to a stop_source. Destroying the connection
+    /// disconnects the slot.
     struct stop_connection
     {
-        void
-        disconnect()
+        stop_connection() = default;
+
+        stop_connection(stop_connection &&other) noexcept
+        : state_(std::move(other.state_))
         {
-            if (auto s = std::exchange(source_, {}))
-                s->disconnect(id_);
+            if (state_)
+                state_->relocate(reg_, other.reg_);
         }
 
-      private:
-        friend stop_token;
+        stop_connection &
+        operator=(stop_connection &&other) noexcept
+        {
+            if (this != &other)
+            {
+                disconnect();
+                state_ = std::move(other.state_);
+                if (state_)
+                    state_->relocate(reg_, other.reg_);
+            }
+            return *this;
+        }
+
+        ~stop_connection()
+        {
+            disconnect();
+        }
 
-        std::shared_ptr< detail::stop_source_impl > source_;
-        std::uint64_t                               id_;
+        /// Ensure that the slot will not be invoked. If it is running on
+        /// another thread, wait for it to finish.
+        void
+        disconnect() noexcept
+        {
+            if (auto s = std::exchange(state_, {}))
+                s->disconnect(reg_);
+        }
 
-        stop_connection(std::shared_ptr< detail::stop_source_impl > source,
-                        std::uint64_t                               id)
-        : source_(std::move(source))
-        , id_(id)
+        bool
+        connected() const noexcept
         {
+            return state_ != nullptr;
         }
+
+      private:
+        friend stop_token;
+
+        boost::intrusive_ptr< detail::stop_state > state_;
+        detail::stop_registration                  reg_;
     };
 
     struct stop_token
@@ -49,28 +92,43 @@ namespace util { namespace st {
             return source_ ? source_->stopped() : false;
         }
 
+        /// Connect a slot, to be invoked once when the source is stopped. If
+        /// the source has already been stopped, the slot is delivered at
+        /// once and the connection returned is empty.
+        template < class Slot >
         stop_connection
-        connect(stop_slot slot)
+        connect(Slot &&slot) const
         {
             assert(source_);
-            return stop_connection(source_, source_->connect(std::move(slot)));
+            using executor_type =
+                detail::net::associated_executor_t< std::decay_t< Slot > >;
+
+            auto c = stop_connection();
+            if constexpr (not std::is_same_v< executor_type,
+                                              detail::net::system_executor >)
+                c.reg_.executor = detail::net::get_associated_executor(slot);
+            c.reg_.slot = stop_slot(std::forward< Slot >(slot));
+            source_->connect(c.reg_);
+            if (c.reg_.id)
+                c.state_ = source_;
+            return c;
         }
 
       private:
         friend stop_source;
 
-        stop_token(std::shared_ptr< detail::stop_source_impl > source)
+        stop_token(boost::intrusive_ptr< detail::stop_state > source)
         : source_(std::move(source))
         {
         }
 
-        std::shared_ptr< detail::stop_source_impl > source_;
+        boost::intrusive_ptr< detail::stop_state > source_;
     };
 
     struct stop_source
     {
         stop_source()
-        : impl_(std::make_shared< detail::stop_source_impl >())
+        : impl_(new detail::stop_state())
         {
         }
 
@@ -88,7 +146,53 @@ namespace util { namespace st {
         }
 
       private:
-        std::shared_ptr< detail::stop_source_impl > impl_;
+        boost::intrusive_ptr< detail::stop_state > impl_;
+    };
+
+#if BOOST_VERSION >= 107700
+    /// Forwards a stop_token to asio's per-operation cancellation.
+    ///
+    /// When the token is stopped, the signal is emitted on the given
+    /// executor, which should be the one the bound operations run on. The
+    /// object must outlive those operations, so it cannot be moved.
+    class stop_cancellation
+    {
+      public:
+        template < class Executor >
+        stop_cancellation(stop_token const &             token,
+                          Executor const &               exec,
+                          detail::net::cancellation_type type =
+                              detail::net::cancellation_type::terminal)
+        : signal_()
+        , connection_(token.connect(detail::net::bind_executor(
+              exec, [this, type] { signal_.emit(type); })))
+        {
+        }
+
+        stop_cancellation(stop_cancellation const &) = delete;
+
+        stop_cancellation &
+        operator=(stop_cancellation const &) = delete;
+
+        detail::net::cancellation_slot
+        slot() noexcept
+        {
+            return signal_.slot();
+        }
+
+        /// Bind a completion token to this object's cancellation slot
+        template < class CompletionToken >
+        auto
+        bind(CompletionToken &&token)
+        {
+            return detail::net::bind_cancellation_slot(
+                slot(), std::forward< CompletionToken >(token));
+        }
+
+      private:
+        detail::net::cancellation_signal signal_;
+        stop_connection                  connection_;
     };
+#endif
 
-}}   // namespace util::st
\ No newline at end of file
+}}   // namespace util::st
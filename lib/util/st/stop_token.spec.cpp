@@ -0,0 +1,189 @@
+#include <catch2/catch.hpp>
+
+#include "util/st/stop_token.hpp"
+#include "util/testing/allocation_counter.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace beast_fun_times::util;
+
+TEST_CASE("util::st::stop_source")
+{
+    auto source = ::util::st::stop_source();
+    auto token  = source.make_token();
+    int  fired  = 0;
+
+    auto c1 = token.connect([&] { ++fired; });
+    auto c2 = token.connect([&] { fired += 10; });
+    CHECK(c1.connected());
+
+    SECTION("stop invokes every slot once")
+    {
+        source.stop();
+        CHECK(token.stopped());
+        CHECK(fired == 11);
+        source.stop();
+        CHECK(fired == 11);
+    }
+
+    SECTION("a disconnected slot is not invoked")
+    {
+        c2.disconnect();
+        CHECK_FALSE(c2.connected());
+        source.stop();
+        CHECK(fired == 1);
+    }
+
+    SECTION("a destroyed connection disconnects")
+    {
+        {
+            auto c3 = token.connect([&] { fired += 100; });
+        }
+        source.stop();
+        CHECK(fired == 11);
+    }
+
+    SECTION("a moved connection stays connected")
+    {
+        auto c3 = std::move(c2);
+        CHECK_FALSE(c2.connected());
+        CHECK(c3.connected());
+        auto c4 = ::util::st::stop_connection();
+        c4 = std::move(c3);
+        source.stop();
+        CHECK(fired == 11);
+    }
+
+    SECTION("connecting after stop invokes the slot at once")
+    {
+        source.stop();
+        auto c3 = token.connect([&] { fired += 100; });
+        CHECK_FALSE(c3.connected());
+        CHECK(fired == 111);
+    }
+}
+
+TEST_CASE("util::st::stop_source delivers slots on their executors")
+{
+    auto ioc    = net::io_context(1);
+    auto source = ::util::st::stop_source();
+    auto token  = source.make_token();
+    auto fired  = std::atomic< int >(0);
+    auto where  = std::thread::id();
+
+    auto c = token.connect(net::bind_executor(ioc.get_executor(), [&] {
+        where = std::this_thread::get_id();
+        ++fired;
+    }));
+
+    SECTION("stop on this thread")
+    {
+        source.stop();
+        CHECK(fired == 0);
+        ioc.run();
+        CHECK(fired == 1);
+        CHECK(where == std::this_thread::get_id());
+    }
+
+    SECTION("stop on another thread")
+    {
+        std::thread([&] { source.stop(); }).join();
+        CHECK(fired == 0);
+        ioc.run();
+        CHECK(fired == 1);
+        CHECK(where == std::this_thread::get_id());
+    }
+
+    SECTION("disconnecting suppresses a pending delivery")
+    {
+        source.stop();
+        c.disconnect();
+        ioc.run();
+        CHECK(fired == 0);
+    }
+
+    SECTION("a pending delivery follows a moved connection")
+    {
+        source.stop();
+        auto moved = std::move(c);
+        ioc.run();
+        CHECK(fired == 1);
+    }
+}
+
+TEST_CASE("util::st::stop_source delivers every slot when one throws")
+{
+    auto source = ::util::st::stop_source();
+    auto token  = source.make_token();
+    int  fired  = 0;
+
+    auto c1 = token.connect([&] { ++fired; });
+    auto c2 = token.connect([] { throw std::runtime_error("slot"); });
+    auto c3 = token.connect([&] { ++fired; });
+
+    CHECK_THROWS_AS(source.stop(), std::runtime_error);
+    CHECK(fired == 2);
+}
+
+TEST_CASE("util::st::stop_connection waits for a running slot")
+{
+    auto source   = ::util::st::stop_source();
+    auto token    = source.make_token();
+    auto entered  = std::atomic< bool >(false);
+    auto finished = std::atomic< bool >(false);
+
+    auto c = token.connect([&] {
+        entered = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        finished = true;
+    });
+
+    auto t = std::thread([&] { source.stop(); });
+    while (not entered)
+        std::this_thread::yield();
+    c.disconnect();
+    CHECK(finished);
+    t.join();
+}
+
+TEST_CASE("util::st::stop_token connects without allocating")
+{
+    using testing::allocations;
+
+    auto source = ::util::st::stop_source();
+    auto token  = source.make_token();
+    int  fired  = 0;
+
+    auto ioc    = net::io_context(1);
+    auto before = allocations();
+    for (int i = 0; i < 100; ++i)
+    {
+        auto c1 = token.connect([&] { ++fired; });
+        auto c2 = token.connect(
+            net::bind_executor(ioc.get_executor(), [&] { ++fired; }));
+        auto c3 = std::move(c1);
+    }
+    CHECK(allocations() == before);
+    CHECK(fired == 0);
+}
+
+#if BOOST_VERSION >= 107700
+TEST_CASE("util::st::stop_cancellation")
+{
+    auto ioc    = net::io_context(1);
+    auto source = ::util::st::stop_source();
+    auto timer  = net::steady_timer(ioc, std::chrono::hours(1));
+    auto cancel = ::util::st::stop_cancellation(source.make_token(),
+                                                ioc.get_executor());
+    auto error  = error_code();
+    timer.async_wait(cancel.bind([&](error_code ec) { error = ec; }));
+
+    std::thread([&] { source.stop(); }).join();
+    ioc.run();
+    CHECK(error == net::error::operation_aborted);
+}
+#endif
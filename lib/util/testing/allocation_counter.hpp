@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+
+namespace beast_fun_times::util::testing
+{
+    /// The number of heap allocations made so far by the calling thread.
+    ///
+    /// Only meaningful in a program which includes allocation_counter_src.hpp,
+    /// which replaces the global operator new. Compare two readings to find
+    /// out how many allocations a piece of code made.
+    std::size_t
+    allocations() noexcept;
+
+    /// The number of heap allocations made so far by every thread
+    std::size_t
+    total_allocations() noexcept;
+
+}   // namespace beast_fun_times::util::testing
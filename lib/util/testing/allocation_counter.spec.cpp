@@ -0,0 +1,28 @@
+#include <catch2/catch.hpp>
+
+#include "util/testing/allocation_counter_src.hpp"
+
+#include <memory>
+#include <thread>
+
+TEST_CASE("util::testing::allocations")
+{
+    using namespace beast_fun_times::util::testing;
+
+    auto before       = allocations();
+    auto total_before = total_allocations();
+    auto p            = std::make_unique< int >(42);
+    CHECK(allocations() == before + 1);
+    p.reset();
+    CHECK(allocations() == before + 1);
+
+    // each thread has its own count, and the total counts every thread
+    std::size_t            other = 0;
+    std::unique_ptr< int > q;
+    std::thread([&other, &q] {
+        q     = std::make_unique< int >(43);
+        other = allocations();
+    }).join();
+    CHECK(other == 1);
+    CHECK(total_allocations() >= total_before + 2);
+}
@@ -0,0 +1,91 @@
+#pragma once
+// Replaces the global allocation functions with ones which count.
+//
+// Include this file in exactly one translation unit of a test or benchmark
+// program. Never include it in a library or an application.
+#include "util/testing/allocation_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace beast_fun_times::util::testing
+{
+    namespace
+    {
+        thread_local std::size_t   allocation_count = 0;
+        std::atomic< std::size_t > total_allocation_count { 0 };
+
+        void *
+        counted_allocate(std::size_t size, std::size_t align)
+        {
+            ++allocation_count;
+            total_allocation_count.fetch_add(1, std::memory_order_relaxed);
+            if (size == 0)
+                size = 1;
+            void *p = nullptr;
+            if (align <= alignof(std::max_align_t))
+                p = std::malloc(size);
+            else if (::posix_memalign(&p, align, size) != 0)
+                p = nullptr;
+            if (not p)
+                throw std::bad_alloc();
+            return p;
+        }
+    }   // namespace
+
+    std::size_t
+    allocations() noexcept
+    {
+        return allocation_count;
+    }
+
+    std::size_t
+    total_allocations() noexcept
+    {
+        return total_allocation_count.load(std::memory_order_relaxed);
+    }
+
+}   // namespace beast_fun_times::util::testing
+
+// The array and nothrow forms of the replaceable allocation functions are
+// specified in terms of these, so replacing these is enough to see
+// everything.
+
+void *
+operator new(std::size_t size)
+{
+    return beast_fun_times::util::testing::counted_allocate(
+        size, alignof(std::max_align_t));
+}
+
+void *
+operator new(std::size_t size, std::align_val_t align)
+{
+    return beast_fun_times::util::testing::counted_allocate(
+        size, static_cast< std::size_t >(align));
+}
+
+void
+operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void
+operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void
+operator delete(void *p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void
+operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
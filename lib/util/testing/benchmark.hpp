@@ -0,0 +1,145 @@
+#pragma once
+#include "util/testing/allocation_counter.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace beast_fun_times::util::testing
+{
+    /// The body of a benchmark. It must perform the operation being measured
+    /// exactly `iterations` times.
+    using benchmark_body = void (*)(std::size_t iterations);
+
+    struct benchmark_result
+    {
+        std::size_t              iterations  = 0;
+        std::chrono::nanoseconds elapsed     = {};
+        std::size_t              allocations = 0;
+        std::size_t              bytes       = 0;
+
+        double
+        ns_per_op() const noexcept
+        {
+            return iterations ? double(elapsed.count()) / double(iterations)
+                              : 0.0;
+        }
+
+        double
+        allocations_per_op() const noexcept
+        {
+            return iterations ? double(allocations) / double(iterations)
+                              : 0.0;
+        }
+
+        double
+        bytes_per_op() const noexcept
+        {
+            return iterations ? double(bytes) / double(iterations) : 0.0;
+        }
+    };
+
+    /// Bytes produced by the benchmark being run, for benchmarks which trade
+    /// time for size. A body adds what it produces; the count is reset
+    /// before each run.
+    inline std::size_t &
+    benchmark_bytes() noexcept
+    {
+        static std::size_t bytes = 0;
+        return bytes;
+    }
+
+    /// Stop the optimiser from discarding the computation of *p
+    inline void
+    escape(void const *p) noexcept
+    {
+#if defined(__GNUC__)
+        asm volatile("" : : "g"(p) : "memory");
+#else
+        static void const *volatile sink;
+        sink = p;
+#endif
+    }
+
+    struct benchmark_case
+    {
+        std::string    group;
+        std::string    name;
+        benchmark_body body;
+    };
+
+    /// Every benchmark registered in this program
+    inline std::vector< benchmark_case > &
+    benchmark_registry()
+    {
+        static std::vector< benchmark_case > cases;
+        return cases;
+    }
+
+    struct benchmark_registrar
+    {
+        benchmark_registrar(char const *   group,
+                            char const *   name,
+                            benchmark_body body)
+        {
+            benchmark_registry().push_back({ group, name, body });
+        }
+    };
+
+    /// Run a benchmark body, increasing the number of iterations until a run
+    /// takes at least min_time, and measure that run.
+    ///
+    /// Allocations are counted across all threads, so a benchmark which uses
+    /// helper threads is charged for their allocations too.
+    inline benchmark_result
+    run_benchmark(
+        benchmark_body           body,
+        std::chrono::nanoseconds min_time = std::chrono::milliseconds(200))
+    {
+        using clock = std::chrono::steady_clock;
+
+        // warm up caches, pools and recyclers
+        body(1000);
+
+        std::size_t iterations = 1000;
+        for (;;)
+        {
+            benchmark_bytes() = 0;
+            auto allocs       = total_allocations();
+            auto start        = clock::now();
+            body(iterations);
+            auto elapsed = clock::now() - start;
+            allocs       = total_allocations() - allocs;
+
+            if (elapsed >= min_time or iterations >= (std::size_t(1) << 40))
+                return benchmark_result {
+                    iterations, elapsed, allocs, benchmark_bytes()
+                };
+
+            // aim a little past min_time, but never grow by more than 10x
+            auto scale = elapsed.count()
+                             ? double(min_time.count()) * 1.2 /
+                                   double(elapsed.count())
+                             : 10.0;
+            iterations = std::size_t(
+                double(iterations) * std::min(std::max(scale, 1.5), 10.0));
+        }
+    }
+
+}   // namespace beast_fun_times::util::testing
+
+#define UTIL_BENCHMARK_CAT2(a, b) a##b
+#define UTIL_BENCHMARK_CAT(a, b) UTIL_BENCHMARK_CAT2(a, b)
+
+/// Define and register a benchmark. The body that follows is a function of
+/// `std::size_t iterations`, which must perform the operation being measured
+/// that many times.
+#define UTIL_BENCHMARK(group, name)                                           \
+    static void UTIL_BENCHMARK_CAT(util_benchmark_, __LINE__)(std::size_t);   \
+    static ::beast_fun_times::util::testing::benchmark_registrar              \
+        UTIL_BENCHMARK_CAT(util_benchmark_registrar_, __LINE__)(              \
+            group, name, &UTIL_BENCHMARK_CAT(util_benchmark_, __LINE__));     \
+    static void UTIL_BENCHMARK_CAT(util_benchmark_, __LINE__)(                \
+        [[maybe_unused]] std::size_t iterations)
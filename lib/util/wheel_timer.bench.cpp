@@ -0,0 +1,77 @@
+#include "util/testing/benchmark.hpp"
+#include "util/wheel_timer.hpp"
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace beast_fun_times::util;
+using namespace std::literals;
+
+namespace
+{
+    /// The number of other timers waiting, as on a server with that many
+    /// connections
+    constexpr std::size_t population = 100000;
+
+    /// A population of waiting timers, made once and kept for every run
+    template < class Timer >
+    struct population_of
+    {
+        population_of()
+        {
+            timers.reserve(population);
+            for (std::size_t i = 0; i < population; ++i)
+            {
+                auto &t = *timers.emplace_back(
+                    std::make_unique< Timer >(ioc.get_executor()));
+                t.expires_after(std::chrono::seconds(10 + rng() % 50));
+                t.async_wait([](error_code) {});
+            }
+        }
+
+        static population_of &
+        instance()
+        {
+            static population_of p;
+            return p;
+        }
+
+        net::io_context                         ioc { 1 };
+        std::mt19937                            rng { 1 };
+        std::vector< std::unique_ptr< Timer > > timers;
+    };
+
+    /// Re-arm timers picked at random from a population which are all
+    /// waiting, as session and ping timers do. Each iteration cancels one
+    /// wait and starts another, from within the io_context as a server's
+    /// handlers would, and runs the cancelled wait's completion.
+    template < class Timer >
+    void
+    rearm(std::size_t iterations)
+    {
+        auto &p    = population_of< Timer >::instance();
+        auto  step = [&p](auto &self, std::size_t remaining) -> void {
+            auto &t = *p.timers[p.rng() % population];
+            t.expires_after(std::chrono::seconds(10 + p.rng() % 50));
+            t.async_wait([](error_code) {});
+            if (--remaining)
+                net::post(p.ioc, [&self, remaining] { self(self, remaining); });
+        };
+        net::post(p.ioc, [&step, iterations] { step(step, iterations); });
+        p.ioc.restart();
+        while (p.ioc.poll())
+            ;
+    }
+}   // namespace
+
+UTIL_BENCHMARK("timers", "steady_timer, re-arm among 100k")
+{
+    rearm< net::steady_timer >(iterations);
+}
+
+UTIL_BENCHMARK("timers", "wheel_timer, re-arm among 100k")
+{
+    rearm< wheel_timer >(iterations);
+}
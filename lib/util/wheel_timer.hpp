@@ -0,0 +1,328 @@
+#pragma once
+#include "util/detail/timing_wheel.hpp"
+#include "util/net.hpp"
+#include "util/poly_handler.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace beast_fun_times::util
+{
+    /// One timing wheel, and one asio timer to drive it, shared by every
+    /// wheel_timer in an execution context.
+    ///
+    /// With many thousands of long, coarse timers, such as session timeouts
+    /// and keepalive pings, asio's own timer queue pays O(log n) to arm or
+    /// cancel each one. On the wheel those are O(1). Expiries are rounded up
+    /// to the next tick, so timers which expire close together fire
+    /// together, and the underlying asio timer is armed only for ticks at
+    /// which something happens.
+    ///
+    /// Thread-safe: the wheel is guarded by a mutex, which is held only to
+    /// link, unlink or expire entries. Completions are always posted to the
+    /// waiting handler's associated executor.
+    class timing_wheel_service : public net::execution_context::service
+    {
+      public:
+        using clock_type = std::chrono::steady_clock;
+
+        /// The wheel's resolution. Timers fire up to one tick late, never
+        /// early.
+        static constexpr clock_type::duration tick =
+            std::chrono::milliseconds(10);
+
+        static inline net::execution_context::id id;
+
+        explicit timing_wheel_service(net::execution_context &ctx)
+        : net::execution_context::service(ctx)
+        , epoch_(clock_type::now())
+        {
+        }
+
+        /// A wait on the wheel, embedded in a wheel_timer
+        struct entry : detail::wheel_entry
+        {
+            poly_handler< void(error_code) > handler;
+            net::any_io_executor             executor;
+        };
+
+        /// Wait for an entry to reach its expiry. The entry must not be
+        /// waiting already. driver is an executor on this service's context,
+        /// for the underlying timer if it has not been made yet, and the
+        /// handler's executor if it has none of its own.
+        template < class Handler >
+        void
+        wait(entry &                     e,
+             clock_type::time_point      expiry,
+             net::any_io_executor const &driver,
+             Handler &&                  handler)
+        {
+            auto hexec  = net::get_associated_executor(handler, driver);
+            auto stored = poly_handler< void(error_code) >(
+                [wg = net::prefer(hexec,
+                                  net::execution::outstanding_work.tracked),
+                 h  = std::forward< Handler >(handler)](error_code ec) mutable {
+                    h(ec);
+                });
+
+            auto lock = std::lock_guard(mutex_);
+            if (not timer_)
+                timer_.emplace(driver);
+
+            // an idle wheel may have fallen behind the clock. A busy one is
+            // kept up to date by its timer.
+            if (wheel_.empty())
+                wheel_.advance(ticks(clock_type::now()),
+                               [](detail::wheel_entry &) {});
+            e.handler  = std::move(stored);
+            e.executor = hexec;
+            wheel_.schedule(e, ticks_ceil(expiry));
+            arm();
+        }
+
+        /// Cancel an entry's wait, which completes with operation_aborted.
+        /// Returns the number of waits cancelled.
+        std::size_t
+        cancel(entry &e)
+        {
+            auto lock = std::lock_guard(mutex_);
+            if (not wheel_.cancel(e))
+                return 0;
+            complete(e, net::error::operation_aborted);
+
+            // an idle wheel must not keep its context running
+            if (wheel_.empty() and armed_)
+            {
+                armed_.reset();
+                timer_->cancel();
+            }
+            return 1;
+        }
+
+        /// The number of waits on the wheel
+        std::size_t
+        size() const
+        {
+            auto lock = std::lock_guard(mutex_);
+            return wheel_.size();
+        }
+
+        /// The number of times the underlying timer has fired
+        std::uint64_t
+        wakeups() const
+        {
+            auto lock = std::lock_guard(mutex_);
+            return wakeups_;
+        }
+
+      private:
+        void
+        shutdown() override
+        {
+            // as asio does, destroy waiting handlers without invoking them.
+            // Destroying a handler may destroy other timers, so it is done
+            // without the lock.
+            auto handlers = std::vector< poly_handler< void(error_code) > >();
+            {
+                auto lock = std::lock_guard(mutex_);
+                wheel_.clear([&handlers](detail::wheel_entry &e) {
+                    auto &en = static_cast< entry & >(e);
+                    handlers.push_back(std::move(en.handler));
+                    en.executor = {};
+                });
+                armed_.reset();
+            }
+            handlers.clear();
+            timer_.reset();
+        }
+
+        std::uint64_t
+        ticks(clock_type::time_point t) const noexcept
+        {
+            return t <= epoch_ ? 0 : std::uint64_t((t - epoch_) / tick);
+        }
+
+        std::uint64_t
+        ticks_ceil(clock_type::time_point t) const noexcept
+        {
+            if (t <= epoch_)
+                return 0;
+            return std::uint64_t((t - epoch_ + tick - clock_type::duration(1)) /
+                                 tick);
+        }
+
+        /// Post an entry's completion. Called with the lock held.
+        void
+        complete(entry &e, error_code ec)
+        {
+            net::post(net::bind_executor(
+                std::exchange(e.executor, {}),
+                [h = std::move(e.handler), ec]() mutable { h(ec); }));
+        }
+
+        /// Make sure the underlying timer will fire by the wheel's next tick.
+        /// Called with the lock held.
+        void
+        arm()
+        {
+            auto next = wheel_.next_tick();
+            if (not next or (armed_ and *armed_ <= *next))
+                return;
+
+            // re-arming cancels any wait in progress, which will find that
+            // its generation is out of date
+            armed_ = next;
+            timer_->expires_at(epoch_ + *next * tick);
+            timer_->async_wait(
+                [this, generation = ++generation_](error_code ec) {
+                    on_timer(ec, generation);
+                });
+        }
+
+        void
+        on_timer(error_code ec, std::uint64_t generation)
+        {
+            auto lock = std::lock_guard(mutex_);
+            if (ec == net::error::operation_aborted or
+                generation != generation_)
+                return;
+            ++wakeups_;
+            armed_.reset();
+            expire_due();
+            arm();
+        }
+
+        /// Complete every wait whose expiry has been reached. Called with the
+        /// lock held.
+        void
+        expire_due()
+        {
+            wheel_.advance(ticks(clock_type::now()),
+                           [this](detail::wheel_entry &e) {
+                               complete(static_cast< entry & >(e),
+                                        error_code());
+                           });
+        }
+
+        mutable std::mutex                 mutex_;
+        clock_type::time_point const       epoch_;
+        detail::timing_wheel               wheel_;
+        std::optional< net::steady_timer > timer_;
+        std::optional< std::uint64_t >     armed_;
+        std::uint64_t                      generation_ = 0;
+        std::uint64_t                      wakeups_    = 0;
+    };
+
+    /// A timer on its execution context's timing wheel.
+    ///
+    /// It has the interface of asio's waitable timers, for waits that can
+    /// tolerate firing up to timing_wheel_service::tick late: arming and
+    /// cancelling are O(1) however many timers there are. async_wait takes
+    /// any completion token, so a coroutine can co_await it.
+    ///
+    /// One wait at a time. Setting the expiry cancels a wait in progress, as
+    /// does destroying the timer.
+    template < class Executor = net::any_io_executor >
+    class basic_wheel_timer
+    {
+      public:
+        using executor_type = Executor;
+        using clock_type    = timing_wheel_service::clock_type;
+        using duration      = clock_type::duration;
+        using time_point    = clock_type::time_point;
+
+        template < class OtherExec >
+        struct rebind_executor
+        {
+            using other = basic_wheel_timer< OtherExec >;
+        };
+
+        explicit basic_wheel_timer(executor_type const &exec)
+        : exec_(exec)
+        , service_(&net::use_service< timing_wheel_service >(
+              net::query(exec, net::execution::context)))
+        {
+        }
+
+        basic_wheel_timer(basic_wheel_timer const &) = delete;
+
+        basic_wheel_timer &
+        operator=(basic_wheel_timer const &) = delete;
+
+        ~basic_wheel_timer()
+        {
+            cancel();
+        }
+
+        executor_type
+        get_executor() const noexcept
+        {
+            return exec_;
+        }
+
+        time_point
+        expiry() const noexcept
+        {
+            return expiry_;
+        }
+
+        /// Set the expiry, cancelling any wait in progress. Returns the
+        /// number of waits cancelled.
+        std::size_t
+        expires_at(time_point t)
+        {
+            auto n  = cancel();
+            expiry_ = t;
+            return n;
+        }
+
+        std::size_t
+        expires_after(duration d)
+        {
+            return expires_at(clock_type::now() + d);
+        }
+
+        /// Cancel the wait in progress, if any, which completes with
+        /// operation_aborted. Returns the number of waits cancelled.
+        std::size_t
+        cancel()
+        {
+            return service_->cancel(entry_);
+        }
+
+        /// Wait until the expiry.
+        /// Signature: void(error_code)
+        template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code))
+                       WaitHandler = net::default_completion_token_t<
+                           executor_type > >
+        BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler, void(error_code))
+        async_wait(WaitHandler &&handler =
+                       net::default_completion_token_t< executor_type >())
+        {
+            return net::async_initiate< WaitHandler, void(error_code) >(
+                [this](auto &&deduced_handler) {
+                    service_->wait(
+                        entry_,
+                        expiry_,
+                        net::any_io_executor(exec_),
+                        std::forward< decltype(deduced_handler) >(
+                            deduced_handler));
+                },
+                handler);
+        }
+
+      private:
+        executor_type               exec_;
+        timing_wheel_service *      service_;
+        timing_wheel_service::entry entry_;
+        time_point                  expiry_;
+    };
+
+    using wheel_timer = basic_wheel_timer<>;
+
+}   // namespace beast_fun_times::util
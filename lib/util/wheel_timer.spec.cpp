@@ -0,0 +1,161 @@
+#include <catch2/catch.hpp>
+
+#include "util/detail/timing_wheel.hpp"
+#include "util/wheel_timer.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace beast_fun_times::util;
+using namespace std::literals;
+
+TEST_CASE("util::detail::timing_wheel")
+{
+    auto wheel   = detail::timing_wheel();
+    auto rng     = std::mt19937(7);
+    auto entries = std::vector< detail::wheel_entry >(2000);
+
+    // expiries at every level, and some beyond the top one
+    auto expected = std::vector< std::uint64_t >(entries.size());
+    for (std::size_t i = 0; i < entries.size(); ++i)
+    {
+        auto span   = std::uint64_t(1) << (6 * (i % 5) + 6);
+        expected[i] = 1 + rng() % span;
+        wheel.schedule(entries[i], expected[i]);
+    }
+    CHECK(wheel.size() == entries.size());
+
+    // cancel every seventh
+    for (std::size_t i = 0; i < entries.size(); i += 7)
+    {
+        CHECK(wheel.cancel(entries[i]));
+        CHECK(not wheel.cancel(entries[i]));
+    }
+
+    auto fired = std::vector< bool >(entries.size());
+    auto last  = std::uint64_t(0);
+    while (not wheel.empty())
+    {
+        auto next = wheel.next_tick();
+        REQUIRE(next);
+        REQUIRE(*next > wheel.now());
+
+        // advance in uneven steps, sometimes past the next event
+        auto to = wheel.now() + 1 + rng() % (rng() % 2 ? 64 : 100000);
+        wheel.advance(to, [&](detail::wheel_entry &e) {
+            auto i = std::size_t(&e - entries.data());
+            CHECK(not e.scheduled());
+            CHECK(e.expiry == expected[i]);
+            CHECK(e.expiry <= wheel.now());
+            CHECK(e.expiry >= last);
+            last     = e.expiry;
+            fired[i] = true;
+        });
+    }
+
+    for (std::size_t i = 0; i < entries.size(); ++i)
+        CHECK(fired[i] == (i % 7 != 0));
+}
+
+TEST_CASE("util::detail::timing_wheel skips quiet ticks")
+{
+    auto wheel = detail::timing_wheel();
+    auto e     = detail::wheel_entry();
+    wheel.schedule(e, 1000000);
+
+    // a wake at each cycle of level 0, rather than at each tick
+    auto wakes = 0;
+    while (not wheel.empty())
+    {
+        ++wakes;
+        wheel.advance(*wheel.next_tick(), [](detail::wheel_entry &) {});
+    }
+    CHECK(wheel.now() == 1000000);
+    CHECK(wakes <= 1000000 / 64 + 1);
+
+    // an expiry which has passed fires at the next tick
+    wheel.schedule(e, 5);
+    CHECK(e.expiry == wheel.now() + 1);
+}
+
+TEST_CASE("util::wheel_timer")
+{
+    auto ioc = net::io_context(1);
+
+    SECTION("timers fire at or after their expiry, never before")
+    {
+        auto start  = wheel_timer::clock_type::now();
+        auto timers = std::vector< std::unique_ptr< wheel_timer > >();
+        auto late   = std::vector< wheel_timer::duration >();
+        for (int i = 0; i < 10; ++i)
+        {
+            auto &t = *timers.emplace_back(
+                std::make_unique< wheel_timer >(ioc.get_executor()));
+            t.expires_after(std::chrono::milliseconds(5 * i));
+            t.async_wait([&, expiry = t.expiry()](error_code ec) {
+                CHECK(not ec);
+                late.push_back(wheel_timer::clock_type::now() - expiry);
+            });
+        }
+        ioc.run();
+        REQUIRE(late.size() == 10);
+        for (auto l : late)
+            CHECK(l >= 0ms);
+        CHECK(wheel_timer::clock_type::now() - start < 1s);
+    }
+
+    SECTION("cancelled and re-armed waits complete with operation_aborted")
+    {
+        auto t  = wheel_timer(ioc.get_executor());
+        auto ec = std::vector< error_code >();
+        t.expires_after(1h);
+        t.async_wait([&](error_code e) { ec.push_back(e); });
+        CHECK(t.expires_after(1h) == 1);
+        t.async_wait([&](error_code e) { ec.push_back(e); });
+        CHECK(t.cancel() == 1);
+        CHECK(t.cancel() == 0);
+
+        // and an idle wheel does not keep the context running
+        auto start = wheel_timer::clock_type::now();
+        ioc.run();
+        CHECK(wheel_timer::clock_type::now() - start < 1s);
+        CHECK(ec == std::vector< error_code >(2, net::error::operation_aborted));
+    }
+
+    SECTION("expiries close together share a wakeup")
+    {
+        auto &service = net::use_service< timing_wheel_service >(ioc);
+        auto  before  = service.wakeups();
+        auto  timers  = std::vector< std::unique_ptr< wheel_timer > >();
+        auto  fired   = 0;
+        auto  expiry  = wheel_timer::clock_type::now() + 30ms;
+        for (int i = 0; i < 1000; ++i)
+        {
+            auto &t = *timers.emplace_back(
+                std::make_unique< wheel_timer >(ioc.get_executor()));
+            t.expires_at(expiry + std::chrono::microseconds(i));
+            t.async_wait([&](error_code ec) {
+                CHECK(not ec);
+                ++fired;
+            });
+        }
+        CHECK(service.size() == 1000);
+        ioc.run();
+        CHECK(fired == 1000);
+        CHECK(service.wakeups() - before <= 2);
+    }
+
+    SECTION("completions go to the handler's executor")
+    {
+        auto strand = net::make_strand(ioc);
+        auto t      = basic_wheel_timer< decltype(strand) >(strand);
+        auto on     = false;
+        t.expires_after(1ms);
+        t.async_wait([&](error_code) { on = strand.running_in_this_thread(); });
+        ioc.run();
+        CHECK(on);
+    }
+}
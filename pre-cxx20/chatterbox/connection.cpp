@@ -1,5 +1,7 @@
 #include "connection.hpp"
 
+#include "util/log.hpp"
+
 #include <iostream>
 
 namespace project
@@ -14,15 +16,15 @@ namespace project
     , delay_timer_(exec)
     {
         auto ep = net::ip::tcp::endpoint(net::ip::address_v4::any(), 0);
-        stream_.next_layer().open(ep.protocol());
+        beast::get_lowest_layer(stream_).open(ep.protocol());
 
         // this is so the socket will actually have a local endpoint
-        stream_.next_layer().bind(ep);
+        beast::get_lowest_layer(stream_).bind(ep);
     }
 
     auto connection_impl::get_executor() -> net::any_io_executor { return stream_.get_executor(); }
 
-    auto connection_impl::local_endpoint() -> net::ip::tcp::endpoint { return stream_.next_layer().local_endpoint(); }
+    auto connection_impl::local_endpoint() -> net::ip::tcp::endpoint { return beast::get_lowest_layer(stream_).local_endpoint(); }
 
     void connection_impl::run()
     {
@@ -31,7 +33,7 @@ namespace project
 
     void connection_impl::handle_run()
     {
-        stream_.next_layer().async_connect(
+        beast::get_lowest_layer(stream_).async_connect(
             server_endpoint,
             net::bind_executor(get_executor(), [self = shared_from_this()](error_code ec) {
                 self->handle_connect(ec);
@@ -91,15 +93,16 @@ namespace project
                 std::cout << "result of close: " << ec.message() << std::endl;
             });
         else
-            stream_.next_layer().cancel();
+            beast::get_lowest_layer(stream_).cancel();
     }
     void connection_impl::initiate_rx()
     {
         assert(state_ == chatting);
         assert(!ec_);
-        stream_.async_read(rxbuffer_, [self = this->shared_from_this()](error_code ec, std::size_t bytes_transferred) {
-            self->handle_rx(ec, bytes_transferred);
-        });
+        beast_fun_times::util::async_read_message(
+            stream_, rxbuffer_, [self = this->shared_from_this()](error_code ec, std::size_t bytes_transferred) {
+                self->handle_rx(ec, bytes_transferred);
+            });
     }
     void connection_impl::handle_rx(error_code ec, std::size_t bytes_transferred)
     {
@@ -111,8 +114,9 @@ namespace project
         {
             // handle the read here
             auto message = beast::buffers_to_string(rxbuffer_.data());
-            std::cout << local_endpoint() << " received: " << message << "\n";
+            UTIL_LOG_TRACE(local_endpoint().port(), " received: ", message);
             rxbuffer_.consume(message.size());
+            rxbuffer_.hibernate();
 
             // keep reading until error
             initiate_rx();
@@ -143,6 +147,10 @@ namespace project
         assert(!ec_);
         assert(!tx_queue_.empty());
 
+        // more than one message waiting: send their frames together when the queue runs dry
+        if (tx_queue_.size() > 1)
+            stream_.next_layer().cork();
+
         sending_state_ = sending;
         stream_.async_write(net::buffer(tx_queue_.front()), [self = shared_from_this()](error_code ec, std::size_t) {
             // we don't care about bytes_transferred
@@ -159,6 +167,28 @@ namespace project
         {
             tx_queue_.pop();
             sending_state_ = send_idle;
+        }
+
+        // flush the staged frames once the batch is done, even on error, as a close frame may be staged behind them
+        if (stream_.next_layer().corked() && (ec || ec_ || tx_queue_.empty()))
+            initiate_uncork();
+        else if (!ec)
+            maybe_send_next();
+    }
+    void connection_impl::initiate_uncork()
+    {
+        sending_state_ = sending;
+        stream_.next_layer().async_uncork([self = shared_from_this()](error_code ec) { self->handle_uncork(ec); });
+    }
+    void connection_impl::handle_uncork(error_code ec)
+    {
+        if (ec)
+        {
+            std::cout << "failed to send messages because " << ec.message() << std::endl;
+        }
+        else
+        {
+            sending_state_ = send_idle;
             maybe_send_next();
         }
     }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "config.hpp"
+#include "util/coalescing_stream.hpp"
+#include "util/hibernating_buffer.hpp"
 
 #include <deque>
 #include <memory>
@@ -10,7 +12,7 @@ namespace project {
 struct connection_impl : std::enable_shared_from_this< connection_impl >
 {
     using transport = net::ip::tcp::socket;
-    using stream    = websocket::stream< transport >;
+    using stream    = websocket::stream< beast_fun_times::util::coalescing_stream< transport > >;
 
     connection_impl(net::any_io_executor exec);
 
@@ -57,12 +59,17 @@ struct connection_impl : std::enable_shared_from_this< connection_impl >
     initiate_tx();
     void
     handle_tx(error_code ec);
+    void
+    initiate_uncork();
+    void
+    handle_uncork(error_code ec);
 
   private:
     stream            stream_;
     net::system_timer delay_timer_;
 
-    beast::flat_buffer rxbuffer_;
+    // borrows from the buffer pool per message
+    beast_fun_times::util::hibernating_buffer rxbuffer_;
 
     // elements in a std deque have a stable address, so this means we don't
     // need t make copies of messages
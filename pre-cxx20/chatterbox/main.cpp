@@ -1,5 +1,6 @@
 #include "config.hpp"
 #include "app.hpp"
+#include "util/log.hpp"
 
 #include <iostream>
 
@@ -7,6 +8,9 @@ int main()
 {
     using namespace project;
 
+    // per-message logging is at trace level: LOG_LEVEL=trace to see it
+    beast_fun_times::util::log_sink::instance().set_level_from_env();
+
     net::io_context ioc;
 
     auto the_app = app(ioc.get_executor());
@@ -1,6 +1,12 @@
 #include "connection.hpp"
 
+#include "util/log.hpp"
+#include "util/message_builder.hpp"
+#include "util/metrics_response.hpp"
+#include "util/server_metrics.hpp"
+
 #include <iostream>
+#include <utility>
 
 namespace project {
 
@@ -13,6 +19,21 @@ connection_impl::connection_impl(net::ip::tcp::socket sock)
 {
 }
 
+connection_impl::~connection_impl()
+{
+    auto &metrics = beast_fun_times::util::server_metrics::local();
+    metrics.closed.add();
+    metrics.queued.add(-std::int64_t(tx_queue_.size()));
+    if (on_close_)
+        on_close_();
+}
+
+void
+connection_impl::on_close(beast_fun_times::util::poly_handler< void() > f)
+{
+    on_close_ = std::move(f);
+}
+
 void
 connection_impl::run()
 {
@@ -23,15 +44,56 @@ connection_impl::run()
 void
 connection_impl::handle_run()
 {
-    stream_.async_accept([self = this->shared_from_this()](error_code ec) {
-        self->handle_accept(ec);
-    });
+    request_.emplace();
+    request_->body_limit(beast_fun_times::util::max_http_request_body);
+    http::async_read(stream_.next_layer(),
+                     rxbuffer_,
+                     *request_,
+                     [self = this->shared_from_this()](error_code ec,
+                                                       std::size_t) {
+                         self->handle_request(ec);
+                     });
 
     initiate_timer();
 }
+
+void
+connection_impl::handle_request(error_code ec)
+{
+    if (ec_)
+    {
+        // we've been stopped
+    }
+    else if (ec)
+    {
+        // connection error
+        beast_fun_times::util::server_metrics::local()
+            .handshake_failures.add();
+        session_timer_.cancel();
+    }
+    else if (!websocket::is_upgrade(request_->get()))
+    {
+        // a plain HTTP request, such as a metrics scrape
+        session_timer_.cancel();
+        initiate_http_response();
+    }
+    else
+    {
+        // a websocket client sends nothing more until it has the handshake
+        // response, so there is nothing in the buffer for the websocket
+        rxbuffer_.consume(rxbuffer_.size());
+        rxbuffer_.hibernate();
+        stream_.async_accept(request_->get(),
+                             [self = this->shared_from_this()](error_code ec) {
+                                 self->handle_accept(ec);
+                             });
+    }
+}
+
 void
 connection_impl::handle_accept(error_code ec)
 {
+    request_.reset();
     if (ec_)
     {
         // we've been stopped
@@ -39,6 +101,9 @@ connection_impl::handle_accept(error_code ec)
     else if (ec)
     {
         // connection error
+        beast_fun_times::util::server_metrics::local()
+            .handshake_failures.add();
+        session_timer_.cancel();
     }
     else
     {
@@ -48,6 +113,33 @@ connection_impl::handle_accept(error_code ec)
         maybe_send_next();
     }
 }
+void
+connection_impl::initiate_http_response()
+{
+    // the response must live until the write completes
+    auto response =
+        std::make_shared< http::response< http::string_body > >(
+            beast_fun_times::util::metrics_response(
+                request_->get(),
+                beast_fun_times::util::server_metrics::instance().snapshot()));
+    http::async_write(stream_.next_layer(),
+                      *response,
+                      [self = shared_from_this(),
+                       response](error_code ec, std::size_t) {
+                          self->handle_http_response(ec);
+                      });
+}
+
+void
+connection_impl::handle_http_response(error_code ec)
+{
+    // one request per connection: the connection is done when this handler
+    // lets it go
+    if (!ec)
+        beast::get_lowest_layer(stream_).shutdown(
+            net::socket_base::shutdown_send, ec);
+}
+
 void
 connection_impl::stop()
 {
@@ -57,6 +149,20 @@ connection_impl::stop()
         }));
 }
 
+void
+connection_impl::abort()
+{
+    net::dispatch(
+        net::bind_executor(stream_.get_executor(), [self = shared_from_this()] {
+            if (!self->ec_)
+                self->ec_ = net::error::operation_aborted;
+            self->session_timer_.cancel();
+            self->state_ = closing;
+            error_code ec;
+            beast::get_lowest_layer(self->stream_).close(ec);
+        }));
+}
+
 void
 connection_impl::handle_stop(websocket::close_reason reason)
 {
@@ -70,7 +176,7 @@ connection_impl::handle_stop(websocket::close_reason reason)
     if (state_ == handshaking)
     {
         error_code ec;
-        stream_.next_layer().close(ec);
+        beast::get_lowest_layer(stream_).close(ec);
     }
     else if (state_ == chatting)
     {
@@ -78,7 +184,7 @@ connection_impl::handle_stop(websocket::close_reason reason)
             // very important that we captured self here!
             // the websocket stream must stay alive while
             // there is an outstanding async op
-            std::cout << "result of close: " << ec.message() << std::endl;
+            UTIL_LOG_DEBUG("result of close: ", ec.message());
         });
     }
     else if (state_ == closing)
@@ -91,25 +197,49 @@ connection_impl::initiate_rx()
 {
     assert(state_ == chatting);
     assert(!ec_);
-    stream_.async_read(rxbuffer_,
-                       [self = this->shared_from_this()](
-                           error_code ec, std::size_t bytes_transferred) {
-                           self->handle_rx(ec, bytes_transferred);
-                       });
+    beast_fun_times::util::async_read_message(
+        stream_,
+        rxbuffer_,
+        [self = this->shared_from_this()](error_code  ec,
+                                          std::size_t bytes_transferred) {
+            self->handle_rx(ec, bytes_transferred);
+        });
 }
 void
 connection_impl::handle_rx(error_code ec, std::size_t bytes_transferred)
 {
     if (ec)
     {
-        std::cout << "rx error: " << ec.message() << std::endl;
+        // a close, by either side, is not news
+        if (ec == websocket::error::closed ||
+            ec == net::error::operation_aborted)
+            UTIL_LOG_DEBUG("rx error: ", ec.message());
+        else
+            std::cout << "rx error: " << ec.message() << std::endl;
+
+        // the connection is finished. Don't let the session timer keep it
+        // alive.
+        if (!ec_)
+            ec_ = ec;
+        session_timer_.cancel();
+    }
+    else if (ec_)
+    {
+        // we are closing. The websocket close reads what is left until the
+        // peer's close frame arrives, so no more reads are started, nor
+        // echoes sent.
     }
     else
     {
-        // handle the read here
-        auto message = beast::buffers_to_string(rxbuffer_.data());
-        std::cout << " received: " << message << "\n";
-        rxbuffer_.consume(message.size());
+        // handle the read here. The message is sent back in the buffer it
+        // arrived in, and the next message is read into a recycled one.
+        quiet_ = false;
+
+        auto &metrics = beast_fun_times::util::server_metrics::local();
+        metrics.messages_in.add();
+        metrics.bytes_in.add(bytes_transferred);
+        auto message = beast_fun_times::util::shared_message::take(rxbuffer_);
+        UTIL_LOG_TRACE("received: ", message.view());
 
         // keep reading until error
         initiate_rx();
@@ -119,8 +249,21 @@ connection_impl::handle_rx(error_code ec, std::size_t bytes_transferred)
         send(std::move(message));
     }
 }
+bool
+connection_impl::hibernate_if_quiet()
+{
+    if (!std::exchange(quiet_, true))
+        return false;
+    auto rx = rxbuffer_.hibernate();
+    auto tx = stream_.next_layer().shrink_to_fit();
+    if (!rx && !tx)
+        return false;
+    beast_fun_times::util::server_metrics::local().hibernations.add();
+    return true;
+}
+
 void
-connection_impl::send(std::string msg)
+connection_impl::send(beast_fun_times::util::shared_message msg)
 {
     net::dispatch(net::bind_executor(
         stream_.get_executor(),
@@ -130,9 +273,17 @@ connection_impl::send(std::string msg)
 }
 
 void
-connection_impl::handle_send(std::string msg)
+connection_impl::send(std::string msg)
 {
-    tx_queue_.push(std::move(msg));
+    send(beast_fun_times::util::shared_message(std::move(msg)));
+}
+
+void
+connection_impl::handle_send(beast_fun_times::util::shared_message msg,
+                             std::size_t                           lane)
+{
+    tx_queue_.push(std::move(msg), lane);
+    beast_fun_times::util::server_metrics::local().queued.add(1);
     maybe_send_next();
 }
 
@@ -152,9 +303,17 @@ connection_impl::initiate_tx()
     assert(!ec_);
     assert(!tx_queue_.empty());
 
+    // more than one message waiting: stage their frames and send them
+    // together when the queue runs dry
+    if (tx_queue_.size() > 1)
+        stream_.next_layer().cork();
+
     sending_state_ = sending;
+    tx_current_    = std::move(tx_queue_.front());
+    tx_queue_.pop();
+    beast_fun_times::util::server_metrics::local().queued.add(-1);
     stream_.async_write(
-        net::buffer(tx_queue_.front()),
+        tx_current_,
         [self = shared_from_this()](error_code ec, std::size_t) {
             // we don't care about bytes_transferred
             self->handle_tx(ec);
@@ -165,12 +324,48 @@ connection_impl::handle_tx(error_code ec)
 {
     if (ec)
     {
-        std::cout << "failed to send message: " << tx_queue_.front()
+        std::cout << "failed to send message: " << tx_current_.view()
                   << " because " << ec.message() << std::endl;
     }
     else
     {
-        tx_queue_.pop();
+        auto &metrics = beast_fun_times::util::server_metrics::local();
+        metrics.messages_out.add();
+        metrics.bytes_out.add(tx_current_.size());
+
+        // let go of a payload which may be shared with other connections
+        tx_current_    = {};
+        sending_state_ = send_idle;
+    }
+
+    // flush the staged frames once the batch is done. Do so even on error,
+    // as a close frame may be staged behind them.
+    if (stream_.next_layer().corked() && (ec || ec_ || tx_queue_.empty()))
+        initiate_uncork();
+    else if (!ec)
+        maybe_send_next();
+}
+
+void
+connection_impl::initiate_uncork()
+{
+    sending_state_ = sending;
+    stream_.next_layer().async_uncork(
+        [self = shared_from_this()](error_code ec) {
+            self->handle_uncork(ec);
+        });
+}
+
+void
+connection_impl::handle_uncork(error_code ec)
+{
+    if (ec)
+    {
+        std::cout << "failed to send messages because " << ec.message()
+                  << std::endl;
+    }
+    else
+    {
         sending_state_ = send_idle;
         maybe_send_next();
     }
@@ -198,9 +393,9 @@ connection_impl::handle_timer()
 
     if (time_remaining_.count())
     {
-        std::ostringstream ss;
-        ss << time_remaining_.count() << " seconds remaining";
-        handle_send(ss.str());
+        handle_send(beast_fun_times::util::make_message(
+                        time_remaining_.count(), " seconds remaining"),
+                    tx_queue::urgent_lane);
         initiate_timer();
     }
     else
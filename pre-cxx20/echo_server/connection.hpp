@@ -1,29 +1,63 @@
 #pragma once
 
 #include "config.hpp"
+#include "util/coalescing_stream.hpp"
+#include "util/hibernating_buffer.hpp"
+#include "util/lane_queue.hpp"
+#include "util/poly_handler.hpp"
+#include "util/shared_message.hpp"
+#include "util/wheel_timer.hpp"
 
-#include <deque>
 #include <memory>
-#include <queue>
+#include <optional>
 
 namespace project {
 
 struct connection_impl : std::enable_shared_from_this< connection_impl >
 {
+    // a burst of queued messages leaves in one write to the socket
     using transport = net::ip::tcp::socket;
-    using stream    = websocket::stream< transport >;
+    using stream    = websocket::stream<
+        beast_fun_times::util::coalescing_stream< transport > >;
+
+    // session notices go in the urgent lane, so that they are not held up
+    // behind a backlog of echoes. Payloads are shared, so a message sent to
+    // many connections is not copied for each.
+    using tx_queue =
+        beast_fun_times::util::lane_queue< beast_fun_times::util::shared_message >;
 
     connection_impl(net::ip::tcp::socket sock);
 
+    ~connection_impl();
+
     void
     run();
 
     void
     stop();
 
+    /// Close the socket at once, without a websocket close handshake. For
+    /// connections which have not closed by the server's drain deadline.
+    void
+    abort();
+
+    void
+    send(beast_fun_times::util::shared_message msg);
+
     void
     send(std::string msg);
 
+    /// Give back the receive and staging buffers if nothing has been
+    /// received since the last call. Must be called on the connection's
+    /// executor. Returns true if anything was given back.
+    bool
+    hibernate_if_quiet();
+
+    /// Set a function to be called once, when the connection has closed and
+    /// is destroyed
+    void
+    on_close(beast_fun_times::util::poly_handler< void() > f);
+
   private:
     void
     handle_run();
@@ -32,9 +66,18 @@ struct connection_impl : std::enable_shared_from_this< connection_impl >
     handle_stop(
         websocket::close_reason reason = websocket::close_code::going_away);
 
+    void
+    handle_request(error_code ec);
+
     void
     handle_accept(error_code ec);
 
+    void
+    initiate_http_response();
+
+    void
+    handle_http_response(error_code ec);
+
     void
     initiate_rx();
 
@@ -48,7 +91,8 @@ struct connection_impl : std::enable_shared_from_this< connection_impl >
     handle_timer();
 
     void
-    handle_send(std::string s);
+    handle_send(beast_fun_times::util::shared_message msg,
+                std::size_t lane = tx_queue::bulk_lane);
 
     void
     maybe_send_next();
@@ -59,20 +103,42 @@ struct connection_impl : std::enable_shared_from_this< connection_impl >
     void
     handle_tx(error_code ec);
 
+    void
+    initiate_uncork();
+
+    void
+    handle_uncork(error_code ec);
+
   private:
-    stream            stream_;
-    net::steady_timer session_timer_;
+    stream stream_;
+
+    // one of many thousands of long, coarse timers: it goes on the wheel
+    beast_fun_times::util::wheel_timer session_timer_;
 
     std::chrono::seconds time_remaining_;
 
-    beast::flat_buffer rxbuffer_;
+    // holds no storage while waiting for a message to start, once the
+    // connection has hibernated
+    beast_fun_times::util::hibernating_buffer rxbuffer_;
+
+    // nothing has been received since the last hibernate_if_quiet
+    bool quiet_ = false;
 
-    // elements in a std deque have a stable address, so this means we don't
-    // need t make copies of messages
-    std::queue< std::string, std::deque< std::string > > tx_queue_;
+    // The handshake request is read here first, so that a plain HTTP request
+    // can be answered on the websocket port. A small body is allowed for, so
+    // that a request such as POST /metrics is refused rather than failing to
+    // parse. It is let go once the handshake is done.
+    std::optional< http::request_parser< http::string_body > > request_;
+
+    // The message being written is moved out of the queue, so that it cannot
+    // be overtaken part way through by an urgent message.
+    tx_queue                              tx_queue_;
+    beast_fun_times::util::shared_message tx_current_;
 
     error_code ec_;
 
+    beast_fun_times::util::poly_handler< void() > on_close_;
+
     enum
     {
         handshaking,
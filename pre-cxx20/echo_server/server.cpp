@@ -1,10 +1,20 @@
 #include "server.hpp"
 
+#include "util/drain.hpp"
+#include "util/message_builder.hpp"
+#include "util/server_metrics.hpp"
+
+#include <chrono>
 #include <iostream>
+#include <utility>
+#include <vector>
 
 namespace project {
 server::server(net::any_io_executor exec)
 : acceptor_(exec)
+, connections_(std::make_shared< connection_registry >())
+, hibernation_(beast_fun_times::util::hibernation_settings::from_env())
+, hibernate_timer_(exec)
 {
     auto ep = net::ip::tcp::endpoint(net::ip::address_v4::any(), 4321);
     std::cout << "websocket chat server listening on " << ep << "\n";
@@ -33,6 +43,8 @@ server::handle_run()
 {
     ec_.clear();
     initiate_accept();
+    if (hibernation_.enabled())
+        initiate_hibernate();
 }
 
 void
@@ -60,17 +72,34 @@ server::handle_accept(error_code ec, net::ip::tcp::socket sock)
         // no error
         initiate_accept();
 
+        beast_fun_times::util::server_metrics::local().accepted.add();
         auto ep   = sock.remote_endpoint();
         auto conn = std::make_shared< connection_impl >(std::move(sock));
-        // cache the connection
-        connections_[ep] = conn;
+        // cache the connection until it closes
+        auto handle = connections_->insert({ ep, conn });
+        conn->on_close(
+            [registry = std::weak_ptr(connections_), handle] {
+                if (auto r = registry.lock())
+                    r->erase(handle);
+            });
         conn->run();
-        conn->send("Welcome to my websocket server!\n");
-        conn->send("You are visitor number " +
-                   std::to_string(connections_.size()) + "\n");
-        conn->send("You connected from " + ep.address().to_string() + ":" +
-                   std::to_string(ep.port()) + "\n");
-        conn->send("Be good!\n");
+
+        // greetings which are the same for everyone are built once and
+        // shared. The rest are built into recycled buffers.
+        using beast_fun_times::util::make_message;
+        using beast_fun_times::util::shared_message;
+        static auto const welcome =
+            shared_message("Welcome to my websocket server!\n");
+        static auto const be_good = shared_message("Be good!\n");
+        conn->send(welcome);
+        conn->send(make_message("You are visitor number ",
+                                ++visitors_,
+                                " (",
+                                connections_->size(),
+                                " connected)\n"));
+        conn->send(make_message(
+            "You connected from ", ep.address(), ':', ep.port(), '\n'));
+        conn->send(be_good);
     }
 }
 void
@@ -80,17 +109,66 @@ server::initiate_accept()
         this->handle_accept(ec, std::move(sock));
     });
 }
+void
+server::initiate_hibernate()
+{
+    hibernate_timer_.expires_after(hibernation_.quiet_period);
+    hibernate_timer_.async_wait(
+        [this](error_code ec) { this->handle_hibernate(ec); });
+}
+
+void
+server::handle_hibernate(error_code ec)
+{
+    if (ec || ec_)
+        return;
+
+    // a connection is quiet if it has received nothing in one whole period,
+    // so it hibernates between one and two periods after its last message
+    for (auto &c : *connections_)
+        if (auto conn = c.conn.lock())
+            conn->hibernate_if_quiet();
+    initiate_hibernate();
+}
+
 void
 server::handle_stop()
 {
+    // stop accepting first, so that the drain is not chasing new arrivals
     ec_ = net::error::operation_aborted;
-    acceptor_.cancel();
-    for (auto &[ep, weak_conn] : connections_)
-        if (auto conn = weak_conn.lock())
-        {
-            std::cout << "stopping connection on " << ep << std::endl;
-            conn->stop();
-        }
-    connections_.clear();
+    error_code ec;
+    acceptor_.close(ec);
+    hibernate_timer_.cancel();
+
+    // Connections erase themselves from the registry as they close, so the
+    // drain works from a snapshot of it
+    auto live = std::vector< std::weak_ptr< connection_impl > >();
+    live.reserve(connections_->size());
+    for (auto &c : *connections_)
+        live.push_back(c.conn);
+    std::cout << "draining " << live.size() << " connections" << std::endl;
+
+    // DRAIN_BATCH_SIZE and DRAIN_TIMEOUT_MS tune the drain
+    using beast_fun_times::util::drain_progress;
+    auto settings = beast_fun_times::util::drain_settings::from_env();
+    auto ms       = [](auto d) {
+        return std::chrono::duration_cast< std::chrono::milliseconds >(d)
+            .count();
+    };
+    beast_fun_times::util::async_drain(
+        acceptor_.get_executor(),
+        std::move(live),
+        settings,
+        std::chrono::steady_clock::now() + settings.timeout,
+        [ms](drain_progress const &p) {
+            std::cout << "draining: " << p.closed << " of " << p.total
+                      << " closed, " << p.stopping << " asked to close, "
+                      << ms(p.elapsed) << "ms" << std::endl;
+        },
+        [ms](drain_progress p) {
+            std::cout << "drained " << p.total << " connections in "
+                      << ms(p.elapsed) << "ms, " << p.aborted
+                      << " closed hard at the deadline" << std::endl;
+        });
 }
-}   // namespace project
\ No newline at end of file
+}   // namespace project
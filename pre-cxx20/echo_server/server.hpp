@@ -3,35 +3,17 @@
 #include "config.hpp"
 #include "connection.hpp"
 
-#include <boost/functional/hash.hpp>
-#include <unordered_map>
+#include "util/hibernating_buffer.hpp"
+#include "util/slab_registry.hpp"
+#include "util/wheel_timer.hpp"
 
-namespace project {
-struct endpoint_hasher
-{
-    void
-    combine(std::size_t &seed, net::ip::address const &v) const
-    {
-        if (v.is_v4())
-            boost::hash_combine(seed, v.to_v4().to_bytes());
-        else if (v.is_v6())
-            boost::hash_combine(seed, v.to_v6().to_bytes());
-        else if (v.is_unspecified())
-            boost::hash_combine(seed, 0x4751301174351161ul);
-        else
-            boost::hash_combine(seed, v.to_string());
-    }
-
-    std::size_t
-    operator()(net::ip::tcp::endpoint const &ep) const
-    {
-        std::size_t seed = 0;
-        boost::hash_combine(seed, ep.port());
-        combine(seed, ep.address());
-        return seed;
-    }
-};
+#include <cstdint>
+#include <memory>
 
+namespace project {
+/// Connections which stay quiet for HIBERNATE_AFTER_MS (10s by default, 0 for
+/// never) give back their receive and staging buffers until their next
+/// message.
 struct server
 {
     server(net::any_io_executor exec);
@@ -55,13 +37,32 @@ struct server
     void
     handle_accept(error_code ec, net::ip::tcp::socket sock);
 
+    void
+    initiate_hibernate();
+    void
+    handle_hibernate(error_code ec);
+
+  private:
+    struct registered_connection
+    {
+        net::ip::tcp::endpoint           ep;
+        std::weak_ptr< connection_impl > conn;
+    };
+
+    // Connections erase themselves when they close. The registry is shared
+    // with them so that one which outlives the server does not touch it.
+    using connection_registry =
+        beast_fun_times::util::slab_registry< registered_connection >;
+
   private:
-    net::ip::tcp::acceptor acceptor_;
-    std::unordered_map< net::ip::tcp::endpoint,
-                        std::weak_ptr< connection_impl >,
-                        endpoint_hasher,
-                        std::equal_to<> >
-               connections_;
-    error_code ec_;
+    net::ip::tcp::acceptor                 acceptor_;
+    std::shared_ptr< connection_registry > connections_;
+    std::uint64_t                          visitors_ = 0;
+
+    // wakes every quiet period to hibernate the connections which were
+    // quiet for all of it
+    beast_fun_times::util::hibernation_settings hibernation_;
+    beast_fun_times::util::wheel_timer          hibernate_timer_;
+    error_code                             ec_;
 };
 }   // namespace project
\ No newline at end of file
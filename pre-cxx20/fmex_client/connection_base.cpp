@@ -1,6 +1,7 @@
 #include "connection_base.hpp"
 
 #include "connect_transport_op.hpp"
+#include "util/log.hpp"
 
 #define FMT_HEADER_ONLY
 #include <fmt/color.h>
@@ -63,8 +64,11 @@ namespace project
     void
     ConnectionBase::enter_read_state()
     {
-        ws.async_read(
-            buffer, beast::bind_front_handler(&ConnectionBase::on_read, this));
+        // the buffer borrows from the pool only while a frame is arriving
+        beast_fun_times::util::async_read_message(
+            ws,
+            buffer,
+            beast::bind_front_handler(&ConnectionBase::on_read, this));
     }
     void
     ConnectionBase::on_read(beast::error_code ec, std::size_t bytes_transferred)
@@ -75,12 +79,16 @@ namespace project
         {
             return fail(name, ec, "read");
         }
-        succeed(name, "read");
+        UTIL_LOG_TRACE(name, ": read");
 
         int64_t now = std::chrono::duration_cast< std::chrono::milliseconds >(
                           std::chrono::system_clock::now().time_since_epoch())
                           .count();
-        fmt::print("received: {}\n", beast::buffers_to_string(buffer.data()));
+        UTIL_LOG_TRACE("received: ", [&] {
+            auto d = buffer.data();
+            return std::string_view(static_cast< const char * >(d.data()),
+                                    d.size());
+        }());
 
         try
         {
@@ -90,6 +98,7 @@ namespace project
                     reinterpret_cast< const char * >(d.data()), d.size());
             }());
             buffer.consume(buffer.size());
+            buffer.hibernate();
             enter_read_state();
         }
         catch (system_error &se)
@@ -125,9 +134,9 @@ namespace project
     }
 
     void
-    ConnectionBase::notify_send(std::string frame)
+    ConnectionBase::notify_send(std::string frame, std::size_t lane)
     {
-        tx_queue_.push_back(std::move(frame));
+        tx_queue_.push(std::move(frame), lane);
         if (send_state_ == send_idle)
         {
             initiate_send();
@@ -140,9 +149,11 @@ namespace project
         assert(!tx_queue_.empty());
         send_state_ = send_sending;
 
-        // write the data at the front of the queue
+        // take the most urgent frame and write it
+        tx_current_ = std::move(tx_queue_.front());
+        tx_queue_.pop();
         ws.async_write(
-            boost::asio::buffer(tx_queue_.front()),
+            boost::asio::buffer(tx_current_),
             beast::bind_front_handler(&ConnectionBase::on_write, this));
     }
     void
@@ -152,10 +163,9 @@ namespace project
         boost::ignore_unused(bytes_transferred);
 
         // whether there was an error or not, set the state to idle
-        // and remove the previous frame from the send queue
+        // and discard the previous frame
         send_state_ = send_idle;
-        assert(!tx_queue_.empty());
-        tx_queue_.pop_front();
+        tx_current_.clear();
 
         // error check
         if (ec)
@@ -1,9 +1,10 @@
 #pragma once
 #include "config.hpp"
 #include "stop_register.hpp"
+#include "util/hibernating_buffer.hpp"
+#include "util/lane_queue.hpp"
 
 #include <boost/beast/core.hpp>
-#include <deque>
 
 namespace project
 {
@@ -18,12 +19,19 @@ namespace project
         executor_type exec_;
 
         websocket::stream< beast::ssl_stream< beast::tcp_stream > > ws;
-        beast::flat_buffer                                          buffer {};
+        beast_fun_times::util::hibernating_buffer                   buffer {};
 
-        // A queue of text frames to send. Note that a std::deque's elements
-        // have a stable address even after insertion/removal. This means we can
-        // reliably use front() and back() during async operations
-        std::deque< std::string > tx_queue_ {};
+      protected:
+        // Pings go in the urgent lane so that a backlog of requests cannot
+        // delay them past the exchange's keepalive timeout
+        using tx_queue = beast_fun_times::util::lane_queue< std::string >;
+
+      private:
+        // A queue of text frames to send. The frame being written is moved out
+        // of the queue into tx_current_, so that an urgent frame cannot
+        // overtake it part way through
+        tx_queue    tx_queue_ {};
+        std::string tx_current_ {};
 
         //
         // Record the state of the "send" orthogonal region
@@ -112,7 +120,8 @@ namespace project
         //
 
         void
-        notify_send(std::string frame);
+        notify_send(std::string frame,
+                    std::size_t lane = tx_queue::bulk_lane);
 
       private:
         void
@@ -1,5 +1,6 @@
 #pragma once
 #include "connection_base.hpp"
+#include "util/wheel_timer.hpp"
 
 namespace project
 {
@@ -67,7 +68,7 @@ namespace project
         // JSON ping is an orthogonal region, active while there is a connection
         //
 
-        boost::asio::high_resolution_timer ping_timer_;
+        beast_fun_times::util::basic_wheel_timer< executor_type > ping_timer_;
 
         enum ping_state
         {
@@ -133,8 +134,9 @@ namespace project
                 { "id", "random_id.me.hk" }
             };
 
-            // send the "send" event into the "send" orthogonal region
-            notify_send(j_out.dump());
+            // send the "send" event into the "send" orthogonal region, ahead of
+            // any queued requests
+            notify_send(j_out.dump(), tx_queue::urgent_lane);
 
             // and re-enter the waiting state
             ping_enter_waiting_state();
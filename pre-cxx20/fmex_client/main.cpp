@@ -1,5 +1,6 @@
 #include "config.hpp"
 #include "fmex_connection.hpp"
+#include "util/log.hpp"
 
 namespace project
 {
@@ -82,6 +83,9 @@ main(int argc, char const *argv[])
 {
     using namespace project;
 
+    // per-frame logging is at trace level: LOG_LEVEL=trace to see it
+    beast_fun_times::util::log_sink::instance().set_level_from_env();
+
     net::io_context ioc;
 
     ssl::context ctx { ssl::context::tlsv12_client };
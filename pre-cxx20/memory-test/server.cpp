@@ -15,14 +15,26 @@
 //----
 //--------------------------------------------------------------------------------------------------------
 
+#include "util/deflate_settings.hpp"
+#include "util/hibernating_buffer.hpp"
+#include "util/metrics_response.hpp"
+#include "util/server_metrics.hpp"
+
 #include <algorithm>
+#include <atomic>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/strand.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <ctime>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <string>
 #include <thread>
 #include <vector>
@@ -32,6 +44,7 @@ namespace http      = beast::http;        // from <boost/beast/http.hpp>
 namespace websocket = beast::websocket;   // from <boost/beast/websocket.hpp>
 namespace net       = boost::asio;        // from <boost/asio.hpp>
 using tcp           = boost::asio::ip::tcp;   // from <boost/asio/ip/tcp.hpp>
+namespace util      = beast_fun_times::util;
 
 //----
 //--------------------------------------------------------------------------------------------------------
@@ -43,17 +56,75 @@ fail(beast::error_code ec, char const *what)
     std::cerr << what << ": " << ec.message() << "\n";
 }
 
+// A tcp_stream rate policy which limits nothing, but counts the bytes
+// written, after compression, so that what deflate saves can be set against
+// the CPU it costs
+class wire_counter
+{
+    friend class beast::rate_policy_access;
+
+    std::size_t
+    available_read_bytes() const noexcept
+    {
+        return (std::numeric_limits< std::size_t >::max)();
+    }
+
+    std::size_t
+    available_write_bytes() const noexcept
+    {
+        return (std::numeric_limits< std::size_t >::max)();
+    }
+
+    void
+    transfer_read_bytes(std::size_t) const noexcept
+    {
+    }
+
+    void
+    transfer_write_bytes(std::size_t n) const noexcept
+    {
+        bytes_out.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void
+    on_timer() const noexcept
+    {
+    }
+
+  public:
+    static inline std::atomic< std::uint64_t > bytes_out { 0 };
+};
+
+using wire_stream =
+    beast::basic_stream< tcp, net::any_io_executor, wire_counter >;
+
 // Echoes back all received WebSocket messages
 class session : public std::enable_shared_from_this< session >
 {
-    websocket::stream< beast::tcp_stream > ws_;
-    beast::flat_buffer                     buffer_;
+    websocket::stream< wire_stream > ws_;
+
+    // Holds no storage between messages, however big the last one was, so
+    // that an idle session costs as little as it can
+    util::hibernating_buffer buffer_;
+
+    // The handshake request, read first so that a plain HTTP request can be
+    // answered on the websocket port. A small body is allowed for, so that a
+    // request such as POST /metrics is refused rather than failing to parse.
+    std::optional< http::request_parser< http::string_body > > req_;
+
+    util::deflate_settings deflate_;
 
   public:
     // Take ownership of the socket
-    explicit session(tcp::socket &&socket)
+    session(tcp::socket &&socket, util::deflate_settings const &deflate)
     : ws_(std::move(socket))
+    , deflate_(deflate)
+    {
+    }
+
+    ~session()
     {
+        util::server_metrics::local().closed.add();
     }
 
     // Start the asynchronous operation
@@ -72,21 +143,75 @@ class session : public std::enable_shared_from_this< session >
                             " websocket-server-async");
             }));
 
-        boost::beast::websocket::permessage_deflate opt;
-        opt.server_enable = true;
+        // Offer compression, with the deployment's level and window
+        ws_.set_option(deflate_.server_option());
+
+        // Read the handshake request, in the time the websocket would allow
+        // for the whole handshake
+        ws_.next_layer().expires_after(std::chrono::seconds(30));
+        req_.emplace();
+        req_->body_limit(util::max_http_request_body);
+        http::async_read(
+            ws_.next_layer(),
+            buffer_,
+            *req_,
+            beast::bind_front_handler(&session::on_request, shared_from_this()));
+    }
+
+    void
+    on_request(beast::error_code ec, std::size_t)
+    {
+        if (ec)
+        {
+            util::server_metrics::local().handshake_failures.add();
+            return fail(ec, "request");
+        }
+
+        // Anything but a websocket upgrade gets a plain HTTP answer, such as
+        // the metrics for GET /metrics
+        if (not websocket::is_upgrade(req_->get()))
+            return do_respond();
 
-        ws_.set_option(opt);
+        // Turn off the timeout on the tcp_stream, because the websocket
+        // stream has its own timeout system
+        ws_.next_layer().expires_never();
 
-        // Accept the websocket handshake
+        // Accept the websocket handshake. The request's storage is not
+        // needed again until the first message.
+        buffer_.consume(buffer_.size());
+        buffer_.hibernate();
         ws_.async_accept(
+            req_->get(),
             beast::bind_front_handler(&session::on_accept, shared_from_this()));
     }
 
+    void
+    do_respond()
+    {
+        auto res = std::make_shared< http::response< http::string_body > >(
+            util::metrics_response(
+                req_->get(), util::server_metrics::instance().snapshot()));
+        http::async_write(
+            ws_.next_layer(),
+            *res,
+            [self = shared_from_this(), res](beast::error_code ec,
+                                             std::size_t) {
+                if (ec)
+                    return fail(ec, "respond");
+                self->ws_.next_layer().socket().shutdown(
+                    tcp::socket::shutdown_send, ec);
+            });
+    }
+
     void
     on_accept(beast::error_code ec)
     {
+        req_.reset();
         if (ec)
+        {
+            util::server_metrics::local().handshake_failures.add();
             return fail(ec, "accept");
+        }
 
         // Read a message
         do_read();
@@ -95,8 +220,10 @@ class session : public std::enable_shared_from_this< session >
     void
     do_read()
     {
-        // Read a message into our buffer
-        ws_.async_read(
+        // Read a message into our buffer, which takes storage only once the
+        // message starts to arrive
+        util::async_read_message(
+            ws_,
             buffer_,
             beast::bind_front_handler(&session::on_read, shared_from_this()));
     }
@@ -104,8 +231,6 @@ class session : public std::enable_shared_from_this< session >
     void
     on_read(beast::error_code ec, std::size_t bytes_transferred)
     {
-        boost::ignore_unused(bytes_transferred);
-
         // This indicates that the session was closed
         if (ec == websocket::error::closed)
             return;
@@ -113,7 +238,12 @@ class session : public std::enable_shared_from_this< session >
         if (ec)
             fail(ec, "read");
 
-        // Echo the message
+        auto &metrics = util::server_metrics::local();
+        metrics.messages_in.add();
+        metrics.bytes_in.add(bytes_transferred);
+
+        // Echo the message. Once permessage-deflate has been negotiated,
+        // every message is compressed.
         ws_.text(ws_.got_text());
         ws_.async_write(
             buffer_.data(),
@@ -123,13 +253,17 @@ class session : public std::enable_shared_from_this< session >
     void
     on_write(beast::error_code ec, std::size_t bytes_transferred)
     {
-        boost::ignore_unused(bytes_transferred);
-
         if (ec)
             return fail(ec, "write");
 
-        // Clear the buffer
+        auto &metrics = util::server_metrics::local();
+        metrics.messages_out.add();
+        metrics.bytes_out.add(bytes_transferred);
+
+        // Clear the buffer, and give its storage back while we wait
         buffer_.consume(buffer_.size());
+        if (buffer_.hibernate())
+            metrics.hibernations.add();
 
         // Do another read
         do_read();
@@ -142,13 +276,17 @@ class session : public std::enable_shared_from_this< session >
 // Accepts incoming connections and launches the sessions
 class listener : public std::enable_shared_from_this< listener >
 {
-    net::io_context &ioc_;
-    tcp::acceptor    acceptor_;
+    net::io_context &      ioc_;
+    tcp::acceptor          acceptor_;
+    util::deflate_settings deflate_;
 
   public:
-    listener(net::io_context &ioc, tcp::endpoint endpoint)
+    listener(net::io_context &             ioc,
+             tcp::endpoint                 endpoint,
+             util::deflate_settings const &deflate)
     : ioc_(ioc)
     , acceptor_(ioc)
+    , deflate_(deflate)
     {
         beast::error_code ec;
 
@@ -211,8 +349,10 @@ class listener : public std::enable_shared_from_this< listener >
         }
         else
         {
+            util::server_metrics::local().accepted.add();
+
             // Create the session and run it
-            std::make_shared< session >(std::move(socket))->run();
+            std::make_shared< session >(std::move(socket), deflate_)->run();
         }
 
         // Accept another connection
@@ -223,6 +363,64 @@ class listener : public std::enable_shared_from_this< listener >
 //----
 //--------------------------------------------------------------------------------------------------------
 
+// Every so often, reports the bytes of messages sent, the bytes they took on
+// the wire and the CPU spent, so that deflate settings can be compared
+class deflate_report : public std::enable_shared_from_this< deflate_report >
+{
+    net::steady_timer      timer_;
+    util::deflate_settings deflate_;
+    std::uint64_t          payload_ = 0;
+    std::uint64_t          wire_    = 0;
+    std::clock_t           cpu_     = std::clock();
+
+  public:
+    deflate_report(net::io_context &ioc, util::deflate_settings const &deflate)
+    : timer_(ioc)
+    , deflate_(deflate)
+    {
+    }
+
+    void
+    run()
+    {
+        timer_.expires_after(std::chrono::seconds(10));
+        timer_.async_wait(beast::bind_front_handler(&deflate_report::on_timer,
+                                                    shared_from_this()));
+    }
+
+  private:
+    void
+    on_timer(beast::error_code ec)
+    {
+        if (ec)
+            return;
+
+        auto payload = util::server_metrics::instance().snapshot().bytes_out;
+        auto wire    = wire_counter::bytes_out.load(std::memory_order_relaxed);
+        auto cpu     = std::clock();
+
+        // an idle server has nothing to say
+        if (payload != payload_)
+        {
+            auto sent    = payload - payload_;
+            auto on_wire = wire - wire_;
+            std::cout << "deflate level " << deflate_.level << ": " << sent
+                      << " bytes of messages took " << on_wire
+                      << " bytes on the wire ("
+                      << (sent ? 100.0 * double(on_wire) / double(sent) : 0.0)
+                      << "%), " << double(cpu - cpu_) / CLOCKS_PER_SEC
+                      << "s CPU\n";
+        }
+        payload_ = payload;
+        wire_    = wire;
+        cpu_     = cpu;
+        run();
+    }
+};
+
+//----
+//--------------------------------------------------------------------------------------------------------
+
 int
 main(int argc, char *argv[])
 {
@@ -233,8 +431,15 @@ main(int argc, char *argv[])
     // The io_context is required for all I/O
     net::io_context ioc { threads };
 
+    // Compression level, window and memory come from the environment
+    auto const deflate = util::deflate_settings::from_env();
+
     // Create and launch a listening port
-    std::make_shared< listener >(ioc, tcp::endpoint { address, port })->run();
+    std::make_shared< listener >(ioc, tcp::endpoint { address, port }, deflate)
+        ->run();
+
+    // Report what compression costs and saves
+    std::make_shared< deflate_report >(ioc, deflate)->run();
 
     // Run the I/O service on the requested number of threads
     std::vector< std::thread > v;